@@ -0,0 +1,287 @@
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "mod1.hpp"
+#include "Terrain.hpp"
+#include "Water.hpp"
+#include "WaterKernels.hpp"
+#include "Scene.hpp"
+
+// benchmark defaults, grid sizes in water columns per side
+#define BENCH_DEF_MAP "asset/map/example1.mod1"
+#define BENCH_DEF_MIN_SIZE 64
+#define BENCH_DEF_MAX_SIZE 4096
+#define BENCH_DEF_STEPS 100
+#define BENCH_DEF_DT 0.016
+#define BENCH_DEF_BLOCK_STEPS 1
+
+/**
+ * @brief Benchmark command line options
+ */
+struct	BenchOptions {
+	std::string	mapPath;  /**< Map used by every run */
+	uint32_t	minSize;  /**< Smallest grid size, doubled up to maxSize */
+	uint32_t	maxSize;  /**< Largest grid size */
+	uint32_t	steps;  /**< Updates per run */
+	float		dt;  /**< Update delta time */
+	uint32_t	blockSteps;  /**< Substeps per sweep of the extra limited runs, 1 for none */
+	std::string	outPath;  /**< JSON output file, empty for stdout */
+};
+
+/**
+ * @brief Nominal bytes streamed per cell by one pass of each phase
+ *
+ * Planes read and written per column, plus the vertices written per vertex
+ * for the mesh phases. Divide by ns/cell to get the bandwidth. The state
+ * planes (depth and flows) use the WaterValue storage size.
+ */
+static uint32_t	phaseBytes(WaterPhase::Enum phase, bool limited) {
+	uint32_t f = sizeof(float);
+	uint32_t w = sizeof(WaterValue);
+	switch (phase) {
+		case WaterPhase::FLOW:  // read depth and terrain, update both flows
+			return w + f + 4 * w;
+		case WaterPhase::LIMIT:  // limiter: read depth and flows, write the out scale
+			// iterative: the same, then read the scale and update both flows
+			return limited ? 3 * w + f : 3 * w + f + f + 4 * w;
+		case WaterPhase::DEPTH:  // read the flows (and the out scale), update depth
+			return (limited ? 2 * w + f : 2 * w) + 2 * w;
+		case WaterPhase::SWEEP:  // the flow, limit and depth phases, per substep
+			return phaseBytes(WaterPhase::FLOW, true) + phaseBytes(WaterPhase::LIMIT, true)
+				+ phaseBytes(WaterPhase::DEPTH, true);
+		case WaterPhase::ACTIVITY:  // read the flows and depth
+			return 3 * w;
+		case WaterPhase::MESH:  // read depth and terrain, write the vertex twice
+			return w + f + 2 * sizeof(WaterVert);
+		case WaterPhase::BORDER:  // read depth and terrain, write the top and bottom vertices
+			return w + f + 2 * sizeof(WaterVert);
+		default:
+			return 0;
+	}
+}
+
+static bool	benchUsage() {
+	std::cout << "usage: ./mod1_bench [--min-size <n>] [--max-size <n>] [--steps <n>] [--dt <s>] "
+		"[--block-steps <n>] [-o <file.json>] [map.mod1]" << std::endl;
+	std::cout << "  --min-size <n>: smallest grid size, doubled up to max-size (default "
+		<< BENCH_DEF_MIN_SIZE << ")" << std::endl;
+	std::cout << "  --max-size <n>: largest grid size (default " << BENCH_DEF_MAX_SIZE << ")" << std::endl;
+	std::cout << "  --steps <n>: updates per run (default " << BENCH_DEF_STEPS << ")" << std::endl;
+	std::cout << "  --dt <s>: update delta time (default " << BENCH_DEF_DT << ")" << std::endl;
+	std::cout << "  --block-steps <n>: also run the limited cases with n substeps per sweep"
+		" (default " << BENCH_DEF_BLOCK_STEPS << ", none)" << std::endl;
+	std::cout << "  -o <file.json>: write the results in a file instead of stdout" << std::endl;
+	std::cout << "  map.mod1: map used by every run (default " << BENCH_DEF_MAP << ")" << std::endl;
+	return false;
+}
+
+static bool	benchArgParse(int nbArgs, char const ** args, BenchOptions & options) {
+	double	value;
+
+	for (int i = 0; i < nbArgs; ++i) {
+		if (strcmp(args[i], "--usage") == 0 || strcmp(args[i], "-u") == 0) {
+			return benchUsage();
+		}
+		else if (strcmp(args[i], "--min-size") == 0) {
+			if (!argNumber(nbArgs, args, i, TERRAIN_MIN_RES - 1, TERRAIN_MAX_RES - 1, value, true))
+				return benchUsage();
+			options.minSize = value;
+		}
+		else if (strcmp(args[i], "--max-size") == 0) {
+			if (!argNumber(nbArgs, args, i, TERRAIN_MIN_RES - 1, TERRAIN_MAX_RES - 1, value, true))
+				return benchUsage();
+			options.maxSize = value;
+		}
+		else if (strcmp(args[i], "--steps") == 0) {
+			if (!argNumber(nbArgs, args, i, 1, UINT32_MAX, value, true))
+				return benchUsage();
+			options.steps = value;
+		}
+		else if (strcmp(args[i], "--dt") == 0) {
+			if (!argNumber(nbArgs, args, i, 0, HEADLESS_MAX_DT, value, false) || value <= 0)
+				return benchUsage();
+			options.dt = value;
+		}
+		else if (strcmp(args[i], "--block-steps") == 0) {
+			if (!argNumber(nbArgs, args, i, 1, 16, value, true))
+				return benchUsage();
+			options.blockSteps = value;
+		}
+		else if (strcmp(args[i], "-o") == 0 && i + 1 < nbArgs) {
+			options.outPath = args[++i];
+		}
+		else if (hasSuffix(std::string(args[i]), ".mod1")) {
+			options.mapPath = args[i];
+		}
+		else {
+			std::cout << "invalid argument: " << args[i] << std::endl;
+			return benchUsage();
+		}
+	}
+	if (options.minSize > options.maxSize) {
+		std::cout << "--min-size is greater than --max-size" << std::endl;
+		return benchUsage();
+	}
+	return true;
+}
+
+/**
+ * @brief Simulate one map / size / scenario / limiter combination
+ *
+ * @param options the bench options
+ * @param scene the scene the terrain is attached to, never initialized
+ * @param size the grid size
+ * @param scenarioId the FlowScenario
+ * @param limited true to use the outflow limiter, false for the iterative correction
+ * @param blockSteps substeps per sweep, 1 for none
+ * @param out the JSON run object
+ * @return false on error
+ */
+static bool	benchRun(BenchOptions const & options, Scene & scene, uint32_t size,
+	uint16_t scenarioId, bool limited, uint32_t blockSteps, std::ostream & out)
+{
+	typedef std::chrono::steady_clock	Clock;
+
+	s.j("simulation").b("outflowLimiter") = limited;
+	s.j("simulation").u("blockSteps") = blockSteps;
+	Terrain * terrain;
+	try {
+		terrain = new Terrain(options.mapPath, scene.getGui(), scene, size + 1, true);
+	} catch(Terrain::TerrainException const & e) {
+		logErr(e.what());
+		return false;
+	}
+
+	Water & water = terrain->getWater();
+	water.setMeshVertices(true);
+	Clock::time_point start = Clock::now();
+	if (!terrain->init()) {
+		delete terrain;
+		return false;
+	}
+	terrain->setScenario(scenarioId);
+	double initTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+	// the init and reset are not part of the measure
+	std::array<double, WaterPhase::COUNT> phaseStart;
+	for (uint16_t phase = 0; phase < WaterPhase::COUNT; ++phase)
+		phaseStart[phase] = water.getPhaseTime(static_cast<WaterPhase::Enum>(phase));
+
+	uint64_t nbSubsteps = 0;
+	double activeRatio = 0;
+	start = Clock::now();
+	for (uint32_t step = 0; step < options.steps; ++step) {
+		if (!terrain->update(options.dt)) {
+			delete terrain;
+			return false;
+		}
+		nbSubsteps += water.getNbSubsteps();
+		activeRatio += static_cast<double>(water.getNbActiveTiles()) / water.getNbTiles();
+	}
+	double updateTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+	// items processed by one pass of each phase
+	uint64_t nbCells = static_cast<uint64_t>(size) * size;
+	uint64_t nbVertices = static_cast<uint64_t>(size + 1) * (size + 1);
+	uint64_t nbBorderVertices = static_cast<uint64_t>(size + 1) * 4;
+
+	out << "{\"size\": " << size << ", \"scenario\": \"" << Water::flowScenarioName[scenarioId]
+		<< "\", \"limiter\": " << (limited ? "true" : "false")
+		<< ", \"block_steps\": " << blockSteps
+		<< ", \"substeps\": " << nbSubsteps
+		<< ", \"activeTiles\": " << activeRatio / options.steps
+		<< ", \"init_s\": " << initTime
+		<< ", \"update_s\": " << updateTime
+		<< ", \"volume\": " << water.getVolume()
+		<< ", \"resident_bytes\": " << water.getResidentBytes()
+		<< ", \"cell_updates\": " << water.getNbCellUpdates()
+		<< ", \"checksum\": \"" << std::hex << std::setfill('0') << std::setw(16)
+		<< water.getChecksum() << std::dec << std::setfill(' ') << "\", \"phases\": {";
+	for (uint16_t phase = 0; phase < WaterPhase::COUNT; ++phase) {
+		WaterPhase::Enum p = static_cast<WaterPhase::Enum>(phase);
+		double time = water.getPhaseTime(p) - phaseStart[phase];
+		// the solver phases run once per substep, the others once per update
+		uint64_t nbPasses = options.steps;
+		uint64_t nbItems = nbCells;
+		if (p != WaterPhase::SCENARIO && p < WaterPhase::MESH)
+			nbPasses = nbSubsteps;
+		else if (p == WaterPhase::MESH)
+			nbItems = nbVertices;
+		else if (p == WaterPhase::BORDER)
+			nbItems = nbBorderVertices;
+		double nbTotal = static_cast<double>(nbItems) * nbPasses;
+
+		out << (phase ? ", " : "") << "\"" << Water::phaseName[phase] << "\": {"
+			<< "\"time_s\": " << time
+			<< ", \"ns_per_cell\": " << (nbTotal > 0 ? time * 1e9 / nbTotal : 0)
+			<< ", \"cells_per_s\": " << (time > 0 ? nbTotal / time : 0)
+			<< ", \"bytes_per_cell\": " << phaseBytes(p, limited) << "}";
+	}
+	out << "}}";
+
+	delete terrain;
+	return true;
+}
+
+/**
+ * @brief Time the water solver phases on a grid size / scenario / limiter
+ * matrix, print the results as JSON
+ */
+int main(int ac, char const **av) {
+	std::vector<Terrain *>	terrains;
+	Scene	scene(terrains);
+	BenchOptions	options;
+	options.mapPath = BENCH_DEF_MAP;
+	options.minSize = BENCH_DEF_MIN_SIZE;
+	options.maxSize = BENCH_DEF_MAX_SIZE;
+	options.steps = BENCH_DEF_STEPS;
+	options.dt = BENCH_DEF_DT;
+	options.blockSteps = BENCH_DEF_BLOCK_STEPS;
+
+	initLogs();
+	// keep stdout for the results
+	logging.setLoglevel(LOGWARN);
+	file::mkdir(CONFIG_DIR);
+	initSettings(SETTINGS_FILE);
+	if (!benchArgParse(ac - 1, av + 1, options))
+		return EXIT_FAILURE;
+
+	std::ofstream	file;
+	if (!options.outPath.empty()) {
+		file.open(options.outPath);
+		if (!file.is_open()) {
+			logErr("unable to open " << options.outPath);
+			return EXIT_FAILURE;
+		}
+	}
+	std::ostream & out = options.outPath.empty() ? std::cout : file;
+
+	out << std::setprecision(9);
+	out << "{\"map\": \"" << options.mapPath << "\", \"kernels\": \"" << WaterKernels::best().name
+		<< "\", \"storage\": \"" << WATER_STORAGE_NAME << "\", \"steps\": " << options.steps
+		<< ", \"dt\": " << options.dt << ", \"runs\": [";
+	bool first = true;
+	for (uint64_t size = options.minSize; size <= options.maxSize; size *= 2) {
+		for (uint16_t scenarioId = 0; scenarioId < FlowScenario::COUNT; ++scenarioId) {
+			for (bool limited : {true, false}) {
+				// the blocked sweep needs the limiter
+				std::vector<uint32_t> blocks = {1};
+				if (limited && options.blockSteps > 1)
+					blocks.push_back(options.blockSteps);
+				for (uint32_t blockSteps : blocks) {
+					out << (first ? "\n\t" : ",\n\t");
+					first = false;
+					if (!benchRun(options, scene, size, scenarioId, limited, blockSteps, out))
+						return EXIT_FAILURE;
+					out.flush();
+				}
+			}
+		}
+	}
+	out << "\n]}" << std::endl;
+	return EXIT_SUCCESS;
+}
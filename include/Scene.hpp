@@ -1,6 +1,9 @@
 #ifndef SCENE_HPP_
 #define SCENE_HPP_
 
+// replay seek step of the page up/down keys (s)
+#define SCENE_REPLAY_SEEK_S 5.0f
+
 #include <vector>
 
 #include "mod1.hpp"
@@ -27,6 +30,8 @@ class Scene {
 
 		bool	init();
 		bool	run();
+		bool	restoreSnapshot(std::string const & path);
+		bool	startReplay(std::string const & path);
 		Gui &	getGui();
 		float	getDtTime() const;
 		uint16_t	getFps() const;
@@ -35,10 +40,13 @@ class Scene {
 		bool	getPause() const;
 		float	getOrbitDistance() const;
 		bool	isSandboxScenario() const;
+		uint32_t	getNbActiveTiles() const;
+		uint32_t	getNbTiles() const;
 
 	private:
 		bool	_update();
 		bool	_draw();
+		void	_updateBackground();
 
 		std::vector<Terrain *> &	_terrains;
 		Gui		_gui;
@@ -47,6 +55,7 @@ class Scene {
 		bool	_wireframeMode;
 		int32_t	_terrainId;
 		int32_t	_scenarioId;
+		bool	_allTerrains;  // simulate the maps which are not displayed
 		OrbitControls	* _orbitControls;
 		bool	_pause;
 		UiState	_uiState;
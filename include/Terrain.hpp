@@ -3,19 +3,39 @@
 
 #define NB_CLOSEST_POINTS 16
 #define BOX_B_STEP 8
-#define TERRAIN_H(u, v) (_vertices[(v) * BOX_MAX_SIZE.x + (u)].pos.y)
+// terrain rows built by each job of the threads pool
+#define TERRAIN_JOB_ROWS 8
+// vertices heights interpolated together, one per SIMD lane
+#define TERRAIN_BATCH 4
+#define TERRAIN_H(u, v) (_vertices[(v) * _resolution.x + (u)].pos.y)
 
+#include <array>
+#include <chrono>
 #include <string>
-#include <unordered_set>
 #include <vector>
 
 #include "mod1.hpp"
 #include "Shader.hpp"
 #include "Gui.hpp"
 #include "Material.hpp"
+#include "TerrainPoints.hpp"
+#include "TerrainCache.hpp"
 
 class Scene;
 class Water;
+class TerrainHeightmap;
+
+namespace TerrainPhase {
+	/**
+	 * @brief Timed parts of the terrain building
+	 */
+	enum Enum {
+		HEIGHTS = 0,  // vertices heights interpolation
+		SHADING,  // vertices normals and colors
+		MESH,  // triangle strip indices and GPU upload
+		COUNT
+	};
+}  // namespace TerrainPhase
 
 struct	TerrainVert {
 	glm::vec3	pos;  /**< Vert position */
@@ -31,7 +51,8 @@ struct	TerrainVert {
  */
 class Terrain {
 	public:
-		Terrain(std::string mapPath, Gui & gui, Scene & scene);
+		Terrain(std::string mapPath, Gui & gui, Scene & scene, uint32_t resolution = 0,
+			bool headless = false);
 		virtual ~Terrain();
 		Terrain(Terrain const &src);
 		Terrain &operator=(Terrain const &rhs);
@@ -45,6 +66,15 @@ class Terrain {
 		float	getMinHeight() const;
 		float	getMaxHeight() const;
 		float	getOrbitDistance() const;
+		glm::uvec2	getResolution() const;
+		glm::vec2	getVertSpace() const;
+		bool	isHeadless() const;
+		std::string const &	getMapPath() const;
+		Water const &	getWater() const;
+		Water &	getWater();
+		double	getPhaseTime(TerrainPhase::Enum phase) const;
+
+		static const std::string	phaseName[TerrainPhase::COUNT];
 
 		// -- exceptions -------------------------------------------------------
 		/**
@@ -57,23 +87,20 @@ class Terrain {
 		};
 
 	private:
-		/**
-		 * @brief Info about a heightmap point
-		 */
-		struct HeightPoint {
-			int16_t distance;
-			int16_t	height;
-		};
-
 		void	_loadFile();
+		void	_loadMap();
 		bool	_initMesh();
 		bool	_initMeshBorder();
-		std::vector<HeightPoint>	_getNClosest(glm::uvec2 pos, uint8_t n);
-		float	_calculateHeight(glm::uvec2 pos);
-		glm::vec3	_calculateNormal(uint32_t x, uint32_t z);
-		void	_initColors();
-		glm::vec3	_calcColor(float ratio);
+		void	_initRowHeights(uint32_t z);
+		float	_calculateHeight(glm::vec2 pos) const;
+		void	_calculateHeights(glm::vec2 pos, glm::vec2 step, float * heights) const;
+		void	_initShading();
+		glm::vec3	_calculateNormal(uint32_t x, uint32_t z) const;
+		glm::vec3	_calcColor(float ratio) const;
+		void	_endPhase(TerrainPhase::Enum phase, std::chrono::steady_clock::time_point & start);
 		void	_staticUniform();
+		uint64_t	_cacheParams() const;
+		void	_endCache();
 
 		static std::unique_ptr<Shader>	_sh;  /**< Shader */
 		static std::array<glm::vec3, 3>	_colors;
@@ -81,7 +108,13 @@ class Terrain {
 		Scene			&_scene;
 		std::string		_mapPath;
 		SettingsJson	*_map;
-		std::unordered_set<glm::vec3>	_mapPoints;
+		TerrainPoints	_mapPoints;  /**< Map and border points, indexed for the interpolation */
+		TerrainHeightmap	*_heightmap;  /**< Heights grid instead of the points, until the mesh is built */
+		glm::uvec2	_resolution;  /**< Number of points per side */
+		TerrainCache	_cache;  /**< Vertices built by the previous launches */
+		bool	_useCache;  /**< The vertices are loaded from and saved in the cache */
+		double	_loadTime;  /**< Map file loading time (s) */
+		bool	_headless;  /**< No rendering, only the heightfield is built */
 
 		std::vector<TerrainVert>	_vertices;
 		std::vector<uint32_t>	_indices;
@@ -100,6 +133,7 @@ class Terrain {
 		Water	*_water;
 		float	_minH;
 		float	_maxH;
+		std::array<double, TerrainPhase::COUNT>	_phaseTime;  // time of each building phase (s)
 };
 
 #endif  // TERRAIN_HPP_
@@ -0,0 +1,86 @@
+#ifndef TERRAINCACHE_HPP_
+#define TERRAINCACHE_HPP_
+
+#define TERRAIN_CACHE_MAGIC "MOD1TCHE"
+// increment on every layout or interpolation change, older entries are rebuilt
+#define TERRAIN_CACHE_VERSION 2
+#define TERRAIN_CACHE_EXT ".mod1cache"
+// the entry has the vertices normals after the heights
+#define TERRAIN_CACHE_NORMALS 1
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "useGlm.hpp"
+
+struct TerrainVert;
+
+/**
+ * @brief Cache entry header, followed by width * height heights, then the
+ * same number of normals with TERRAIN_CACHE_NORMALS
+ *
+ * 64 bytes so the heights of a mapped file stay cache line aligned. All the
+ * values are stored in the machine byte order.
+ */
+struct	TerrainCacheHeader {
+	char		magic[8];  /**< TERRAIN_CACHE_MAGIC, without the '\0' */
+	uint32_t	version;  /**< TERRAIN_CACHE_VERSION */
+	uint32_t	width;  /**< Vertices per row */
+	uint32_t	height;  /**< Vertices rows */
+	uint32_t	flags;  /**< TERRAIN_CACHE_NORMALS */
+	uint64_t	mapHash;  /**< Content hash of the map file */
+	uint64_t	paramsHash;  /**< Hash of the resolution and interpolation parameters */
+	float		minH;  /**< Lowest vertex height */
+	float		maxH;  /**< Highest vertex height */
+	double		buildTime;  /**< Map loading and vertices building time (s) */
+	uint8_t		reserved[8];
+};
+
+/**
+ * @brief Built terrain vertices saved between the launches, in CACHE_DIR
+ *
+ * An entry is named after its map path and parameters, and checked against
+ * the content of the map file: a changed map or parameter misses and the entry is
+ * rebuilt. A hit is memory mapped until release().
+ */
+class TerrainCache {
+	public:
+		TerrainCache();
+		virtual ~TerrainCache();
+
+		static uint64_t	hash(void const * data, size_t size, uint64_t seed = 0xcbf29ce484222325ULL);
+		bool	lookup(std::string const & mapPath, uint64_t paramsHash);
+		bool	save(std::vector<TerrainVert> const & vertices, glm::uvec2 resolution, float minH,
+			float maxH, bool normals, double buildTime);
+		void	release();
+
+		// -- getters ----------------------------------------------------------
+		bool	isHit() const;
+		bool	hasNormals() const;
+		TerrainCacheHeader const &	getHeader() const;
+		float const *	getHeights() const;
+		glm::vec3 const *	getNormals() const;
+		double	getLookupTime() const;
+
+	private:
+		TerrainCache(TerrainCache const &src);
+		TerrainCache &operator=(TerrainCache const &rhs);
+
+		bool	_hashFile(std::string const & path);
+		bool	_map();
+		void	_unmap();
+
+		std::string	_path;  // entry file
+		uint64_t	_mapHash;
+		uint64_t	_paramsHash;
+		void	*_mapped;  // mapped entry
+		size_t	_mappedSize;
+		std::vector<uint8_t>	_buffer;  // entry content without mmap
+		uint8_t const	*_data;  // entry content of a hit, nullptr on a miss
+		size_t	_size;
+		double	_lookupTime;  // map hashing and entry loading time (s)
+};
+
+#endif  // TERRAINCACHE_HPP_
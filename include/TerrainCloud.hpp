@@ -0,0 +1,87 @@
+#ifndef TERRAINCLOUD_HPP_
+#define TERRAINCLOUD_HPP_
+
+#define TERRAIN_CLOUD_MAGIC "MOD1PNTS"
+// increment on every layout change, older files are rejected
+#define TERRAIN_CLOUD_VERSION 1
+// packed binary points
+#define TERRAIN_CLOUD_EXT ".mod1pts"
+// text points, one "x y z" line per point
+#define TERRAIN_CLOUD_XYZ_EXT ".xyz"
+#define TERRAIN_CLOUD_CSV_EXT ".csv"
+// bytes parsed by each job of the threads pool
+#define TERRAIN_CLOUD_CHUNK_SIZE (1 << 22)
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "TerrainPoints.hpp"
+
+/**
+ * @brief Binary points file header, followed by nbPoints x, y, z float
+ * triplets in the machine byte order
+ */
+struct	TerrainCloudHeader {
+	char		magic[8];  /**< TERRAIN_CLOUD_MAGIC, without the '\0' */
+	uint32_t	version;  /**< TERRAIN_CLOUD_VERSION */
+	uint32_t	reserved;
+	uint64_t	nbPoints;  /**< Number of points */
+};
+
+/**
+ * @brief Load large point sets in a terrain control points
+ *
+ * The points use the .mod1 maps axes and bounds: x and z the position, y the
+ * height. The text files have one point per line, the coordinates separated
+ * by spaces, tabs, commas or semicolons, the next columns are ignored. The
+ * empty lines, the '#' comments and a first line header are skipped. The
+ * points are interpolated with their exact distances, not the integer ones
+ * of the .mod1 maps.
+ *
+ * The file is read in blocks of one TERRAIN_CLOUD_CHUNK_SIZE chunk per thread,
+ * the chunks are parsed in parallel in flat points buffers, then added in the
+ * file order. Only a block is in memory at a time.
+ */
+class TerrainCloud {
+	public:
+		TerrainCloud();
+		virtual ~TerrainCloud();
+
+		static bool	isCloud(std::string const & path);
+		bool		load(std::string const & path, TerrainPoints & points);
+
+		// -- getters ----------------------------------------------------------
+		uint64_t	getNbDuplicates() const;
+
+	private:
+		/**
+		 * @brief Parsing state of a chunk
+		 */
+		struct Chunk {
+			char const	*start;  /**< Chunk text, or binary points */
+			size_t		size;  /**< Chunk bytes */
+			std::vector<glm::vec3>	points;  /**< Parsed points, reused by the next blocks */
+			uint64_t	nbLines;  /**< Text lines in the chunk */
+			uint64_t	errorLine;  /**< Line or point of the first error in the chunk, 0 for none */
+			std::string	error;  /**< First error message */
+		};
+
+		TerrainCloud(TerrainCloud const &src);
+		TerrainCloud &operator=(TerrainCloud const &rhs);
+
+		bool	_loadText(std::ifstream & file, TerrainPoints & points);
+		bool	_loadBinary(std::ifstream & file, TerrainPoints & points);
+		void	_parseText(Chunk & chunk, bool firstLine) const;
+		void	_parseBinary(Chunk & chunk) const;
+		bool	_addChunks(uint32_t nbChunks, uint64_t firstLine, TerrainPoints & points);
+		static bool	_checkPoint(glm::vec3 const & point, std::string & error);
+
+		std::string	_path;  // loaded file
+		std::vector<char>	_buffer;  // current block
+		std::vector<Chunk>	_chunks;  // one per thread
+		uint64_t	_nbDuplicates;  // points skipped, at an already used position
+};
+
+#endif  // TERRAINCLOUD_HPP_
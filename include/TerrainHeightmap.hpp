@@ -0,0 +1,76 @@
+#ifndef TERRAINHEIGHTMAP_HPP_
+#define TERRAINHEIGHTMAP_HPP_
+
+#define TERRAIN_HEIGHTMAP_MAGIC "MOD1HMAP"
+// increment on every layout change, older files are rejected
+#define TERRAIN_HEIGHTMAP_VERSION 1
+// raw float heights grid
+#define TERRAIN_HEIGHTMAP_EXT ".mod1hm"
+// 8 or 16 bits grayscale image
+#define TERRAIN_HEIGHTMAP_PNG_EXT ".png"
+// heightmaps sides limits, in pixels
+#define TERRAIN_HEIGHTMAP_MIN_SIZE 2
+#define TERRAIN_HEIGHTMAP_MAX_SIZE 65536
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Raw heightmap file header, followed by width * height little endian
+ * floats, row by row
+ *
+ * 32 bytes so the heights of a mapped file stay aligned. The header values
+ * are little endian too.
+ */
+struct	TerrainHeightmapHeader {
+	char		magic[8];  /**< TERRAIN_HEIGHTMAP_MAGIC, without the '\0' */
+	uint32_t	version;  /**< TERRAIN_HEIGHTMAP_VERSION */
+	uint32_t	width;  /**< Heights per row, along x */
+	uint32_t	height;  /**< Rows, along z */
+	uint8_t		reserved[12];
+};
+
+/**
+ * @brief Dense heights grid of a terrain, used instead of the points
+ * interpolation
+ *
+ * The grid covers the whole map, its first row at z = 0. A raw file is memory
+ * mapped and sampled in place, its heights are in the .mod1 maps bounds. A
+ * png gray level is scaled from the lowest to the highest .mod1 height.
+ */
+class TerrainHeightmap {
+	public:
+		TerrainHeightmap();
+		virtual ~TerrainHeightmap();
+
+		static bool	isHeightmap(std::string const & path);
+		bool	load(std::string const & path);
+		float	sample(double u, double v) const;
+
+		// -- getters ----------------------------------------------------------
+		uint32_t	getWidth() const;
+		uint32_t	getHeight() const;
+
+	private:
+		TerrainHeightmap(TerrainHeightmap const &src);
+		TerrainHeightmap &operator=(TerrainHeightmap const &rhs);
+
+		bool	_map(std::string const & path);
+		void	_unmap();
+		bool	_loadRaw(std::string & error);
+		bool	_loadPng(std::string & error);
+
+		void	*_mapped;  // mapped file
+		size_t	_mappedSize;
+		std::vector<uint8_t>	_buffer;  // file content without mmap
+		uint8_t const	*_data;  // file content
+		size_t	_size;
+		std::vector<float>	_decoded;  // heights decoded from a png, or byte swapped
+		float const	*_heights;  // width * height heights, mapped or decoded
+		uint32_t	_width;
+		uint32_t	_height;
+};
+
+#endif  // TERRAINHEIGHTMAP_HPP_
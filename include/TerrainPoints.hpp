@@ -0,0 +1,70 @@
+#ifndef TERRAINPOINTS_HPP_
+#define TERRAINPOINTS_HPP_
+
+// control points per bucket of the nearest points index, on average
+#define TERRAIN_POINTS_PER_BUCKET 4
+// closest distance of a point without truncation, its weight stays finite
+#define TERRAIN_POINTS_MIN_DIST 1e-3f
+// empty slot of the positions hash table
+#define TERRAIN_POINTS_EMPTY UINT32_MAX
+
+#include <cstdint>
+#include <vector>
+
+#include "useGlm.hpp"
+
+/**
+ * @brief Control points of a terrain, indexed to find the nearest ones
+ *
+ * The points are added in the map order, then build() sorts them in a
+ * uniform grid of buckets covering their bounds. The nearest points search
+ * visits the buckets in rings around the position, until the next ring can't
+ * hold a closer point. The exact points positions are found with an open
+ * addressing hash table of the points indices, no allocation per point.
+ */
+class TerrainPoints {
+	public:
+		/**
+		 * @brief A control point seen from a searched position
+		 */
+		struct HeightPoint {
+			float		distance;  /**< Distance, truncated to an integer at least 1 by default */
+			float		height;  /**< Point height */
+			uint32_t	index;  /**< Point order of add(), on a distance tie the lower one is the closest */
+		};
+
+		TerrainPoints();
+		virtual ~TerrainPoints();
+		TerrainPoints(TerrainPoints const &src);
+		TerrainPoints &operator=(TerrainPoints const &rhs);
+
+		void		setTruncated(bool truncated);
+		void		reserve(size_t nbPoints);
+		bool		add(glm::vec3 point);
+		void		build();
+		bool		getExactHeight(glm::vec2 pos, float & height) const;
+		uint32_t	getNClosest(glm::vec2 pos, uint32_t n, HeightPoint * closest) const;
+
+		// -- getters ----------------------------------------------------------
+		uint32_t	size() const;
+
+	private:
+		static uint64_t	_positionKey(glm::vec2 pos);
+		uint32_t	_findSlot(uint64_t key) const;
+		void		_rehash(size_t nbSlots);
+		glm::ivec2	_bucket(glm::vec2 pos) const;
+		float		_distanceLimit(HeightPoint const & farthest) const;
+		bool		_insertClosest(HeightPoint point, uint32_t n, HeightPoint * closest,
+			uint32_t & nbClosest) const;
+
+		std::vector<glm::vec3>	_points;  // in the buckets order once built
+		std::vector<uint32_t>	_order;  // add() order of each point, once built
+		std::vector<uint32_t>	_exact;  // point index of each position, power of 2 slots
+		std::vector<uint32_t>	_bucketStart;  // first point of each bucket, then the points count
+		glm::vec2	_origin;  // position of the first bucket corner
+		float		_bucketSize;  // buckets side length
+		glm::ivec2	_nbBuckets;  // buckets per side
+		bool		_truncated;  // integer distances, for the integer map coordinates
+};
+
+#endif  // TERRAINPOINTS_HPP_
@@ -1,14 +1,43 @@
 #ifndef WATER_HPP_
 #define WATER_HPP_
 
-#define WATER_GRID_RES glm::vec2(BOX_MAX_SIZE.x - 1, BOX_MAX_SIZE.z - 1)
-#define WATER_H(u, v) (_vertices[(v) * (WATER_GRID_RES.x + 1) + (u)].pos.y)
+#define WATER_H(u, v) (_vertices[(v) * (_grid.getWidth() + 1) + (u)].pos.y)
 #define WATER_MIN_DISPLAY_H 0.01
+// width and height of the active tiles, in columns, also the sparse grid memory unit
+#define WATER_TILE_SIZE WATER_GRID_TILE_SIZE
+// a tile go to sleep once all its flows are below this value (m3/s)
+#define WATER_TILE_SLEEP_FLOW 1e-3f
+// world radius of the water added by a sandbox click
+#define WATER_SANDBOX_RADIUS 0.5f
+// simulated time between two rain showers (s)
+#define WATER_RAIN_PERIOD 0.1
+// below this drop density the drops positions are drawn instead of testing every column
+#define WATER_RAIN_SPARSE_DENSITY 0.05f
+// longest simulation substep (s), used when the water is too shallow to limit it
+#define WATER_MAX_STEP_DT 0.05f
+// passes of a substep swept by the temporal blocking: flow, limit and depth
+#define WATER_SWEEP_PASSES 3
+// max commands waiting for the simulation thread, a power of 2
+#define WATER_COMMANDS_SIZE 256
+// simulation thread sleep when it has nothing to do (ms)
+#define WATER_IDLE_SLEEP_MS 1
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
 #include <vector>
 
 #include "mod1.hpp"
 #include "Terrain.hpp"
+#include "WaterGrid.hpp"
+#include "WaterKernels.hpp"
+#include "TripleBuffer.hpp"
+#include "SpscQueue.hpp"
+#include "WaterSnapshot.hpp"
+#include "WaterRecorder.hpp"
+#include "WaterPlayer.hpp"
 
 namespace FlowDir {
 	/**
@@ -37,13 +66,51 @@ namespace FlowScenario {
 }  // namespace FlowScenario
 
 
-// flow, m3 water /s, positive flow mean increasing water level
-struct	WaterColum {
-	float	depth;  // water depth
-	float	lFlow;  // left flow
-	float	tFlow;  // top flow
-	float	terrainH;  // terrain height
-	WaterColum();
+namespace WaterPhase {
+	/**
+	 * @brief Timed parts of the simulation
+	 */
+	enum Enum {
+		SCENARIO = 0,
+		TILES,
+		FLOW,
+		LIMIT,
+		DEPTH,
+		SWEEP,  // flow, limit and depth of several substeps in a single sweep
+		ACTIVITY,
+		MESH,
+		BORDER,
+		COUNT
+	};
+}  // namespace WaterPhase
+
+namespace WaterCmd {
+	/**
+	 * @brief Commands sent to the simulation
+	 */
+	enum Enum {
+		ADVANCE,  // simulate dtTime more seconds
+		ADD_WATER,  // sandbox click on the column (u, v)
+		SET_SCENARIO,  // reset the columns with scenarioId
+		SNAPSHOT,  // save the water state in the snapshot file
+		RESTORE,  // replace the water state by the snapshot
+		RECORD,  // replace the recorder, nullptr to stop recording
+		REPLAY,  // replace the simulation by a record player, nullptr to stop
+		REPLAY_SEEK,  // move the replay by dtTime seconds
+		REPLAY_STEP,  // move the replay by u frames
+		REPLAY_SPEED  // multiply the replay speed by dtTime
+	};
+}  // namespace WaterCmd
+
+struct	WaterCommand {
+	WaterCmd::Enum	type;
+	float		dtTime;  /**< ADVANCE duration, REPLAY_SEEK offset or REPLAY_SPEED factor */
+	int64_t		u;  /**< ADD_WATER column or REPLAY_STEP frames */
+	int64_t		v;  /**< ADD_WATER row */
+	uint16_t	scenarioId;  /**< SET_SCENARIO scenario */
+	WaterSnapshot	*snapshot;  /**< RESTORE state, deleted by the simulation */
+	WaterRecorder	*recorder;  /**< RECORD recorder, owned by the simulation */
+	WaterPlayer	*player;  /**< REPLAY player, owned by the simulation */
 };
 
 struct	WaterVert {
@@ -52,6 +119,28 @@ struct	WaterVert {
 	float		visible;  /**< Vert visibility between 0.0 and 1.0 */
 };
 
+/**
+ * @brief Mesh published by the simulation for the renderer
+ */
+struct	WaterMeshFrame {
+	std::vector<WaterVert>	vertices;  /**< All the surface vertices, only the changed rows are copied */
+	std::vector<WaterVert>	verticesB;  /**< All the border vertices, copied when changed */
+	uint32_t	zMin;  /**< First surface vertices row changed since the last uploaded frame */
+	uint32_t	zMax;  /**< Last changed row + 1 */
+	bool		borderChanged;  /**< The border vertices changed since the last uploaded frame */
+};
+
+/**
+ * @brief Difference of the water depth with a reference snapshot, to measure
+ * the error of a storage format against the fp32 one
+ */
+struct	WaterDiff {
+	double	depthRms;  /**< Root mean square of the columns depth differences */
+	float	depthMax;  /**< Largest column depth difference */
+	double	volume;  /**< Reference water volume */
+	double	volumeDrift;  /**< Volume difference relative to the reference one */
+};
+
 class Water {
 	public:
 		Water(Terrain & terrain, Gui & gui);
@@ -63,21 +152,94 @@ class Water {
 		bool	update(float dtTime);
 		bool	draw(bool wireframe = false);
 		void	setScenario(uint16_t scenarioId);
+		void	setMeshVertices(bool enabled);
+		void	setBackground(bool background);
+		void	saveSnapshot();
+		bool	restoreSnapshot(std::string const & path);
+		bool	writeSnapshot(std::string const & path) const;
+		bool	compareSnapshot(std::string const & path, WaterDiff & diff) const;
+		bool	startRecording(std::string const & path);
+		void	stopRecording();
+		bool	startReplay(std::string const & path);
+		void	replaySeek(float offset);
+		void	replayStep(int32_t nbFrames);
+		void	replaySpeed(float factor);
+		bool	isReplaying() const;
+		std::string const &	getSnapshotPath() const;
+		uint16_t	getScenario() const;
+		double	getSimTime() const;
+		uint32_t	getNbActiveTiles() const;
+		uint32_t	getNbTiles() const;
+		uint32_t	getNbSubsteps() const;
+		uint64_t	getNbCellUpdates() const;
+		uint64_t	getResidentBytes() const;
+		double	getPhaseTime(WaterPhase::Enum phase) const;
+		double	getVolume() const;
+		uint64_t	getChecksum() const;
 
 		static const std::string	flowScenarioName[FlowScenario::COUNT];
+		static const std::string	phaseName[WaterPhase::COUNT];
+		static const std::string	boundaryName[WaterBoundary::COUNT];
 
 	private:
-		static glm::vec2 const	_gridSpace;
-		static glm::vec2 const	_pipeLen;
-		static float const	_gridArea;
 		static std::unique_ptr<Shader>	_sh;  /**< Shader */
 
 		Gui	& _gui;
 		Terrain	& _terrain;
-		bool	_firstInit;
-		FlowScenario::Enum	_scenario;
+		FlowScenario::Enum	_scenario;  // scenario simulated
+		FlowScenario::Enum	_requestedScenario;  // last scenario sent to the simulation
 		float	_gravity;  // gravity in m/s
-		std::vector< std::vector<WaterColum> >	_waterCols;  // all water columns
+		glm::vec2	_gridSpace;  // space between grid points
+		glm::vec2	_pipeLen;  // water grid pipe length
+		float	_gridArea;  // grid box area
+		// all water columns, flow in m3 water /s, positive flow mean increasing water level
+		WaterGrid	_grid;
+		WaterKernels::Kernels const *	_kernels;  // flow/depth row update kernels
+		WaterKernels::FlowParams	_flowParams;
+		WaterBoundary::Enum	_boundary;  // grid borders pipes
+		float	_courant;  // fraction of the stable step used by each substep
+		float	_rainDensity;  // fraction of the columns getting a drop at each rain shower
+		uint32_t	_maxSubsteps;  // max substeps per frame
+		uint32_t	_blockSteps;  // substeps swept together (temporal blocking), 1 for one pass per phase
+		std::atomic<uint32_t>	_nbSubsteps;  // substeps run by the last update
+		std::array<double, WaterPhase::COUNT>	_phaseTime;  // total time of each phase (s)
+		double	_simTime;  // simulated time since the scenario start (s)
+
+		// active tiles, one flag per tile, row major
+		uint32_t	_tilesW;  // number of tiles per row
+		uint32_t	_tilesH;  // number of tiles rows
+		std::vector<uint8_t>	_tileAwake;  // tile has water with non-negligible flows
+		std::vector<uint8_t>	_tileFlow;  // flows updated this step, awake tiles and their neighbours
+		std::vector<uint8_t>	_tileDepth;  // depth updated this step, flow tiles and their left/top ones
+		std::atomic<uint32_t>	_nbActiveTiles;  // number of tiles updated this step
+		std::atomic<uint64_t>	_nbCellUpdates;  // columns updated by all the steps
+		std::vector<uint8_t>	_tileMesh;  // depth tiles of all the steps since the last mesh update
+		std::vector<float>	_tileMaxDepth;  // max column depth of each tile
+
+		// sparse grid, the tiles are resident while they are close to water
+		bool	_sparse;  // only keep the tiles around the water in memory
+		std::vector<float>	_tileMinTerrainH;  // lowest column terrain of each tile
+
+		bool	_headless;  // no GL calls
+		bool	_meshVertices;  // compute the mesh vertices, off by default in headless mode
+		// simulation thread, the update() thread only send it commands
+		bool	_threaded;  // false to simulate in update()
+		std::atomic<bool>	_background;  // not displayed, no mesh update and low pool priority
+		std::thread	_simThread;
+		std::atomic<bool>	_quitSim;
+		SpscQueue<WaterCommand, WATER_COMMANDS_SIZE>	_commands;
+		TripleBuffer<WaterMeshFrame>	_meshBuffer;  // last meshes computed by the simulation
+		uint32_t	_pendingZMin;  // vertices rows changed since the last consumed mesh
+		uint32_t	_pendingZMax;
+		bool	_pendingBorder;  // border changed since the last consumed mesh
+		std::array<glm::uvec2, 3>	_slotRows;  // vertices rows [x, y[ each mesh slot lacks
+		std::array<bool, 3>	_slotBorder;  // the mesh slot lacks the border vertices
+		std::string	_snapshotPath;  // file written by saveSnapshot
+		std::thread	_snapshotThread;  // last snapshot write
+		std::atomic<bool>	_snapshotWriting;  // _snapshotThread is still writing
+		WaterRecorder	*_recorder;  // record the depth after each update, nullptr if not recording
+		WaterPlayer	*_player;  // replayed record driving the water instead of the simulation
+		std::atomic<bool>	_replaying;  // a replay was sent to the simulation and didn't fail
 
 		std::vector<WaterVert>	_vertices;
 		std::vector<uint32_t>	_indices;
@@ -93,18 +255,54 @@ class Water {
 		uint32_t	_eboB;
 
 		float	_currentRiseH;
-		std::chrono::milliseconds	_lastRainUpdate;
 		float	_maxTerrainCenterDist;
 
+		bool	_pushCommand(WaterCommand const & cmd);
+		void	_simulationLoop();
+		bool	_processCommands();
+		void	_resetColumns();
+		void	_restoreColumns(WaterSnapshot const & snapshot);
+		void	_saveSnapshot();
+		float	_columnTerrainH(uint32_t u, uint32_t v) const;
+		float	_terrainH(uint32_t u, uint32_t v) const;
+		void	_makeResident(uint32_t u, uint32_t v);
+		void	_fillTile(uint32_t t, bool outScale);
+		void	_fillTiles();
+		bool	_isTileNeeded(uint32_t t) const;
+		void	_releaseTiles();
+		void	_advance(float dtTime);
+		void	_replay(float dtTime);
+		void	_sendReplayCommand(WaterCommand const & cmd);
+		void	_sandboxClick();
+		void	_addWater(int64_t cu, int64_t cv);
 		void	_scenarioUpdate(float dtTime);
-		void	_updateFlow(uint32_t u, uint32_t v, float dtTime);
-		void	_updateDepth(uint32_t u, uint32_t v, float dtTime);
+		void	_rain(uint64_t shower, float amount);
+		float	_stableStep() const;
+		void	_step(float dtTime, uint32_t nbSteps);
+		void	_sweep(float dtTime, uint32_t nbSteps);
+		void	_sweepRows(float dtTime, uint32_t nbLevels, int64_t vStart, int64_t vEnd,
+			int32_t topSlope, int32_t bottomSlope);
+		void	_endPhase(WaterPhase::Enum phase, std::chrono::steady_clock::time_point & start);
+		void	_updateFlow(uint32_t v, uint32_t uStart, uint32_t uEnd, float dtTime);
+		void	_updateDepth(uint32_t v, uint32_t uStart, uint32_t uEnd, float dtTime);
 		void	_correctNegWaterDepth(float dtTime);
+		bool	_calcOutScale(uint32_t v, float dtTime);
+		void	_applyOutScale(uint32_t v);
+		void	_forEachBand(std::function<void(uint32_t vStart, uint32_t vEnd)> const & func);
+		void	_forEachSpan(uint32_t v, std::vector<uint8_t> const & tiles,
+			std::function<void(uint32_t uStart, uint32_t uEnd)> const & func) const;
+		void	_wakeCell(uint32_t u, uint32_t v);
+		float	_calcTileMaxDepth(uint32_t t) const;
+		void	_updateTileSets(uint32_t nbSteps);
+		void	_updateTileActivity();
+		void	_initVertices();
 		bool	_initMesh();
-		bool	_updateMesh();
+		void	_updateVertices(uint32_t & zMin, uint32_t & zMax);
+		void	_publishMesh(uint32_t zMin, uint32_t zMax, bool borderChanged);
+		void	_uploadMesh();
+		void	_initBorderVertices();
 		bool	_initMeshBorder();
-		void	_updateBorderVertices();
-		bool	_updateMeshBorder();
+		bool	_updateBorderVertices();
 		float	_calculateHeight(uint32_t x, uint32_t z, float & waterDepth);
 		glm::vec3	_calculateNormal(uint32_t x, uint32_t z);
 		void	_staticUniform();
@@ -0,0 +1,197 @@
+#ifndef WATERGRID_HPP_
+#define WATERGRID_HPP_
+
+// alignment in bytes of every plane and row (one cache line)
+#define WATER_GRID_BYTE_ALIGN 64
+// width and height of a sparse grid tile, the unit of its memory, in columns
+#define WATER_GRID_TILE_SIZE 16
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include "WaterStorage.hpp"
+
+namespace WaterPlane {
+	/**
+	 * @brief Planes stored by the water grid, one value per cell each
+	 *
+	 * The state planes, before TERRAIN_H, hold WaterValue in the storage
+	 * format, the others floats.
+	 */
+	enum Enum {
+		DEPTH = 0,  // water depth
+		L_FLOW,  // left flow
+		T_FLOW,  // top flow
+		TERRAIN_H,  // terrain height, first float plane
+		OUT_SCALE,  // scale factor applied to the column outflows
+		COUNT
+	};
+}  // namespace WaterPlane
+
+/**
+ * @brief Structure of arrays storage for the water columns
+ *
+ * Every WaterPlane is a contiguous, 64 bytes aligned array of
+ * stride * height values. Rows are padded up to the stride so each row start
+ * on a cache line, the padding cells are kept to 0 and never simulated.
+ * The state planes are accessed with cells(), the float planes with row().
+ *
+ * A sparse grid is split in tiles of WATER_GRID_TILE_SIZE columns per side,
+ * each one a block holding all its planes, row by row. Only the resident
+ * tiles have a block, taken from a pool by allocTile() and given back by
+ * freeTile() with its memory, the others read 0 from a shared read only
+ * block. The cells of a row are then contiguous in runs of a tile width, the
+ * whole row for a dense grid: getRunStart() and getRunEnd(). Without virtual
+ * memory support (_WIN32) the grid stays dense.
+ */
+class WaterGrid {
+	public:
+		WaterGrid();
+		WaterGrid(uint32_t width, uint32_t height);
+		virtual ~WaterGrid();
+		WaterGrid(WaterGrid const &src);
+		WaterGrid &operator=(WaterGrid const &rhs);
+
+		void	resize(uint32_t width, uint32_t height, bool sparse = false);
+		void	clear();
+		void	fillPlane(WaterPlane::Enum plane, float value);
+		bool	allocTile(uint32_t tu, uint32_t tv);
+		void	freeTile(uint32_t tu, uint32_t tv);
+
+		uint32_t	getWidth() const;
+		uint32_t	getHeight() const;
+		uint32_t	getStride() const;
+		size_t		getPlaneSize() const;
+		size_t		getCellBytes() const;
+		bool		isSparse() const;
+		uint32_t	getNbResidentTiles() const;
+		uint64_t	getResidentBytes() const;
+
+		/**
+		 * @brief Get the size in bytes of one value of a plane
+		 *
+		 * @param plane the plane
+		 * @return size_t sizeof(WaterValue) for the state planes, else sizeof(float)
+		 */
+		static inline size_t	valueSize(WaterPlane::Enum plane) {
+			return plane < WaterPlane::TERRAIN_H ? sizeof(WaterValue) : sizeof(float);
+		}
+
+		/**
+		 * @brief Get the first column of the run of contiguous cells holding
+		 * the column u, its tile for a sparse grid
+		 */
+		inline uint32_t	getRunStart(uint32_t u) const {
+			return _sparse ? u / WATER_GRID_TILE_SIZE * WATER_GRID_TILE_SIZE : 0;
+		}
+		/**
+		 * @brief Get the last column + 1 of the run of contiguous cells
+		 * holding the column u
+		 */
+		inline uint32_t	getRunEnd(uint32_t u) const {
+			uint32_t end = getRunStart(u) + WATER_GRID_TILE_SIZE;
+			return _sparse && end < _width ? end : _width;
+		}
+		/**
+		 * @brief Check if a sparse grid tile has its own block, always true
+		 * for a dense grid
+		 */
+		inline bool	isResident(uint32_t tu, uint32_t tv) const {
+			return !_sparse || _tiles[static_cast<size_t>(tv) * _tilesW + tu] != _zeroTile;
+		}
+
+		/**
+		 * @brief Get a state plane cell, followed by the next cells of its row
+		 * up to getRunEnd(u)
+		 *
+		 * @param plane the state plane to access (DEPTH, L_FLOW or T_FLOW)
+		 * @param u the column id
+		 * @param v the row id
+		 * @return WaterValue* cell pointer, a run start is aligned on
+		 * WATER_GRID_BYTE_ALIGN
+		 */
+		inline WaterValue *	cells(WaterPlane::Enum plane, uint32_t u, uint32_t v) {
+			return reinterpret_cast<WaterValue *>(_cell(plane, u, v));
+		}
+		inline WaterValue const *	cells(WaterPlane::Enum plane, uint32_t u, uint32_t v) const {
+			return reinterpret_cast<WaterValue const *>(_cell(plane, u, v));
+		}
+		/**
+		 * @brief Get a float plane cell, followed by the next cells of its row
+		 * up to getRunEnd(u)
+		 *
+		 * @param plane the float plane to access (TERRAIN_H or OUT_SCALE)
+		 * @param u the column id
+		 * @param v the row id
+		 * @return float* cell pointer, a run start is aligned on
+		 * WATER_GRID_BYTE_ALIGN
+		 */
+		inline float *	row(WaterPlane::Enum plane, uint32_t u, uint32_t v) {
+			return reinterpret_cast<float *>(_cell(plane, u, v));
+		}
+		inline float const *	row(WaterPlane::Enum plane, uint32_t u, uint32_t v) const {
+			return reinterpret_cast<float const *>(_cell(plane, u, v));
+		}
+		inline WaterValue &	cell(WaterPlane::Enum plane, uint32_t u, uint32_t v) {
+			return *cells(plane, u, v);
+		}
+		inline float	cell(WaterPlane::Enum plane, uint32_t u, uint32_t v) const {
+			return *cells(plane, u, v);
+		}
+		inline float &	at(WaterPlane::Enum plane, uint32_t u, uint32_t v) {
+			return *row(plane, u, v);
+		}
+		inline float	at(WaterPlane::Enum plane, uint32_t u, uint32_t v) const {
+			return *row(plane, u, v);
+		}
+
+		void	readRow(WaterPlane::Enum plane, uint32_t v, float * dst) const;
+		void	writeRow(WaterPlane::Enum plane, uint32_t v, float const * src);
+
+		// -- planes shortcuts -------------------------------------------------
+		inline WaterValue &	depth(uint32_t u, uint32_t v) { return cell(WaterPlane::DEPTH, u, v); }
+		inline WaterValue &	lFlow(uint32_t u, uint32_t v) { return cell(WaterPlane::L_FLOW, u, v); }
+		inline WaterValue &	tFlow(uint32_t u, uint32_t v) { return cell(WaterPlane::T_FLOW, u, v); }
+		inline float &	terrainH(uint32_t u, uint32_t v) { return at(WaterPlane::TERRAIN_H, u, v); }
+		inline float	depth(uint32_t u, uint32_t v) const { return cell(WaterPlane::DEPTH, u, v); }
+		inline float	lFlow(uint32_t u, uint32_t v) const { return cell(WaterPlane::L_FLOW, u, v); }
+		inline float	tFlow(uint32_t u, uint32_t v) const { return cell(WaterPlane::T_FLOW, u, v); }
+		inline float	terrainH(uint32_t u, uint32_t v) const { return at(WaterPlane::TERRAIN_H, u, v); }
+
+	private:
+		void	_free();
+		void	_releaseBlock(uint32_t id);
+		size_t	_getTileBytes() const;
+
+		inline uint8_t *	_cell(WaterPlane::Enum plane, uint32_t u, uint32_t v) const {
+			if (!_sparse)
+				return _planes[plane] + (static_cast<size_t>(v) * _stride + u) * valueSize(plane);
+			uint8_t * tile = _tiles[static_cast<size_t>(v / WATER_GRID_TILE_SIZE) * _tilesW
+				+ u / WATER_GRID_TILE_SIZE];
+			return tile + _tileOffsets[plane] + ((v % WATER_GRID_TILE_SIZE) * WATER_GRID_TILE_SIZE
+				+ u % WATER_GRID_TILE_SIZE) * valueSize(plane);
+		}
+
+		uint32_t	_width;  /**< Number of simulated columns per row */
+		uint32_t	_height;  /**< Number of rows */
+		uint32_t	_stride;  /**< Row length in cells, _width padded */
+		bool	_sparse;  /**< Planes stored in tiles, only the resident ones use memory */
+		uint8_t	*_data;  /**< Single allocation holding all the planes of a dense grid */
+		uint8_t	*_planes[WaterPlane::COUNT];  /**< First cell of each plane of a dense grid */
+
+		// sparse grid tiles
+		uint32_t	_tilesW;  /**< Number of tiles per row */
+		uint32_t	_tilesH;  /**< Number of tiles rows */
+		size_t	_tileOffsets[WaterPlane::COUNT];  /**< Offset of each plane in a tile block */
+		std::vector<uint8_t *>	_tiles;  /**< Block of each tile, _zeroTile if not resident */
+		uint8_t	*_zeroTile;  /**< Read only block of 0 */
+		uint8_t	*_pool;  /**< Reserved blocks, only the used ones are committed */
+		uint32_t	_poolUsed;  /**< Blocks ever taken since the last clear */
+		std::vector<uint32_t>	_freeBlocks;  /**< Given back blocks, taken again first */
+		std::vector<uint8_t>	_blockFree;  /**< 1 for each pool block not used by a tile */
+		uint32_t	_nbResidentTiles;
+		std::mutex	_poolMutex;  /**< Tiles can be allocated by parallel tiles rows */
+};
+
+#endif  // WATERGRID_HPP_
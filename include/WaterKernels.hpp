@@ -0,0 +1,74 @@
+#ifndef WATERKERNELS_HPP_
+#define WATERKERNELS_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include "WaterGrid.hpp"
+
+namespace WaterBoundary {
+	/**
+	 * @brief What the pipes crossing the grid borders do
+	 */
+	enum Enum {
+		WALL = 0,  // closed, no flow
+		OPEN,  // free outfall, the water leaves the grid at the critical flow
+		PERIODIC,  // the opposite borders are connected
+		COUNT
+	};
+}  // namespace WaterBoundary
+
+/**
+ * @brief Row kernels of the pipe model water update
+ *
+ * Each kernel exist in a scalar version and in vectorized versions (SSE2,
+ * AVX2) picked at runtime according to the cpu features. The vectorized
+ * kernels follow the scalar operations order and replace the branches by
+ * masks, they give the same result as the scalar one.
+ *
+ * The kernels are instantiated for each WaterBoundary, the border columns and
+ * rows are peeled so the interior loops do not test the position of the cells.
+ * The grid kernels split their span in the contiguous runs of the grid, the
+ * whole row of a dense grid or the tiles of a sparse one.
+ */
+namespace WaterKernels {
+	/**
+	 * @brief Constants used by the flow update
+	 */
+	struct FlowParams {
+		float	csaX;  /**< pipe cross-sectional area factor, left pipe */
+		float	csaY;  /**< pipe cross-sectional area factor, top pipe */
+		float	accX;  /**< gravity / pipe length, left pipe */
+		float	accY;  /**< gravity / pipe length, top pipe */
+		float	openX;  /**< free outfall discharge factor of the open left and right borders */
+		float	openY;  /**< free outfall discharge factor of the open top and bottom borders */
+		bool	limited;  /**< scale the previous flows by the OUT_SCALE plane first */
+	};
+
+	typedef void	(*FlowRowFunc)(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, FlowParams const & params);
+	typedef void	(*LimitRowFunc)(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, float gridArea, FlowParams const & params);
+	typedef void	(*DepthRowFunc)(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, float gridArea, FlowParams const & params);
+	typedef uint32_t	(*RainRowFunc)(WaterValue * depth, uint32_t uStart, uint32_t uEnd, uint32_t key,
+		uint32_t threshold, float amount);
+
+	/**
+	 * @brief A set of kernels
+	 */
+	struct Kernels {
+		char const *	name;
+		WaterBoundary::Enum	boundary;  /**< border pipes handled by the kernels */
+		FlowRowFunc		flowRow;  /**< update the left and top flows of the row columns [uStart, uEnd[ */
+		LimitRowFunc	limitRow;  /**< compute the outflow scale factor of the row columns [uStart, uEnd[ */
+		DepthRowFunc	depthRow;  /**< update the depth of the row columns [uStart, uEnd[ from their flows */
+		RainRowFunc		rainRow;  /**< add amount to the depth of the columns [uStart, uEnd[, depth points to uStart, whose Rng::at(key, u) >> 8 is below threshold, return the drops count */
+	};
+
+	Kernels const &	scalar(WaterBoundary::Enum boundary = WaterBoundary::WALL);
+	Kernels const &	best(WaterBoundary::Enum boundary = WaterBoundary::WALL);
+	std::vector<Kernels const *>	supported(WaterBoundary::Enum boundary);
+}  // namespace WaterKernels
+
+#endif  // WATERKERNELS_HPP_
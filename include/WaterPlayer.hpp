@@ -0,0 +1,92 @@
+#ifndef WATERPLAYER_HPP_
+#define WATERPLAYER_HPP_
+
+// frames read ahead of the played one
+#define WATER_REPLAY_READ_AHEAD 128
+#define WATER_REPLAY_MIN_SPEED 0.0625f
+#define WATER_REPLAY_MAX_SPEED 64.0f
+
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "WaterRecorder.hpp"
+
+/**
+ * @brief Play a record made by WaterRecorder
+ *
+ * The frames are streamed from the file by a read-ahead thread, the thread
+ * calling update() decodes them. Seeking decodes from the closest keyframe.
+ */
+class WaterPlayer {
+	public:
+		explicit WaterPlayer(std::string const & path);
+		virtual ~WaterPlayer();
+
+		bool	open();
+		bool	update(double dtTime);
+		void	seek(double time);
+		void	step(int32_t nbFrames);
+		void	setSpeed(float speed);
+
+		static bool	readHeader(std::string const & path, WaterRecordHeader & header,
+			std::string & mapPath);
+
+		WaterRecordHeader const &	getHeader() const;
+		std::string const &	getMapPath() const;
+		uint16_t const *	getFrame() const;
+		uint32_t	getFrameId() const;
+		uint32_t	getNbFrames() const;
+		double	getTime() const;
+		float	getSpeed() const;
+		bool	hasFailed() const;
+
+	private:
+		/**
+		 * @brief Encoded frame read ahead
+		 */
+		struct Chunk {
+			uint32_t	id;  // frame id, UINT32_MAX if empty
+			std::vector<uint8_t>	data;
+		};
+
+		WaterPlayer(WaterPlayer const &src);
+		WaterPlayer &operator=(WaterPlayer const &rhs);
+
+		bool	_readIndex();
+		bool	_scanIndex();
+		uint32_t	_frameAt(double time) const;
+		bool	_decodeTo(uint32_t target);
+		bool	_readChunk(std::ifstream & file, uint32_t id, std::vector<uint8_t> & data) const;
+		void	_readAheadLoop();
+
+		std::string	_path;
+		WaterRecordHeader	_header;
+		std::string	_mapPath;
+		std::vector<WaterRecordIndexEntry>	_index;
+		std::ifstream	_file;  // frames missed by the read-ahead
+
+		// playback, update() thread
+		double	_time;  // record time played
+		float	_speed;
+		uint32_t	_current;  // decoded frame, UINT32_MAX before the first one
+		bool	_failed;  // a frame can't be read or decoded, the playback stopped
+		std::vector<uint16_t>	_frame;
+		std::vector<uint16_t>	_prev;
+		std::vector<uint16_t>	_zero;
+		std::vector<uint8_t>	_encoded;
+
+		// read-ahead, the chunk of frame id is in _chunks[id % WATER_REPLAY_READ_AHEAD]
+		std::thread	_reader;
+		std::mutex	_chunksMutex;
+		std::condition_variable	_chunksCond;
+		std::vector<Chunk>	_chunks;
+		uint32_t	_wanted;  // first frame to read ahead
+		bool	_quit;
+};
+
+#endif  // WATERPLAYER_HPP_
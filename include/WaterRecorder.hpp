@@ -0,0 +1,145 @@
+#ifndef WATERRECORDER_HPP_
+#define WATERRECORDER_HPP_
+
+#define WATER_RECORD_MAGIC "MOD1REC"
+#define WATER_RECORD_INDEX_MAGIC "MOD1IDX"
+// increment on every layout change, older files are rejected
+#define WATER_RECORD_VERSION 1
+#define WATER_RECORD_EXT ".mod1rec"
+// quantized depth steps per meter, 16 bits cover 64m of water
+#define WATER_RECORD_SCALE 1024.0f
+// one frame in this many is encoded without delta, to seek in a record
+#define WATER_RECORD_KEYFRAME 64
+// frames waiting for the writer thread, a power of 2
+#define WATER_RECORD_QUEUE_SIZE 4
+// writer thread sleep when it has no frame to write (ms)
+#define WATER_RECORD_IDLE_SLEEP_MS 1
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "WaterGrid.hpp"
+#include "SpscQueue.hpp"
+
+/**
+ * @brief Record file header, followed by the map path then the frames
+ *
+ * All the values are stored in the machine byte order.
+ */
+struct	WaterRecordHeader {
+	char		magic[8];  /**< WATER_RECORD_MAGIC */
+	uint32_t	version;  /**< WATER_RECORD_VERSION */
+	uint32_t	width;  /**< Water columns per row */
+	uint32_t	height;  /**< Water columns rows */
+	float		scale;  /**< Quantized steps per meter */
+	uint32_t	keyframeInterval;  /**< Frames between two keyframes */
+	uint32_t	mapPathSize;  /**< Size of the map path following the header */
+	uint8_t		reserved[32];
+};
+
+namespace WaterRecordFlag {
+	/**
+	 * @brief Frame flags
+	 */
+	enum Enum {
+		KEYFRAME = 1  // not delta encoded
+	};
+}  // namespace WaterRecordFlag
+
+/**
+ * @brief Frame chunk header, followed by size bytes of encoded frame
+ */
+struct	WaterRecordFrameHeader {
+	uint32_t	size;  /**< Encoded frame size */
+	uint32_t	flags;  /**< WaterRecordFlag */
+	double		simTime;  /**< Simulated time of the frame (s) */
+};
+
+/**
+ * @brief Seek index entry, one per frame
+ */
+struct	WaterRecordIndexEntry {
+	uint64_t	offset;  /**< Frame chunk offset in the file */
+	double		simTime;  /**< Simulated time of the frame (s) */
+	uint32_t	size;  /**< Encoded frame size */
+	uint32_t	flags;  /**< WaterRecordFlag */
+};
+
+/**
+ * @brief Last bytes of a record, locate the index written after the frames
+ */
+struct	WaterRecordFooter {
+	uint64_t	indexOffset;  /**< Offset of the first index entry */
+	uint32_t	nbFrames;  /**< Number of index entries */
+	uint32_t	reserved;
+	char		magic[8];  /**< WATER_RECORD_INDEX_MAGIC */
+};
+
+/**
+ * @brief Record the water depth after each update in a compressed file
+ *
+ * The simulation thread only quantizes the depth to 16 bits and queues the
+ * frame, a full queue drops the frame instead of waiting. The writer thread
+ * delta encodes each frame against the previous written one, compresses it
+ * and appends it to the file. The seek index is written when the recorder is
+ * destroyed, which also prints the compression report.
+ */
+class WaterRecorder {
+	public:
+		WaterRecorder(std::string const & path, std::string const & mapPath, uint32_t width,
+			uint32_t height);
+		virtual ~WaterRecorder();
+
+		bool	start();
+		void	record(WaterGrid const & grid, double simTime);
+
+		static void	encode(uint16_t const * frame, uint16_t const * prev, size_t size,
+			std::vector<uint8_t> & out);
+		static bool	decode(uint8_t const * data, size_t dataSize, uint16_t const * prev,
+			uint16_t * frame, size_t size);
+
+	private:
+		/**
+		 * @brief Quantized depth of all the columns
+		 */
+		struct Frame {
+			std::vector<uint16_t>	depth;
+			double	simTime;
+		};
+
+		WaterRecorder(WaterRecorder const &src);
+		WaterRecorder &operator=(WaterRecorder const &rhs);
+
+		void	_writerLoop();
+		void	_writeFrame(Frame const & frame);
+		void	_writeIndex();
+		void	_report() const;
+
+		std::string	_path;
+		std::string	_mapPath;
+		uint32_t	_width;
+		uint32_t	_height;
+		std::ofstream	_file;
+
+		std::vector<Frame>	_frames;  // all the frames buffers
+		SpscQueue<Frame *, WATER_RECORD_QUEUE_SIZE>	_pending;  // frames to write
+		SpscQueue<Frame *, WATER_RECORD_QUEUE_SIZE>	_free;  // frames written, to reuse
+		std::thread	_writer;
+		std::atomic<bool>	_quit;
+
+		// writer thread
+		std::vector<uint16_t>	_prev;  // last written frame, delta reference
+		std::vector<uint16_t>	_zero;  // keyframes reference
+		std::vector<uint8_t>	_encoded;
+		std::vector<WaterRecordIndexEntry>	_index;
+		uint64_t	_offset;  // file size
+		double	_encodeTime;  // total time spent encoding (s)
+
+		std::atomic<uint32_t>	_nbDropped;  // frames dropped because the queue was full
+};
+
+#endif  // WATERRECORDER_HPP_
@@ -0,0 +1,80 @@
+#ifndef WATERSNAPSHOT_HPP_
+#define WATERSNAPSHOT_HPP_
+
+#define WATER_SNAPSHOT_MAGIC "MOD1SNAP"
+// increment on every layout change, older files are rejected
+#define WATER_SNAPSHOT_VERSION 1
+#define WATER_SNAPSHOT_EXT ".mod1snap"
+// planes saved in a snapshot, all the WaterGrid ones
+#define WATER_SNAPSHOT_NB_PLANES 5
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "WaterGrid.hpp"
+
+/**
+ * @brief Snapshot file header, followed by the planes and the tiles flags
+ *
+ * 64 bytes so the planes of a mapped file stay cache line aligned. All the
+ * values are stored in the machine byte order.
+ */
+struct	WaterSnapshotHeader {
+	char		magic[8];  /**< WATER_SNAPSHOT_MAGIC, without the '\0' */
+	uint32_t	version;  /**< WATER_SNAPSHOT_VERSION */
+	uint32_t	width;  /**< Water columns per row */
+	uint32_t	height;  /**< Water columns rows */
+	uint32_t	nbPlanes;  /**< WATER_SNAPSHOT_NB_PLANES */
+	uint32_t	scenario;  /**< FlowScenario simulated */
+	float		currentRiseH;  /**< Even rise scenario water height */
+	double		simTime;  /**< Simulated time since the scenario start (s) */
+	uint32_t	tileSize;  /**< Active tiles size, in columns */
+	uint32_t	nbTiles;  /**< Number of active tiles */
+	uint8_t		reserved[16];
+};
+
+/**
+ * @brief Saved water state: the grid planes, the active tiles and the
+ * scenario progress
+ *
+ * The planes are stored one after the other, width * height floats each
+ * without the grid row padding, in the snapshotPlanes order. Then come the
+ * awake and flow flags of the tiles, one byte each. A loaded file is memory
+ * mapped, restoring it only copies the planes rows in the grid.
+ */
+class WaterSnapshot {
+	public:
+		WaterSnapshot();
+		virtual ~WaterSnapshot();
+
+		void	capture(WaterGrid const & grid, std::vector<uint8_t> const & tileAwake,
+			std::vector<uint8_t> const & tileFlow, uint32_t scenario, float currentRiseH,
+			double simTime);
+		bool	save(std::string const & path) const;
+		bool	load(std::string const & path);
+		void	restore(WaterGrid & grid) const;
+
+		WaterSnapshotHeader const &	getHeader() const;
+		float const *	getPlane(WaterPlane::Enum plane) const;
+		uint8_t const *	getTileAwake() const;
+		uint8_t const *	getTileFlow() const;
+
+		static const WaterPlane::Enum	snapshotPlanes[WATER_SNAPSHOT_NB_PLANES];
+
+	private:
+		WaterSnapshot(WaterSnapshot const &src);
+		WaterSnapshot &operator=(WaterSnapshot const &rhs);
+
+		void	_unmap();
+		size_t	_planesSize() const;
+
+		std::vector<uint8_t>	_buffer;  // captured state, or the file content without mmap
+		void	*_mapped;  // mapped file
+		size_t	_mappedSize;
+		uint8_t const	*_data;  // snapshot content, header, planes then tiles flags
+		size_t	_size;
+};
+
+#endif  // WATERSNAPSHOT_HPP_
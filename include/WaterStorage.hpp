@@ -0,0 +1,149 @@
+#ifndef WATERSTORAGE_HPP_
+#define WATERSTORAGE_HPP_
+
+// storage formats of the water state planes (depth and flows)
+#define WATER_STORAGE_FP32 0  // 32 bits floats
+#define WATER_STORAGE_FP16 1  // 16 bits floats, computed as 32 bits floats
+#define WATER_STORAGE_FIXED 2  // 32 bits fixed point
+
+// format chosen at compile time, see the WATER_STORAGE cmake option
+#ifndef WATER_STORAGE
+	#define WATER_STORAGE WATER_STORAGE_FP32
+#endif
+
+// fractional bits of the fixed point format: 1/65536 resolution, +-32768 range
+#define WATER_FIXED_FRAC_BITS 16
+// value of one fixed point unit
+#define WATER_FIXED_STEP (1.0f / (1 << WATER_FIXED_FRAC_BITS))
+// bounds of the fixed point values, before scaling (2147483520 is the largest
+// float below 2^31)
+#define WATER_FIXED_MIN -2147483648.0f
+#define WATER_FIXED_MAX 2147483520.0f
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace WaterStorage {
+	/**
+	 * @brief Round a float to the nearest half float, ties to even, as the
+	 * F16C conversion does
+	 *
+	 * @param value the float to convert
+	 * @return uint16_t the half float bits
+	 */
+	inline uint16_t	floatToHalf(float value) {
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		uint32_t sign = (bits >> 16) & 0x8000;
+		bits &= 0x7fffffff;
+
+		// infinity and NaN, or too large (2^16): infinity
+		if (bits >= 0x47800000)
+			return sign | (bits > 0x7f800000 ? 0x7e00 : 0x7c00);
+		// subnormal half: the float addition of 0.5 rounds the mantissa
+		if (bits < 0x38800000) {
+			float absValue;
+			std::memcpy(&absValue, &bits, sizeof(bits));
+			absValue += 0.5f;
+			std::memcpy(&bits, &absValue, sizeof(bits));
+			return sign | (bits - 0x3f000000);
+		}
+		// normal half: rebias the exponent, round the 13 dropped bits to even,
+		// a mantissa overflow carries in the exponent
+		bits += 0xc8000fff + ((bits >> 13) & 1);
+		return sign | (bits >> 13);
+	}
+
+	/**
+	 * @brief Convert a half float to a float, exact
+	 *
+	 * @param half the half float bits
+	 * @return float the value
+	 */
+	inline float	halfToFloat(uint16_t half) {
+		uint32_t bits = static_cast<uint32_t>(half & 0x7fff) << 13;
+		uint32_t exponent = bits & 0x0f800000;
+		bits += 0x38000000;  // rebias the exponent
+		if (exponent == 0x0f800000) {  // infinity and NaN
+			bits += 0x38000000;
+		}
+		else if (exponent == 0) {  // zero and subnormal, renormalized by a float subtraction
+			float value;
+			bits += 0x00800000;
+			std::memcpy(&value, &bits, sizeof(bits));
+			value -= 6.103515625e-05f;  // 2^-14
+			std::memcpy(&bits, &value, sizeof(bits));
+		}
+		bits |= static_cast<uint32_t>(half & 0x8000) << 16;
+		float value;
+		std::memcpy(&value, &bits, sizeof(bits));
+		return value;
+	}
+
+	/**
+	 * @brief Round a float to the nearest fixed point value, ties to even and
+	 * saturated, as the SSE conversion of the clamped value does
+	 *
+	 * @param value the float to convert
+	 * @return int32_t the fixed point value
+	 */
+	inline int32_t	floatToFixed(float value) {
+		float scaled = value * static_cast<float>(1 << WATER_FIXED_FRAC_BITS);
+		scaled = std::min(std::max(scaled, WATER_FIXED_MIN), WATER_FIXED_MAX);
+		return static_cast<int32_t>(std::nearbyint(scaled));
+	}
+
+	/**
+	 * @brief Convert a fixed point value to a float
+	 *
+	 * @param fixed the fixed point value
+	 * @return float the value
+	 */
+	inline float	fixedToFloat(int32_t fixed) {
+		return static_cast<float>(fixed) * WATER_FIXED_STEP;
+	}
+}  // namespace WaterStorage
+
+/**
+ * @brief A water state value stored in a packed format and computed as a float
+ *
+ * Reading converts the value to a float, writing rounds the float back to the
+ * storage format. The class has the size of its storage, arrays of values are
+ * read by the kernels as arrays of Bits.
+ *
+ * @tparam Bits the storage type
+ * @tparam pack float to storage conversion
+ * @tparam unpack storage to float conversion
+ */
+template <typename Bits, Bits (*pack)(float), float (*unpack)(Bits)>
+class WaterPacked {
+	public:
+		WaterPacked() = default;
+		WaterPacked(float value) : _bits(pack(value)) {}
+
+		inline operator float() const { return unpack(_bits); }
+		inline WaterPacked &	operator+=(float value) { return *this = unpack(_bits) + value; }
+		inline WaterPacked &	operator-=(float value) { return *this = unpack(_bits) - value; }
+		inline WaterPacked &	operator*=(float value) { return *this = unpack(_bits) * value; }
+
+	private:
+		Bits	_bits;
+};
+
+#if WATER_STORAGE == WATER_STORAGE_FP16
+	typedef WaterPacked<uint16_t, WaterStorage::floatToHalf, WaterStorage::halfToFloat>	WaterValue;
+	#define WATER_STORAGE_NAME "fp16"
+#elif WATER_STORAGE == WATER_STORAGE_FIXED
+	typedef WaterPacked<int32_t, WaterStorage::floatToFixed, WaterStorage::fixedToFloat>	WaterValue;
+	#define WATER_STORAGE_NAME "fixed"
+#else
+	/**
+	 * @brief Value type of the water state planes
+	 */
+	typedef float	WaterValue;
+	#define WATER_STORAGE_NAME "fp32"
+#endif
+
+#endif  // WATERSTORAGE_HPP_
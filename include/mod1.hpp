@@ -9,6 +9,8 @@
 
 #include <cstdlib>
 #include <chrono>
+#include <string>
+#include <vector>
 
 #include "FileUtils.hpp"
 #include "SettingsJson.hpp"
@@ -24,10 +26,41 @@
 
 #define SETTINGS_FILE			CONFIG_DIR"settings.json"
 #define CONTROLS_FILE			CONFIG_DIR"controls.json"
+#define SNAPSHOTS_DIR			"snapshots/"
+#define CACHE_DIR				"cache/"
 
+// points of a .mod1 map, the point clouds have no limit
 #define MAX_POINTS_NB 50
 #define BOX_MAX_SIZE glm::vec3(64, 64, 64)
 #define BOX_GROUND_HEIGHT 24
+// terrain resolution, number of terrain points per side (water cells + 1)
+#define TERRAIN_DEF_RES 64
+#define TERRAIN_MIN_RES 8
+#define TERRAIN_MAX_RES 8192
+// headless mode defaults
+#define HEADLESS_DEF_STEPS 1000
+#define HEADLESS_DEF_DT 0.016
+#define HEADLESS_MAX_DT 1.0
+
+/**
+ * @brief Options given on the command line
+ */
+struct	CmdOptions {
+	std::vector<std::string>	mapsPath;  /**< Maps to load */
+	uint32_t	resolution;  /**< Terrain resolution, 0 to use the map or settings one */
+	bool		headless;  /**< Run the simulation without window */
+	uint32_t	steps;  /**< Headless number of updates */
+	std::string	scenario;  /**< Headless scenario name, empty for the default one */
+	float		dt;  /**< Headless update delta time */
+	std::string	restorePath;  /**< Snapshot restored in the first map, empty for none */
+	std::string	recordPath;  /**< Record of the first map water, empty for none */
+	std::string	replayPath;  /**< Record replayed on the first map, empty for none */
+	std::string	savePath;  /**< Headless snapshot of the first map water at the end, empty for none */
+	std::string	comparePath;  /**< Headless reference snapshot of the first map water, empty for none */
+	uint64_t	seed;  /**< Random numbers seed */
+	bool		hasSeed;  /**< The seed was given, else a random one is used */
+	CmdOptions();
+};
 
 void	initLogs();
 bool	checkPrgm();
@@ -35,7 +68,9 @@ bool	initSettings(std::string const & filename);
 bool	saveSettings(std::string const & filename);
 bool	usage();
 bool	hasSuffix(std::string const & str, std::string const & suffix);
-bool	argParse(int nbArgs, char const ** args, std::vector<std::string> & mapsPath);
+bool	argNumber(int nbArgs, char const ** args, int & i, double min, double max, double & value,
+	bool integer);
+bool	argParse(int nbArgs, char const ** args, CmdOptions & options);
 std::chrono::milliseconds	getMs();
 glm::vec4	colorise(uint32_t color, uint8_t alpha = 0xff);
 
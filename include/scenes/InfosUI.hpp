@@ -38,6 +38,7 @@ class InfosUI : public AUserInterface {
 		std::chrono::milliseconds	_lastUpdateMs;  /**< Last time fps was updated */
 		uint16_t	_fps;  /**< Actual FPS */
 		TextUI *	_fpsText;
+		TextUI *	_tilesText;
 		TextUI *	_mapText;
 		TextUI *	_scenarioText;
 		RectUI *	_pauseRect;
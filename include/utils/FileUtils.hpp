@@ -6,6 +6,7 @@
 namespace file {
 	bool	isFile(std::string const & path);
 	bool	isDir(std::string const & path);
+	std::string	canonical(std::string const & path);
 
 	bool	mkdir(std::string const & path, bool silent = false);
 	bool 	rm(std::string const & path, bool silent = false);
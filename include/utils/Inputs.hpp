@@ -20,6 +20,8 @@
 #define DEFAULT_DECREMENT_1	SDL_SCANCODE_LEFT
 #define DEFAULT_MODIFIER_1	SDL_SCANCODE_LSHIFT
 #define DEFAULT_MODIFIER_2	SDL_SCANCODE_LCTRL
+#define DEFAULT_SNAPSHOT	SDL_SCANCODE_F5
+#define DEFAULT_RESTORE		SDL_SCANCODE_F9
 
 namespace InputType {
 	/**
@@ -35,6 +37,8 @@ namespace InputType {
 		DECREMENT_1,
 		MODIFIER_1,
 		MODIFIER_2,
+		SNAPSHOT,
+		RESTORE,
 		NB_INPUTS  // need to be the last element
 	};
 }  // namespace InputType
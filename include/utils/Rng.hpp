@@ -0,0 +1,65 @@
+#ifndef RNG_HPP_
+#define RNG_HPP_
+
+#include <cstdint>
+
+/**
+ * @brief Counter-based random numbers
+ *
+ * A random number is a hash of a key and a counter, so any thread can draw
+ * the numbers of any stream in any order and always get the same values. The
+ * keys are derived from the program seed and the stream ids.
+ */
+namespace Rng {
+	void		setSeed(uint64_t seed);
+	uint64_t	getSeed();
+
+	/**
+	 * @brief splitmix64 finalizer, mix all the bits of a 64 bits value
+	 */
+	inline uint64_t	mix64(uint64_t x) {
+		x += 0x9e3779b97f4a7c15ull;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+
+	/**
+	 * @brief lowbias32 hash, mix all the bits of a 32 bits value, only use
+	 * operations available to the vectorized kernels
+	 */
+	inline uint32_t	mix32(uint32_t x) {
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		return x ^ (x >> 16);
+	}
+
+	/**
+	 * @brief Get the key of a stream, independent from the other streams keys
+	 *
+	 * @param stream the stream id
+	 * @param subStream the sub stream id
+	 * @return uint32_t the key to give to at()
+	 */
+	inline uint32_t	key(uint64_t stream, uint64_t subStream) {
+		return static_cast<uint32_t>(mix64(mix64(getSeed() ^ mix64(stream)) + subStream));
+	}
+
+	/**
+	 * @brief Get the counter-th random number of a stream
+	 */
+	inline uint32_t	at(uint32_t key, uint32_t counter) {
+		return mix32(key + counter);
+	}
+
+	/**
+	 * @brief Convert a random number to a float in ]0, 1]
+	 */
+	inline float	unit(uint32_t random) {
+		return ((random >> 8) + 1) * (1.0f / (1u << 24));
+	}
+}  // namespace Rng
+
+#endif  // RNG_HPP_
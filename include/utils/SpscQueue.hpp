@@ -0,0 +1,62 @@
+#ifndef SPSCQUEUE_HPP_
+#define SPSCQUEUE_HPP_
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @brief Lock-free bounded queue with a single producer and a single consumer
+ * thread
+ *
+ * @tparam T the item type
+ * @tparam SIZE the max number of queued items, a power of 2
+ */
+template<typename T, size_t SIZE>
+class SpscQueue {
+	static_assert(SIZE != 0 && (SIZE & (SIZE - 1)) == 0, "SpscQueue SIZE must be a power of 2");
+
+	public:
+		SpscQueue()
+		: _head(0),
+		  _tail(0) {}
+
+		/**
+		 * @brief Add an item, producer thread only
+		 *
+		 * @param item the item to add
+		 * @return false if the queue is full, the item is not added
+		 */
+		bool	push(T const & item) {
+			size_t tail = _tail.load(std::memory_order_relaxed);
+			if (tail - _head.load(std::memory_order_acquire) == SIZE)
+				return false;
+			_items[tail & (SIZE - 1)] = item;
+			_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		 * @brief Remove the oldest item, consumer thread only
+		 *
+		 * @param item filled with the removed item
+		 * @return false if the queue is empty
+		 */
+		bool	pop(T & item) {
+			size_t head = _head.load(std::memory_order_relaxed);
+			if (head == _tail.load(std::memory_order_acquire))
+				return false;
+			item = _items[head & (SIZE - 1)];
+			_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+	private:
+		SpscQueue(SpscQueue const &src);
+		SpscQueue &operator=(SpscQueue const &rhs);
+
+		T	_items[SIZE];
+		alignas(64) std::atomic<size_t>	_head;  /**< Next item to pop, written by the consumer */
+		alignas(64) std::atomic<size_t>	_tail;  /**< Next free slot, written by the producer */
+};
+
+#endif  // SPSCQUEUE_HPP_
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <mutex>
 
 /**
  * @brief sStat element (to store the stats of a function call)
@@ -17,7 +18,18 @@ struct sStat {
 };
 
 /**
- * @brief Stats object to manage functions calls stats
+ * @brief sValueStat element (to store the stats of a sampled value)
+ */
+struct sValueStat {
+	int	nbValues;  ///< Number of samples
+	double	total;  ///< Sum of the samples
+	double	min;  ///< Min sample
+	double	max;  ///< Max sample
+	double	last;  ///< Last sample
+};
+
+/**
+ * @brief Stats object to manage functions calls stats and sampled values stats
  */
 class Stats {
 	public:
@@ -25,10 +37,13 @@ class Stats {
 		~Stats();
 		static std::chrono::high_resolution_clock::time_point	startStats(std::string name);
 		static void	endStats(std::string name, std::chrono::high_resolution_clock::time_point startExecTime);
+		static void	addValue(std::string name, double value);
 		static void	printStats();
 
 		// Members
 		static std::unordered_map<std::string, struct sStat>	stats;  ///< Stats are stored here
+		static std::unordered_map<std::string, struct sValueStat>	values;  ///< Values stats are stored here
+		static std::mutex	valuesMutex;  ///< Protect values, added from any thread
 };
 
 // -- getStats for clasic functions --------------------------------------------
@@ -0,0 +1,55 @@
+#ifndef THREADPOOL_HPP_
+#define THREADPOOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Persistent pool of worker threads
+ *
+ * The workers are created once and sleep between two run() calls.
+ * run() dispatch the jobs [0, nbJobs[ on the workers and the calling thread,
+ * and only return once all of them are done, so each run() call act as a
+ * barrier between two phases of work. A background run never waits for the
+ * pool, it runs its jobs on the calling thread when the pool is busy or
+ * wanted by a foreground run.
+ */
+class ThreadPool {
+	public:
+		explicit ThreadPool(uint32_t nbThreads = 0);
+		virtual ~ThreadPool();
+
+		static ThreadPool &	get();
+		void		run(uint32_t nbJobs, std::function<void(uint32_t jobId)> const & job,
+			bool background = false);
+		uint32_t	getNbThreads() const;
+
+	private:
+		ThreadPool(ThreadPool const &src);
+		ThreadPool &operator=(ThreadPool const &rhs);
+
+		void	_workerLoop();
+		void	_runJobs();
+
+		std::vector<std::thread>	_workers;  /**< Workers, the calling thread is not part of it */
+		std::mutex	_mutex;  /**< Protect the members below */
+		std::mutex	_runMutex;  /**< Only one run() at a time */
+		std::atomic<uint32_t>	_nbWaiting;  /**< Foreground runs waiting for the pool */
+		std::condition_variable	_startCond;  /**< Wake up the workers */
+		std::condition_variable	_doneCond;  /**< Wake up the thread waiting in run() */
+		std::function<void(uint32_t)> const *	_job;  /**< Current job */
+		uint32_t	_nbJobs;  /**< Current number of jobs */
+		std::atomic<uint32_t>	_nextJob;  /**< Next job id to take */
+		uint32_t	_nbBusy;  /**< Number of workers still on the current run */
+		uint64_t	_generation;  /**< Incremented at every run() */
+		bool	_quit;  /**< True to stop the workers */
+
+		static thread_local bool	_inJob;  /**< True if this thread is running a job */
+};
+
+#endif  // THREADPOOL_HPP_
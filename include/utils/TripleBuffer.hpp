@@ -0,0 +1,84 @@
+#ifndef TRIPLEBUFFER_HPP_
+#define TRIPLEBUFFER_HPP_
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief Lock-free triple buffer, hand the last value written by a producer
+ * thread to a consumer thread
+ *
+ * The producer fill back() then publish() it, the consumer call update() to
+ * get the last published value in front(). Neither of them ever wait, a
+ * value published twice before the consumer update is skipped.
+ *
+ * @tparam T the buffered value type
+ */
+template<typename T>
+class TripleBuffer {
+	public:
+		TripleBuffer()
+		: _back(0),
+		  _middle(1),
+		  _front(2) {}
+
+		// -- producer ---------------------------------------------------------
+		/**
+		 * @brief Get the value being written, owned by the producer
+		 */
+		T &	back() { return _slots[_back]; }
+
+		/**
+		 * @brief Get the slot index of back(), to keep a producer state per slot
+		 */
+		uint8_t	backSlot() const { return _back; }
+
+		/**
+		 * @brief Publish the back value, the producer get a new back value
+		 */
+		void	publish() {
+			_back = _middle.exchange(_back | DIRTY, std::memory_order_acq_rel) & INDEX;
+		}
+
+		/**
+		 * @brief Check if the consumer got the last published value
+		 *
+		 * @return false if the last published value was not taken yet, it will
+		 * be skipped if another one is published
+		 */
+		bool	consumed() const {
+			return !(_middle.load(std::memory_order_acquire) & DIRTY);
+		}
+
+		// -- consumer ---------------------------------------------------------
+		/**
+		 * @brief Take the last published value if any
+		 *
+		 * @return true if front() changed
+		 */
+		bool	update() {
+			if (!(_middle.load(std::memory_order_relaxed) & DIRTY))
+				return false;
+			_front = _middle.exchange(_front, std::memory_order_acq_rel) & INDEX;
+			return true;
+		}
+
+		/**
+		 * @brief Get the last value taken by update(), owned by the consumer
+		 */
+		T const &	front() const { return _slots[_front]; }
+
+	private:
+		TripleBuffer(TripleBuffer const &src);
+		TripleBuffer &operator=(TripleBuffer const &rhs);
+
+		static constexpr uint8_t	INDEX = 0x3;  /**< Slot index bits */
+		static constexpr uint8_t	DIRTY = 0x4;  /**< Set when the middle slot is not consumed */
+
+		T	_slots[3];
+		uint8_t	_back;  /**< Producer slot */
+		std::atomic<uint8_t>	_middle;  /**< Exchanged slot index, with the DIRTY flag */
+		uint8_t	_front;  /**< Consumer slot */
+};
+
+#endif  // TRIPLEBUFFER_HPP_
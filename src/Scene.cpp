@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <limits>
 
 #ifdef _WIN32
 	#include <windows.h>
@@ -17,6 +18,7 @@ Scene::Scene(std::vector<Terrain *> & terrains)
   _infosUI(nullptr) {
 	_terrainId = 0;
 	_scenarioId = 0;
+	_allTerrains = false;
 	_pause = true;
 }
 
@@ -52,6 +54,7 @@ bool	Scene::init() {
 	_infosUI = new InfosUI(_gui, *this, _uiState);
 	_infosUI->init();
 
+	_allTerrains = s.j("simulation").b("allTerrains");
 	return true;
 }
 
@@ -59,6 +62,7 @@ bool	Scene::run() {
 	float	maxFrameDuration = 1000 / s.j("screen").u("maxFps");
 	std::chrono::milliseconds	lastLoopMs = getMs();
 
+	_updateBackground();
 	while (!_gui.gameInfo.quit) {
 		/* reset variables */
 		_dtTime = (getMs().count() - lastLoopMs.count()) / 1000.0;
@@ -109,9 +113,9 @@ bool	Scene::_update() {
 		_pause = !_pause;
 	}
 
-	// next/previous map
+	// next/previous map, paused unless all the maps are simulated
 	if (_uiState.leftBtn || _uiState.rightBtn) {
-		_pause = true;
+		_pause = _pause || !_allTerrains;
 		_terrainId += _uiState.rightBtn ? 1 : -1;
 		_uiState.rightBtn = false;
 		_uiState.leftBtn = false;
@@ -119,6 +123,36 @@ bool	Scene::_update() {
 			_terrainId = 0;
 		if (_terrainId < 0)
 			_terrainId = _terrains.size() - 1;
+		_updateBackground();
+	}
+
+	// save / restore the water state
+	if (Inputs::getKeyDown(InputType::SNAPSHOT))
+		_terrains[_terrainId]->getWater().saveSnapshot();
+	if (Inputs::getKeyDown(InputType::RESTORE))
+		restoreSnapshot(_terrains[_terrainId]->getWater().getSnapshotPath());
+
+	// replay controls, stepping frame by frame pauses the replay
+	Water & water = _terrains[_terrainId]->getWater();
+	if (water.isReplaying()) {
+		if (Inputs::getKeyByScancodeDown(SDL_SCANCODE_PERIOD)) {
+			_pause = true;
+			water.replayStep(1);
+		}
+		if (Inputs::getKeyByScancodeDown(SDL_SCANCODE_COMMA)) {
+			_pause = true;
+			water.replayStep(-1);
+		}
+		if (Inputs::getKeyByScancodeDown(SDL_SCANCODE_RIGHTBRACKET))
+			water.replaySpeed(2.0f);
+		if (Inputs::getKeyByScancodeDown(SDL_SCANCODE_LEFTBRACKET))
+			water.replaySpeed(0.5f);
+		if (Inputs::getKeyByScancodeDown(SDL_SCANCODE_PAGEUP))
+			water.replaySeek(SCENE_REPLAY_SEEK_S);
+		if (Inputs::getKeyByScancodeDown(SDL_SCANCODE_PAGEDOWN))
+			water.replaySeek(-SCENE_REPLAY_SEEK_S);
+		if (Inputs::getKeyByScancodeDown(SDL_SCANCODE_HOME))
+			water.replaySeek(-std::numeric_limits<float>::infinity());
 	}
 
 	// next scenario
@@ -134,9 +168,13 @@ bool	Scene::_update() {
 	}
 
 	if (!_pause) {
-		// update terrains/water
+		// update terrains/water, the displayed one first so it gets the threads pool
 		if (!_terrains[_terrainId]->update(_dtTime))
 			return false;
+		for (int32_t i = 0; _allTerrains && i < (int32_t)_terrains.size(); ++i) {
+			if (i != _terrainId && !_terrains[i]->update(_dtTime))
+				return false;
+		}
 	}
 
 	// orbit controls
@@ -147,6 +185,41 @@ bool	Scene::_update() {
 	return true;
 }
 
+/**
+ * @brief Restore the water of the current map from a snapshot, the simulation
+ * is paused
+ *
+ * @param path the snapshot file
+ * @return false if the snapshot can't be restored
+ */
+bool	Scene::restoreSnapshot(std::string const & path) {
+	Water & water = _terrains[_terrainId]->getWater();
+	if (!water.restoreSnapshot(path))
+		return false;
+	_pause = true;
+	_scenarioId = water.getScenario();
+	return true;
+}
+
+/**
+ * @brief Replace the water simulation of the current map by a record replay
+ *
+ * @param path the record file
+ * @return false if the record can't be replayed
+ */
+bool	Scene::startReplay(std::string const & path) {
+	return _terrains[_terrainId]->getWater().startReplay(path);
+}
+
+/**
+ * @brief Only the displayed water updates its mesh and has the threads pool
+ * priority
+ */
+void	Scene::_updateBackground() {
+	for (int32_t i = 0; i < (int32_t)_terrains.size(); ++i)
+		_terrains[i]->getWater().setBackground(i != _terrainId);
+}
+
 bool	Scene::_draw() {
 	// draw skybox
 	glm::mat4	view = _gui.cam->getViewMatrix();
@@ -174,6 +247,12 @@ uint16_t	Scene::getScenarioId() const { return _scenarioId; }
 bool	Scene::getPause() const { return _pause; }
 float	Scene::getOrbitDistance() const { return _orbitControls->getDistance(); }
 bool	Scene::isSandboxScenario() const { return _scenarioId == FlowScenario::SANDBOX; }
+uint32_t	Scene::getNbActiveTiles() const {
+	return _terrains[_terrainId]->getWater().getNbActiveTiles();
+}
+uint32_t	Scene::getNbTiles() const {
+	return _terrains[_terrainId]->getWater().getNbTiles();
+}
 // -- UiState ------------------------------------------------------------------
 UiState::UiState() {
 	leftBtn = false;
@@ -1,16 +1,105 @@
 #include <algorithm>
+#include <cmath>
 
 #include "Terrain.hpp"
+#include "TerrainCloud.hpp"
+#include "TerrainHeightmap.hpp"
 #include "Scene.hpp"
 #include "Water.hpp"
+#include "ThreadPool.hpp"
+
+#if defined(__SSE2__)
+	#define TERRAIN_SSE2 1
+	#include <emmintrin.h>
+#else
+	#define TERRAIN_SSE2 0
+#endif
+
+// terrain building phases names
+const std::string	Terrain::phaseName[] = {
+	"heights",
+	"shading",
+	"mesh"
+};
+
+/**
+ * @brief Inverse distance weighting of the closest points heights
+ *
+ * @param closest the closest points, from the closest one
+ * @param nbClosest the number of points
+ * @return float the interpolated height
+ */
+static float	idwScalar(TerrainPoints::HeightPoint const * closest, uint32_t nbClosest) {
+	float top = 0;
+	float bottom = 0;
+	for (uint32_t i = 0; i < nbClosest; ++i) {
+		float distPow = closest[i].distance;  // power of 1
+		distPow *= distPow;  // power of 2
+		distPow *= distPow;  // power of 4
+
+		top += closest[i].height / distPow;
+		bottom += 1.0 / distPow;
+	}
+
+	return top / bottom;
+}
+
+#if TERRAIN_SSE2
+/**
+ * @brief idwScalar on TERRAIN_BATCH vertices, one per lane
+ *
+ * Each lane does the scalar operations in the same order, the weight sum in
+ * double, so the heights are the scalar ones.
+ *
+ * @param closest NB_CLOSEST_POINTS closest points of each vertex
+ * @param heights the TERRAIN_BATCH interpolated heights
+ */
+static void	idwSse2(TerrainPoints::HeightPoint const (*closest)[NB_CLOSEST_POINTS], float * heights) {
+	static_assert(TERRAIN_BATCH == 4, "one vertex per SSE lane");
+	__m128 top = _mm_setzero_ps();
+	__m128 bottom = _mm_setzero_ps();
+	__m128d const one = _mm_set1_pd(1.0);
+	for (uint32_t i = 0; i < NB_CLOSEST_POINTS; ++i) {
+		__m128 distPow = _mm_setr_ps(closest[0][i].distance, closest[1][i].distance,
+			closest[2][i].distance, closest[3][i].distance);
+		__m128 height = _mm_setr_ps(closest[0][i].height, closest[1][i].height,
+			closest[2][i].height, closest[3][i].height);
+		distPow = _mm_mul_ps(distPow, distPow);
+		distPow = _mm_mul_ps(distPow, distPow);
+
+		top = _mm_add_ps(top, _mm_div_ps(height, distPow));
+		__m128d bottomLo = _mm_add_pd(_mm_cvtps_pd(bottom), _mm_div_pd(one, _mm_cvtps_pd(distPow)));
+		__m128d bottomHi = _mm_add_pd(_mm_cvtps_pd(_mm_movehl_ps(bottom, bottom)),
+			_mm_div_pd(one, _mm_cvtps_pd(_mm_movehl_ps(distPow, distPow))));
+		bottom = _mm_movelh_ps(_mm_cvtpd_ps(bottomLo), _mm_cvtpd_ps(bottomHi));
+	}
+	_mm_storeu_ps(heights, _mm_div_ps(top, bottom));
+}
+#endif
 
 // -- Constructors -------------------------------------------------------------
 
-Terrain::Terrain(std::string const mapPath, Gui & gui, Scene & scene)
+/**
+ * @brief Construct a new Terrain object
+ *
+ * @param mapPath the map file
+ * @param gui the gui
+ * @param scene the scene
+ * @param resolution number of points per side, 0 to use the map file or
+ * settings one
+ * @param headless true to only build the heightfield, without any GL call
+ */
+Terrain::Terrain(std::string const mapPath, Gui & gui, Scene & scene, uint32_t resolution,
+	bool headless)
 : _gui(gui),
   _scene(scene),
   _mapPath(mapPath),
   _map(nullptr),
+  _heightmap(nullptr),
+  _resolution(resolution),
+  _useCache(false),
+  _loadTime(0),
+  _headless(headless),
   _vao(0),
   _vbo(0),
   _ebo(0),
@@ -20,38 +109,50 @@ Terrain::Terrain(std::string const mapPath, Gui & gui, Scene & scene)
   _minH(0),
   _maxH(0)
 {
+	_phaseTime.fill(0.0);
+
 	// init static shader if null
-	if (!_sh) {
+	if (!_headless && !_sh) {
 		_sh = std::unique_ptr<Shader>(
 			new Shader("shaders/terrain_vs.glsl", "shaders/terrain_fs.glsl"));
 	}
 
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	_loadFile();
+	_loadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
 	_water = new Water(*this, _gui);
 }
 
 Terrain::~Terrain() {
 	// free vao / vbo
-	_sh->use();
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-	glDeleteBuffers(1, &_vbo);
-	glDeleteBuffers(1, &_ebo);
-	glDeleteVertexArrays(1, &_vao);
-	glDeleteBuffers(1, &_vboB);
-	glDeleteBuffers(1, &_eboB);
-	glDeleteVertexArrays(1, &_vaoB);
-	_sh->unuse();
+	if (!_headless) {
+		_sh->use();
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+		glDeleteBuffers(1, &_vbo);
+		glDeleteBuffers(1, &_ebo);
+		glDeleteVertexArrays(1, &_vao);
+		glDeleteBuffers(1, &_vboB);
+		glDeleteBuffers(1, &_eboB);
+		glDeleteVertexArrays(1, &_vaoB);
+		_sh->unuse();
+	}
 
 	delete _water;
+	delete _heightmap;
 }
 
 Terrain::Terrain(Terrain const &src)
 : _gui(src._gui),
   _scene(src._scene),
   _map(nullptr),
+  _heightmap(nullptr),
+  _resolution(src._resolution),
+  _useCache(false),
+  _loadTime(0),
+  _headless(src._headless),
   _vao(0),
   _vbo(0),
   _ebo(0),
@@ -72,7 +173,72 @@ Terrain &Terrain::operator=(Terrain const &rhs) {
 
 // -- Methods ------------------------------------------------------------------
 
+/**
+ * @brief Load the map points, a .mod1 map or a point cloud, and index them
+ * with the border points, or load a heightmap used without interpolation
+ */
 void	Terrain::_loadFile() {
+	if (TerrainHeightmap::isHeightmap(_mapPath)) {
+		_heightmap = new TerrainHeightmap();
+		if (!_heightmap->load(_mapPath))
+			throw TerrainException(std::string("Map \"" + _mapPath + "\", unable to load the heightmap").c_str());
+		// one vertex per height by default, in the resolution limits
+		if (_resolution.x == 0) {
+			uint32_t res = std::max(_heightmap->getWidth(), _heightmap->getHeight());
+			_resolution = glm::uvec2(std::min(std::max(res, static_cast<uint32_t>(TERRAIN_MIN_RES)),
+				static_cast<uint32_t>(TERRAIN_MAX_RES)));
+		}
+		if (_resolution.x < TERRAIN_MIN_RES) {
+			throw TerrainException(std::string("Map \"" + _mapPath + "\", resolution below the minimum: " +
+				std::to_string(TERRAIN_MIN_RES)).c_str());
+		}
+		return;
+	}
+
+	// a terrain built by a previous launch skips the map loading
+	_useCache = s.j("simulation").b("terrainCache");
+	if (_useCache && _cache.lookup(_mapPath, _cacheParams())) {
+		_resolution = glm::uvec2(_cache.getHeader().width, _cache.getHeader().height);
+		return;
+	}
+
+	if (TerrainCloud::isCloud(_mapPath)) {
+		TerrainCloud cloud;
+		_mapPoints.setTruncated(false);  // the cloud points are closer than the integer coordinates
+		if (!cloud.load(_mapPath, _mapPoints))
+			throw TerrainException(std::string("Map \"" + _mapPath + "\", unable to load the points").c_str());
+	}
+	else {
+		_loadMap();
+	}
+
+	// the command line resolution override the map one, which override the settings one
+	if (_resolution.x == 0)
+		_resolution = glm::uvec2(s.j("simulation").u("resolution"));
+	if (_resolution.x < TERRAIN_MIN_RES) {
+		throw TerrainException(std::string("Map \"" + _mapPath + "\", resolution below the minimum: " +
+			std::to_string(TERRAIN_MIN_RES)).c_str());
+	}
+
+	// fill map border with 0 altitude, the map points keep their position
+	for (uint16_t x = 0; x < BOX_MAX_SIZE.x; x += BOX_B_STEP) {
+		_mapPoints.add(glm::vec3(x, 0, 0));
+		_mapPoints.add(glm::vec3(x, 0, BOX_MAX_SIZE.z - 1));
+	}
+	for (uint16_t z = 0; z < BOX_MAX_SIZE.z; z += BOX_B_STEP) {
+		_mapPoints.add(glm::vec3(0, 0, z));
+		_mapPoints.add(glm::vec3(BOX_MAX_SIZE.x - 1, 0, z));
+	}
+
+	// index the points once for the vertices interpolation
+	_mapPoints.build();
+}
+
+/**
+ * @brief Load the points and the resolution of a .mod1 map, at most
+ * MAX_POINTS_NB points
+ */
+void	Terrain::_loadMap() {
 	_map = new SettingsJson();
 
 	SettingsJson * coord3d = new SettingsJson();
@@ -81,6 +247,8 @@ void	Terrain::_loadFile() {
 	coord3d->add<int64_t>("z").setMin(1).setMax(BOX_MAX_SIZE.z - 1);
 
 	_map->addList<SettingsJson>("map", coord3d);
+	_map->add<int64_t>("resolution", 0).setMin(0).setMax(TERRAIN_MAX_RES)
+		.setDescription("Number of points per side, 0 to use the settings one");
 
 	bool failure = false;
 	std::string errMsg;
@@ -99,6 +267,10 @@ void	Terrain::_loadFile() {
 			", compare with the example: \"asset/map/example1.mod1\"").c_str());
 	}
 
+	// the command line resolution override the map one
+	if (_resolution.x == 0)
+		_resolution = glm::uvec2(_map->i("resolution"));
+
 	for (SettingsJson * p : _map->lj("map").list) {
 		// limit points numbers to MAX_POINTS_NB
 		if (_mapPoints.size() == MAX_POINTS_NB) {
@@ -107,22 +279,11 @@ void	Terrain::_loadFile() {
 				std::to_string(MAX_POINTS_NB)).c_str());
 		}
 
-		auto eRes = _mapPoints.emplace(p->i("x"), p->i("y"), p->i("z"));
-		if (!std::get<1>(eRes))
+		if (!_mapPoints.add(glm::vec3(p->i("x"), p->i("y"), p->i("z"))))
 			logWarn("duplicate points in \"" << _mapPath << "\", skipped");
 	}
 
 	delete _map;
-
-	// fill map border with 0 altitude
-	for (uint16_t x = 0; x < BOX_MAX_SIZE.x; x += BOX_B_STEP) {
-		_mapPoints.emplace(x, 0, 0);
-		_mapPoints.emplace(x, 0, BOX_MAX_SIZE.z - 1);
-	}
-	for (uint16_t z = 0; z < BOX_MAX_SIZE.z; z += BOX_B_STEP) {
-		_mapPoints.emplace(0, 0, z);
-		_mapPoints.emplace(BOX_MAX_SIZE.x - 1, 0, z);
-	}
 }
 
 bool	Terrain::draw(bool wireframe) {
@@ -152,7 +313,13 @@ bool	Terrain::draw(bool wireframe) {
 	return true;
 }
 
-float	Terrain::_calculateHeight(glm::uvec2 pos) {
+/**
+ * @brief Interpolate the height of a point from the map points
+ *
+ * @param pos the point position, in map coordinates [0, BOX_MAX_SIZE - 1]
+ * @return float the point height
+ */
+float	Terrain::_calculateHeight(glm::vec2 pos) const {
 	// is pos outside the terrain limit ?
 	if (pos.x > BOX_MAX_SIZE.x || pos.y > BOX_MAX_SIZE.z) {
 		logErr(std::string("[_calculateHeight] pos " + glm::to_string(pos) +
@@ -160,56 +327,96 @@ float	Terrain::_calculateHeight(glm::uvec2 pos) {
 	}
 
 	// we already know pos height
-	for (const glm::vec3 & p: _mapPoints) {
-		if (glm::uvec2(p.x, p.z) == pos)
-			return p.y;
-	}
+	float height;
+	if (_mapPoints.getExactHeight(pos, height))
+		return height;
 
 	/* we need to interpolate the height */
-	std::vector<HeightPoint> closPoints = _getNClosest(pos, NB_CLOSEST_POINTS);
-
-	// inverse distance weighting
-	float top = 0;
-	float bottom = 0;
-	for (HeightPoint heightP : closPoints) {
-		float distPow = heightP.distance;  // power of 1
-		distPow *= distPow;  // power of 2
-		distPow *= distPow;  // power of 3
+	std::array<TerrainPoints::HeightPoint, NB_CLOSEST_POINTS> closPoints;
+	uint32_t nbClosest = _mapPoints.getNClosest(pos, NB_CLOSEST_POINTS, closPoints.data());
+	return idwScalar(closPoints.data(), nbClosest);
+}
 
-		top += heightP.height / distPow;
-		bottom += 1.0 / distPow;
-	}
+/**
+ * @brief _calculateHeight of TERRAIN_BATCH points on a line, the weights
+ * of the points are computed together
+ *
+ * @param pos the first point position, in map coordinates
+ * @param step the space between two points
+ * @param heights the TERRAIN_BATCH points heights
+ */
+void	Terrain::_calculateHeights(glm::vec2 pos, glm::vec2 step, float * heights) const {
+	#if TERRAIN_SSE2
+		// the points out of the batch weighting are computed alone
+		TerrainPoints::HeightPoint	closest[TERRAIN_BATCH][NB_CLOSEST_POINTS];
+		bool batch = true;
+		for (uint32_t i = 0; batch && i < TERRAIN_BATCH; ++i) {
+			glm::vec2 iPos = pos + step * static_cast<float>(i);
+			float height;
+			batch = iPos.x <= BOX_MAX_SIZE.x && iPos.y <= BOX_MAX_SIZE.z
+				&& !_mapPoints.getExactHeight(iPos, height)
+				&& _mapPoints.getNClosest(iPos, NB_CLOSEST_POINTS, closest[i]) == NB_CLOSEST_POINTS;
+		}
+		if (batch) {
+			idwSse2(closest, heights);
+			return;
+		}
+	#endif
 
-	return top / bottom;
+	for (uint32_t i = 0; i < TERRAIN_BATCH; ++i)
+		heights[i] = _calculateHeight(pos + step * static_cast<float>(i));
 }
 
 /**
- * @brief return the n closest point to pos
+ * @brief Set the vertices positions of a terrain row, the heights of the
+ * border ones are null
+ *
+ * A heightmap is resampled with a bilinear filter, its heights are copied at
+ * its own resolution.
  *
- * @param pos the pos of the point we want to compare
- * @param n the number of points to keep
- * @return std::vector<HeightPoint> n closest points to pos
+ * @param z the row id
  */
-std::vector<Terrain::HeightPoint>	Terrain::_getNClosest(glm::uvec2 pos, uint8_t n) {
-	std::vector<HeightPoint>	allPoints;
-	std::vector<HeightPoint>	res(_mapPoints.size() < n ? _mapPoints.size() : n);
-
-	// calculate distance for each points
-	for (const glm::vec3 & p: _mapPoints) {
-		HeightPoint heightP;
-		heightP.distance = glm::distance(glm::vec2(pos), glm::vec2(p.x, p.z));
-		heightP.height = p.y;
-		allPoints.push_back(heightP);
+void	Terrain::_initRowHeights(uint32_t z) {
+	TerrainVert * row = &_vertices[static_cast<size_t>(z) * _resolution.x];
+	float pZ = static_cast<float>(z) / (_resolution.y - 1) * BOX_MAX_SIZE.z;
+	for (uint32_t x = 0; x < _resolution.x; ++x) {
+		float pX = static_cast<float>(x) / (_resolution.x - 1) * BOX_MAX_SIZE.x;
+		row[x].pos = {pX, 0, pZ};
+	}
+	// a cached row is copied with its border
+	if (_cache.isHit()) {
+		float const * heights = _cache.getHeights() + static_cast<size_t>(z) * _resolution.x;
+		for (uint32_t x = 0; x < _resolution.x; ++x)
+			row[x].pos.y = heights[x];
+		return;
+	}
+	// force border to have null altitude
+	if (z == 0 || z == _resolution.y - 1)
+		return;
+
+	if (_heightmap) {
+		// the scale is 1 at the heightmap resolution, its heights are exact
+		double uScale = static_cast<double>(_heightmap->getWidth() - 1) / (_resolution.x - 1);
+		double v = static_cast<double>(z) * (_heightmap->getHeight() - 1) / (_resolution.y - 1);
+		for (uint32_t x = 1; x < _resolution.x - 1; ++x)
+			row[x].pos.y = _heightmap->sample(x * uScale, v);
+		return;
 	}
 
-	// keep the n closest
-	std::partial_sort_copy(allPoints.begin(), allPoints.end(), res.begin(), res.end(),
-		[](HeightPoint lhs, HeightPoint rhs) { return lhs.distance < rhs.distance; });
-
-	return res;
+	// map coordinates of the points
+	glm::vec2 mapStep = glm::vec2(BOX_MAX_SIZE.x - 1, BOX_MAX_SIZE.z - 1) / glm::vec2(_resolution - 1u);
+	uint32_t x = 1;
+	for (; x + TERRAIN_BATCH < _resolution.x; x += TERRAIN_BATCH) {
+		float heights[TERRAIN_BATCH];
+		_calculateHeights(glm::vec2(x, z) * mapStep, glm::vec2(mapStep.x, 0), heights);
+		for (uint32_t i = 0; i < TERRAIN_BATCH; ++i)
+			row[x + i].pos.y = heights[i];
+	}
+	for (; x < _resolution.x - 1; ++x)
+		row[x].pos.y = _calculateHeight(glm::vec2(x, z) * mapStep);
 }
 
-glm::vec3	Terrain::_calculateNormal(uint32_t x, uint32_t z) {
+glm::vec3	Terrain::_calculateNormal(uint32_t x, uint32_t z) const {
 	float hL, hR, hB, hT;
 
 	// hL
@@ -218,12 +425,12 @@ glm::vec3	Terrain::_calculateNormal(uint32_t x, uint32_t z) {
 	else
 		hL = TERRAIN_H(x, z);
 	// hR
-	if (x < BOX_MAX_SIZE.x - 1)
+	if (x < _resolution.x - 1)
 		hR = TERRAIN_H(x + 1, z);
 	else
 		hR = TERRAIN_H(x, z);
 	// hT
-	if (z < BOX_MAX_SIZE.z - 1)
+	if (z < _resolution.y - 1)
 		hT = TERRAIN_H(x, z + 1);
 	else
 		hT = TERRAIN_H(x, z);
@@ -234,14 +441,15 @@ glm::vec3	Terrain::_calculateNormal(uint32_t x, uint32_t z) {
 		hB = TERRAIN_H(x, z);
 
 	float sx = hR - hL;
-	if (x == 0 || x == BOX_MAX_SIZE.x - 1)
+	if (x == 0 || x == _resolution.x - 1)
 		sx *= 2;
 
 	float sy = hB - hT;
-	if (z == 0 || z == BOX_MAX_SIZE.z -1)
+	if (z == 0 || z == _resolution.y - 1)
 		sy *= 2;
 
-	glm::vec3 norm(-sx, 2.0, sy);
+	// the height differences are taken over 2 points spaces
+	glm::vec3 norm(-sx, 2.0 * (BOX_MAX_SIZE.x - 1) / (_resolution.x - 1), sy);
 
 	return glm::normalize(norm);
 }
@@ -249,64 +457,99 @@ glm::vec3	Terrain::_calculateNormal(uint32_t x, uint32_t z) {
 bool	Terrain::init() {
 	if (!_initMesh())
 		return false;
-	if (!_initMeshBorder())
+	// the heights are in the vertices now
+	delete _heightmap;
+	_heightmap = nullptr;
+	if (!_headless && !_initMeshBorder())
 		return false;
 	if (!_water->init())
 		return false;
 	return true;
 }
 
+/**
+ * @brief Build the terrain vertices, then the mesh with a window
+ *
+ * The rows are split in jobs of TERRAIN_JOB_ROWS on the threads pool: first
+ * the heights, then the normals and colors that need the finished heights
+ * and the heights range.
+ *
+ * @return false on error
+ */
 bool	Terrain::_initMesh() {
-	// fill vertices
-	for (uint16_t z = 0; z < BOX_MAX_SIZE.z; ++z) {
-		for (uint16_t x = 0; x < BOX_MAX_SIZE.x; ++x) {
-			TerrainVert	vert;
-			float pX = x / (BOX_MAX_SIZE.x - 1) * BOX_MAX_SIZE.x;
-			float pZ = z / (BOX_MAX_SIZE.z - 1) * BOX_MAX_SIZE.z;
-
-			// force border to have null altitude
-			if (x == 0 || x == BOX_MAX_SIZE.x - 1 || z == 0 || z == BOX_MAX_SIZE.z - 1)
-				vert.pos = {pX, 0, pZ};
-			else
-				vert.pos = {pX, _calculateHeight({x, z}), pZ};
-			_vertices.push_back(vert);
+	typedef std::chrono::steady_clock	Clock;
+	Clock::time_point phaseStart = Clock::now();
+	_phaseTime.fill(0.0);
+
+	// fill vertices positions, and the heights range of each job
+	_vertices.resize(static_cast<size_t>(_resolution.x) * _resolution.y);
+	uint32_t nbJobs = (_resolution.y + TERRAIN_JOB_ROWS - 1) / TERRAIN_JOB_ROWS;
+	std::vector<glm::vec2> jobRange(nbJobs);
+	ThreadPool::get().run(nbJobs, [this, &jobRange](uint32_t jobId) {
+		uint32_t zStart = jobId * TERRAIN_JOB_ROWS;
+		uint32_t zEnd = std::min(zStart + TERRAIN_JOB_ROWS, _resolution.y);
+		glm::vec2 range(INFINITY, -INFINITY);
+		for (uint32_t z = zStart; z < zEnd; ++z) {
+			_initRowHeights(z);
+			for (uint32_t x = 0; x < _resolution.x && !_cache.isHit(); ++x) {
+				range.x = std::min(range.x, TERRAIN_H(x, z));
+				range.y = std::max(range.y, TERRAIN_H(x, z));
+			}
 		}
+		jobRange[jobId] = range;
+	});
+	_minH = jobRange[0].x;
+	_maxH = jobRange[0].y;
+	for (glm::vec2 const & range : jobRange) {
+		_minH = std::min(_minH, range.x);
+		_maxH = std::max(_maxH, range.y);
 	}
+	if (_cache.isHit()) {
+		_minH = _cache.getHeader().minH;
+		_maxH = _cache.getHeader().maxH;
+	}
+	_endPhase(TerrainPhase::HEIGHTS, phaseStart);
 
-	// fill vert colors
-	_initColors();
-
-	// calc vertices normals
-	for (TerrainVert & vert : _vertices) {
-		uint16_t x = vert.pos.x / BOX_MAX_SIZE.x * (BOX_MAX_SIZE.x - 1);
-		uint16_t z = vert.pos.z / BOX_MAX_SIZE.z * (BOX_MAX_SIZE.z - 1);
-		vert.norm = _calculateNormal(x, z);
+	// only the heights are used without rendering
+	if (_headless) {
+		_endCache();
+		return true;
 	}
 
+	// fill vertices normals and colors
+	_initShading();
+	_endPhase(TerrainPhase::SHADING, phaseStart);
+	_endCache();
+
 	// fill indices
 	// By repeating the last vertex and the first vertex, we created four
 	// degenerate triangles that will be skipped, and linked the first row
 	// with the second. We could link an arbitrary number of rows this way and
 	// draw the entire mesh with only one call
 	// cf: learnopengles.com/tag/triangle-strips
-	for (uint16_t y = 0; y < BOX_MAX_SIZE.z - 1; ++y) {
+	// each strip row has 2 indices per column, and the degenerate ones
+	// between the rows
+	size_t rowIndices = static_cast<size_t>(_resolution.x) * 2 + 2;
+	_indices.resize(rowIndices * (_resolution.y - 1) - 2);
+	ThreadPool::get().run(_resolution.y - 1, [this, rowIndices](uint32_t y) {
+		uint32_t * indices = &_indices[y == 0 ? 0 : rowIndices * y - 1];
 		// duplicate first vertice to generate degenerate triangle
 		if (y > 0)
-			_indices.push_back(y * BOX_MAX_SIZE.x);
+			*indices++ = y * _resolution.x;
 
 		uint32_t a = 0;
 		uint32_t b = 0;
-		for (uint16_t x = 0; x < BOX_MAX_SIZE.x; ++x) {
-			a = x + y * BOX_MAX_SIZE.x;
-			b = a + BOX_MAX_SIZE.x;
-			_indices.push_back(a);
-			_indices.push_back(b);
+		for (uint32_t x = 0; x < _resolution.x; ++x) {
+			a = x + y * _resolution.x;
+			b = a + _resolution.x;
+			*indices++ = a;
+			*indices++ = b;
 		}
 
 		// duplicate last vertice to generate degenerate triangle
-		if (y != BOX_MAX_SIZE.z - 2)
-			_indices.push_back(b);
-	}
+		if (y != _resolution.y - 2)
+			*indices = b;
+	});
 
 	// create vao, vbo, ebo
 	glGenVertexArrays(1, &_vao);
@@ -342,7 +585,11 @@ bool	Terrain::_initMesh() {
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	_staticUniform();
+	_endPhase(TerrainPhase::MESH, phaseStart);
 
+	logInfo("terrain " << _resolution.x << "x" << _resolution.y << " built: heights "
+		<< _phaseTime[TerrainPhase::HEIGHTS] << "s, shading " << _phaseTime[TerrainPhase::SHADING]
+		<< "s, mesh " << _phaseTime[TerrainPhase::MESH] << "s");
 	return true;
 }
 
@@ -421,34 +668,37 @@ bool	Terrain::_initMeshBorder() {
 	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
 	return true;
 }
 
-void	Terrain::_initColors() {
-	// calc min/max height
-	_minH = _vertices[0].pos.y;
-	_maxH = _minH;
-	for (TerrainVert & vert : _vertices) {
-		if (vert.pos.y < _minH)
-			_minH = vert.pos.y;
-		if (vert.pos.y > _maxH)
-			_maxH = vert.pos.y;
-	}
-
+/**
+ * @brief Fill the vertices normals and colors, in a single pass over the rows
+ * after the heights and their range
+ */
+void	Terrain::_initShading() {
 	// apply color based on the height ratio and the colors gradient array
 	float diffH = _maxH - _minH;
-	for (TerrainVert & vert : _vertices) {
-		float ratio = (vert.pos.y - _minH) / diffH;
-		vert.color = _calcColor(ratio);
-	}
+	uint32_t nbJobs = (_resolution.y + TERRAIN_JOB_ROWS - 1) / TERRAIN_JOB_ROWS;
+	glm::vec3 const * normals = _cache.hasNormals() ? _cache.getNormals() : nullptr;
+	ThreadPool::get().run(nbJobs, [this, diffH, normals](uint32_t jobId) {
+		uint32_t zStart = jobId * TERRAIN_JOB_ROWS;
+		uint32_t zEnd = std::min(zStart + TERRAIN_JOB_ROWS, _resolution.y);
+		for (uint32_t z = zStart; z < zEnd; ++z) {
+			for (uint32_t x = 0; x < _resolution.x; ++x) {
+				size_t id = static_cast<size_t>(z) * _resolution.x + x;
+				TerrainVert & vert = _vertices[id];
+				vert.norm = normals ? normals[id] : _calculateNormal(x, z);
+				vert.color = _calcColor((vert.pos.y - _minH) / diffH);
+			}
+		}
+	});
 
 	// init border color
 	float ratio = -_minH / diffH;
 	_borderColor = _calcColor(ratio);
 }
 
-glm::vec3	Terrain::_calcColor(float ratio) {
+glm::vec3	Terrain::_calcColor(float ratio) const {
 	float step = 1.0 / (_colors.size() - 1);
 
 	for (uint8_t i = 0; i < _colors.size() - 1; ++i) {
@@ -490,6 +740,66 @@ void	Terrain::_staticUniform() {
 	_sh->unuse();
 }
 
+/**
+ * @brief Add the time elapsed since start to a phase, then restart start
+ *
+ * @param phase the phase to account the time to
+ * @param start the phase start time, set to now
+ */
+void	Terrain::_endPhase(TerrainPhase::Enum phase, std::chrono::steady_clock::time_point & start) {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	_phaseTime[phase] += std::chrono::duration<double>(now - start).count();
+	start = now;
+}
+
+/**
+ * @brief Hash the parameters the vertices depend on, besides the map content
+ */
+uint64_t	Terrain::_cacheParams() const {
+	std::array<float, 9> params = {
+		static_cast<float>(_resolution.x),  // the command line one, 0 if not given
+		static_cast<float>(s.j("simulation").u("resolution")),
+		NB_CLOSEST_POINTS,
+		BOX_B_STEP,
+		BOX_MAX_SIZE.x,
+		BOX_MAX_SIZE.y,
+		BOX_MAX_SIZE.z,
+		BOX_GROUND_HEIGHT,
+		TERRAIN_POINTS_MIN_DIST,
+	};
+	// the extension selects the loader, and the distances truncation
+	size_t dot = _mapPath.find_last_of('.');
+	std::string ext = dot == std::string::npos ? "" : _mapPath.substr(dot);
+	return TerrainCache::hash(ext.data(), ext.size(), TerrainCache::hash(params.data(), sizeof(params)));
+}
+
+/**
+ * @brief Save the built vertices on a cache miss, log the time saved on a hit
+ *
+ * A headless build has no normals, they are added by the next launch with a
+ * window.
+ */
+void	Terrain::_endCache() {
+	if (!_useCache)
+		return;
+
+	double buildTime = _loadTime + _phaseTime[TerrainPhase::HEIGHTS] + _phaseTime[TerrainPhase::SHADING];
+	if (!_cache.isHit()) {
+		_cache.save(_vertices, _resolution, _minH, _maxH, !_headless, buildTime);
+		return;
+	}
+
+	double savedTime = _cache.getHeader().buildTime;
+	bool addNormals = !_headless && !_cache.hasNormals();
+	if (addNormals)  // the normals were computed on this launch
+		buildTime -= _phaseTime[TerrainPhase::SHADING];
+	logInfo("\"" << _mapPath << "\": terrain loaded from the cache in " << buildTime << "s, "
+		<< savedTime - buildTime << "s saved");
+	_cache.release();
+	if (addNormals)
+		_cache.save(_vertices, _resolution, _minH, _maxH, true, savedTime + _phaseTime[TerrainPhase::SHADING]);
+}
+
 bool	Terrain::update(float dtTime) {
 	return _water->update(dtTime);
 }
@@ -503,10 +813,19 @@ float	Terrain::getHeight(uint32_t u, uint32_t v) const {
 	return TERRAIN_H(u, v);
 }
 
+/**
+ * @brief Get the height of the point closest to a world position
+ *
+ * @param u the world x position
+ * @param v the world z position
+ * @param height filled with the point height
+ * @return true if the position is on the terrain
+ */
 bool	Terrain::getNearHeight(float u, float v, float & height) const {
-	int32_t x = std::round(u);
-	int32_t z = std::round(v);
-	if (x >= 0 && x < BOX_MAX_SIZE.x && z >= 0 && z < BOX_MAX_SIZE.z) {
+	glm::vec2 vertSpace = getVertSpace();
+	int64_t x = std::round(u / vertSpace.x);
+	int64_t z = std::round(v / vertSpace.y);
+	if (x >= 0 && x < _resolution.x && z >= 0 && z < _resolution.y) {
 		height = TERRAIN_H(x, z);
 		return true;
 	}
@@ -516,6 +835,15 @@ bool	Terrain::getNearHeight(float u, float v, float & height) const {
 float	Terrain::getMinHeight() const { return _minH; }
 float	Terrain::getMaxHeight() const { return _maxH; }
 float	Terrain::getOrbitDistance() const { return _scene.getOrbitDistance(); }
+glm::uvec2	Terrain::getResolution() const { return _resolution; }
+glm::vec2	Terrain::getVertSpace() const {
+	return glm::vec2(BOX_MAX_SIZE.x, BOX_MAX_SIZE.z) / glm::vec2(_resolution - 1u);
+}
+bool	Terrain::isHeadless() const { return _headless; }
+std::string const &	Terrain::getMapPath() const { return _mapPath; }
+Water const &	Terrain::getWater() const { return *_water; }
+Water &	Terrain::getWater() { return *_water; }
+double	Terrain::getPhaseTime(TerrainPhase::Enum phase) const { return _phaseTime[phase]; }
 
 // -- exceptions ---------------------------------------------------------------
 /**
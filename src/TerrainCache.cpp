@@ -0,0 +1,275 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#ifdef _WIN32
+	#include <iterator>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include "TerrainCache.hpp"
+#include "Terrain.hpp"
+#include "Logging.hpp"
+
+static_assert(sizeof(TerrainCacheHeader) == 64, "TerrainCacheHeader must be 64 bytes");
+
+// -- Constructors -------------------------------------------------------------
+
+TerrainCache::TerrainCache()
+: _mapHash(0),
+  _paramsHash(0),
+  _mapped(nullptr),
+  _mappedSize(0),
+  _data(nullptr),
+  _size(0),
+  _lookupTime(0) {}
+
+TerrainCache::~TerrainCache() {
+	_unmap();
+}
+
+TerrainCache::TerrainCache(TerrainCache const &src)
+: _mapHash(0),
+  _paramsHash(0),
+  _mapped(nullptr),
+  _mappedSize(0),
+  _data(nullptr),
+  _size(0),
+  _lookupTime(0) {
+	*this = src;
+}
+
+TerrainCache &TerrainCache::operator=(TerrainCache const &rhs) {
+	if (this != &rhs) {
+		logWarn("operator= called");
+	}
+	return *this;
+}
+
+// -- Methods ------------------------------------------------------------------
+
+/**
+ * @brief FNV-1a on 8 bytes words, the tail bytes one by one
+ *
+ * @param data the bytes
+ * @param size the number of bytes, a multiple of 8 to continue the hash on
+ * the next ones
+ * @param seed the previous hash, to hash data in several parts
+ * @return the hash
+ */
+uint64_t	TerrainCache::hash(void const * data, size_t size, uint64_t seed) {
+	uint8_t const * bytes = static_cast<uint8_t const *>(data);
+	uint64_t h = seed;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, bytes + i, sizeof(word));
+		h = (h ^ word) * 0x100000001b3ULL;
+	}
+	for (; i < size; ++i)
+		h = (h ^ bytes[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+/**
+ * @brief Find the entry of a map, a hit is mapped until release()
+ *
+ * @param mapPath the map file, hashed to check the entry
+ * @param paramsHash the hash of everything else the vertices depend on
+ * @return true on a hit, false if the entry is missing, outdated or the map
+ * can't be read
+ */
+bool	TerrainCache::lookup(std::string const & mapPath, uint64_t paramsHash) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	release();
+
+	// one entry per map file and parameters, replaced when the map changes, the
+	// full path hash tells apart the maps of the same name in other directories
+	std::string mapName = mapPath.substr(mapPath.find_last_of("/\\") + 1);
+	if (mapName.find_last_of('.') != std::string::npos)
+		mapName.resize(mapName.find_last_of('.'));
+	std::string fullPath = file::canonical(mapPath);
+	std::ostringstream name;
+	name << CACHE_DIR << mapName << "_" << std::hex << std::setfill('0')
+		<< std::setw(16) << hash(fullPath.data(), fullPath.size()) << "_"
+		<< std::setw(16) << paramsHash << TERRAIN_CACHE_EXT;
+	_path = name.str();
+	_paramsHash = paramsHash;
+
+	bool hit = _hashFile(mapPath) && _map();
+	_lookupTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return hit;
+}
+
+/**
+ * @brief Write the entry of the last lookup(), through a temporary file so an
+ * interrupted save never leaves a truncated entry
+ *
+ * @param vertices the terrain vertices
+ * @param resolution the vertices per side
+ * @param minH the lowest vertex height
+ * @param maxH the highest vertex height
+ * @param normals true to save the normals too
+ * @param buildTime the time saved by a hit (s)
+ * @return false on write error
+ */
+bool	TerrainCache::save(std::vector<TerrainVert> const & vertices, glm::uvec2 resolution, float minH,
+	float maxH, bool normals, double buildTime)
+{
+	file::mkdir(CACHE_DIR, true);
+
+	TerrainCacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, TERRAIN_CACHE_MAGIC, sizeof(header.magic));
+	header.version = TERRAIN_CACHE_VERSION;
+	header.width = resolution.x;
+	header.height = resolution.y;
+	header.flags = normals ? TERRAIN_CACHE_NORMALS : 0;
+	header.mapHash = _mapHash;
+	header.paramsHash = _paramsHash;
+	header.minH = minH;
+	header.maxH = maxH;
+	header.buildTime = buildTime;
+
+	std::string tmpPath = _path + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+		// the planes row by row, out of the interleaved vertices
+		std::vector<float> heights(resolution.x);
+		std::vector<glm::vec3> rowNormals(resolution.x);
+		for (uint32_t z = 0; file && z < resolution.y; ++z) {
+			TerrainVert const * row = &vertices[static_cast<size_t>(z) * resolution.x];
+			for (uint32_t x = 0; x < resolution.x; ++x)
+				heights[x] = row[x].pos.y;
+			file.write(reinterpret_cast<char const *>(heights.data()), heights.size() * sizeof(float));
+		}
+		for (uint32_t z = 0; file && normals && z < resolution.y; ++z) {
+			TerrainVert const * row = &vertices[static_cast<size_t>(z) * resolution.x];
+			for (uint32_t x = 0; x < resolution.x; ++x)
+				rowNormals[x] = row[x].norm;
+			file.write(reinterpret_cast<char const *>(rowNormals.data()),
+				rowNormals.size() * sizeof(glm::vec3));
+		}
+		if (!file) {
+			logWarn("unable to write the terrain cache " << tmpPath);
+			file.close();
+			std::remove(tmpPath.c_str());
+			return false;
+		}
+	}
+	if (std::rename(tmpPath.c_str(), _path.c_str()) != 0) {
+		logWarn("unable to rename " << tmpPath << " to " << _path);
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Unmap the entry of a hit, once copied in the vertices
+ */
+void	TerrainCache::release() {
+	_unmap();
+	_buffer = std::vector<uint8_t>();
+}
+
+/**
+ * @brief Hash the whole map file, in blocks
+ */
+bool	TerrainCache::_hashFile(std::string const & path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+		return false;
+	std::vector<char> block(1 << 20);  // a multiple of the hashed words
+	_mapHash = 0xcbf29ce484222325ULL;
+	while (file) {
+		file.read(block.data(), block.size());
+		_mapHash = hash(block.data(), file.gcount(), _mapHash);
+	}
+	return !file.bad();
+}
+
+/**
+ * @brief Map the entry file and check it matches the map and the parameters
+ *
+ * @return false on a miss, the entry is unmapped
+ */
+bool	TerrainCache::_map() {
+	#ifdef _WIN32
+		std::ifstream file(_path, std::ios::binary);
+		if (!file.is_open())
+			return false;
+		_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		_data = _buffer.data();
+		_size = _buffer.size();
+	#else
+		int fd = open(_path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(TerrainCacheHeader))) {
+			close(fd);
+			return false;
+		}
+		void * mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapped == MAP_FAILED)
+			return false;
+		_mapped = mapped;
+		_mappedSize = st.st_size;
+		_data = static_cast<uint8_t const *>(mapped);
+		_size = _mappedSize;
+	#endif
+
+	if (_size < sizeof(TerrainCacheHeader)) {
+		release();
+		return false;
+	}
+	TerrainCacheHeader const & header = getHeader();
+	size_t nbVertices = static_cast<size_t>(header.width) * header.height;
+	if (std::memcmp(header.magic, TERRAIN_CACHE_MAGIC, sizeof(header.magic)) != 0
+	|| header.version != TERRAIN_CACHE_VERSION
+	|| header.mapHash != _mapHash || header.paramsHash != _paramsHash
+	|| header.width != header.height || header.width < TERRAIN_MIN_RES || header.width > TERRAIN_MAX_RES
+	|| _size != sizeof(TerrainCacheHeader) + nbVertices * sizeof(float)
+		+ (hasNormals() ? nbVertices * sizeof(glm::vec3) : 0)) {
+		release();
+		return false;
+	}
+	return true;
+}
+
+void	TerrainCache::_unmap() {
+	#ifndef _WIN32
+		if (_mapped)
+			munmap(_mapped, _mappedSize);
+	#endif
+	_mapped = nullptr;
+	_mappedSize = 0;
+	_data = nullptr;
+	_size = 0;
+}
+
+// -- getters ------------------------------------------------------------------
+
+bool	TerrainCache::isHit() const { return _data != nullptr; }
+bool	TerrainCache::hasNormals() const { return _data && (getHeader().flags & TERRAIN_CACHE_NORMALS); }
+TerrainCacheHeader const &	TerrainCache::getHeader() const {
+	return *reinterpret_cast<TerrainCacheHeader const *>(_data);
+}
+float const *	TerrainCache::getHeights() const {
+	return reinterpret_cast<float const *>(_data + sizeof(TerrainCacheHeader));
+}
+glm::vec3 const *	TerrainCache::getNormals() const {
+	return reinterpret_cast<glm::vec3 const *>(getHeights() + static_cast<size_t>(getHeader().width)
+		* getHeader().height);
+}
+double	TerrainCache::getLookupTime() const { return _lookupTime; }
@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "TerrainCloud.hpp"
+#include "mod1.hpp"
+#include "Logging.hpp"
+#include "ThreadPool.hpp"
+
+static_assert(sizeof(TerrainCloudHeader) == 24, "TerrainCloudHeader must be 24 bytes");
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "the binary points are read as glm::vec3");
+
+// longest number of a text point, in characters
+#define TERRAIN_CLOUD_MAX_NUMBER 63
+
+namespace {
+	/**
+	 * @brief Parse a float at the start of a text, with an optional sign
+	 *
+	 * std::from_chars for the floats is missing from the older standard
+	 * libraries, strtof then parses a bounded copy of the number.
+	 *
+	 * @param start the text
+	 * @param end the text end, not '\0' terminated
+	 * @param value filled with the number
+	 * @return the end of the number, nullptr if there is none
+	 */
+	char const *	parseFloat(char const * start, char const * end, float & value) {
+		#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+			// from_chars doesn't accept the '+' sign
+			if (start < end && *start == '+' && start + 1 < end && start[1] != '-' && start[1] != '+')
+				++start;
+			std::from_chars_result res = std::from_chars(start, end, value);
+			return res.ec == std::errc() ? res.ptr : nullptr;
+		#else
+			char number[TERRAIN_CLOUD_MAX_NUMBER + 1];
+			size_t size = std::min<size_t>(end - start, TERRAIN_CLOUD_MAX_NUMBER);
+			std::memcpy(number, start, size);
+			number[size] = '\0';
+			if (size == 0 || std::isspace(static_cast<unsigned char>(number[0])))
+				return nullptr;
+			char * numberEnd = nullptr;
+			errno = 0;
+			value = std::strtof(number, &numberEnd);
+			if (numberEnd == number || errno == ERANGE)
+				return nullptr;
+			return start + (numberEnd - number);
+		#endif
+	}
+}  // namespace
+
+// -- Constructors -------------------------------------------------------------
+
+TerrainCloud::TerrainCloud()
+: _nbDuplicates(0) {}
+
+TerrainCloud::~TerrainCloud() {}
+
+TerrainCloud::TerrainCloud(TerrainCloud const &src) {
+	*this = src;
+}
+
+TerrainCloud &TerrainCloud::operator=(TerrainCloud const &rhs) {
+	if (this != &rhs) {
+		logWarn("operator= called");
+	}
+	return *this;
+}
+
+// -- Methods ------------------------------------------------------------------
+
+/**
+ * @brief Check if a map file is a point cloud, from its extension
+ *
+ * @param path the map file
+ * @return true for the TerrainCloud formats
+ */
+bool	TerrainCloud::isCloud(std::string const & path) {
+	return hasSuffix(path, TERRAIN_CLOUD_EXT) || hasSuffix(path, TERRAIN_CLOUD_XYZ_EXT)
+		|| hasSuffix(path, TERRAIN_CLOUD_CSV_EXT);
+}
+
+/**
+ * @brief Add the points of a file to the control points, before their build()
+ *
+ * @param path the points file, TERRAIN_CLOUD_EXT for the binary format, else text
+ * @param points the control points
+ * @return false on error, the points are partially added
+ */
+bool	TerrainCloud::load(std::string const & path, TerrainPoints & points) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	_path = path;
+	_nbDuplicates = 0;
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		logErr("unable to open \"" << path << "\"");
+		return false;
+	}
+
+	_chunks.resize(ThreadPool::get().getNbThreads());
+	uint32_t nbPoints = points.size();
+	bool ret = hasSuffix(path, TERRAIN_CLOUD_EXT) ? _loadBinary(file, points) : _loadText(file, points);
+	// free the blocks memory
+	_buffer = std::vector<char>();
+	_chunks = std::vector<Chunk>();
+	if (!ret)
+		return false;
+
+	if (_nbDuplicates > 0)
+		logWarn(_nbDuplicates << " duplicate points in \"" << path << "\", skipped");
+	logInfo("\"" << path << "\": " << points.size() - nbPoints << " points loaded in "
+		<< std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << "s");
+	return true;
+}
+
+/**
+ * @brief Load a text file, block by block, a block ends on a line end
+ */
+bool	TerrainCloud::_loadText(std::ifstream & file, TerrainPoints & points) {
+	size_t blockSize = _chunks.size() * static_cast<size_t>(TERRAIN_CLOUD_CHUNK_SIZE);
+	size_t carry = 0;  // last line of the previous block, not ended
+	uint64_t line = 1;  // first line of the block
+	bool eof = false;
+	while (!eof) {
+		_buffer.resize(carry + blockSize + 1);
+		file.read(&_buffer[carry], blockSize);
+		size_t size = carry + file.gcount();
+		eof = !file;
+		if (file.bad()) {
+			logErr("unable to read \"" << _path << "\"");
+			return false;
+		}
+		// end the last line of the file
+		if (eof && size > 0 && _buffer[size - 1] != '\n')
+			_buffer[size++] = '\n';
+
+		size_t end = size;
+		while (end > 0 && _buffer[end - 1] != '\n')
+			--end;
+		if (end == 0 && !eof) {
+			logErr("\"" << _path << "\" line " << line << ": too long");
+			return false;
+		}
+
+		// split the block on the line ends, about a chunk per thread
+		uint32_t nbChunks = 0;
+		for (size_t chunkStart = 0; chunkStart < end; ++nbChunks) {
+			size_t chunkEnd = std::min(chunkStart + TERRAIN_CLOUD_CHUNK_SIZE, end);
+			while (_buffer[chunkEnd - 1] != '\n')
+				++chunkEnd;
+			if (nbChunks == _chunks.size())
+				_chunks.emplace_back();
+			_chunks[nbChunks].start = &_buffer[chunkStart];
+			_chunks[nbChunks].size = chunkEnd - chunkStart;
+			chunkStart = chunkEnd;
+		}
+		ThreadPool::get().run(nbChunks, [this, line](uint32_t chunkId) {
+			_parseText(_chunks[chunkId], line == 1 && chunkId == 0);
+		});
+		if (!_addChunks(nbChunks, line, points))
+			return false;
+		for (uint32_t c = 0; c < nbChunks; ++c)
+			line += _chunks[c].nbLines;
+
+		carry = size - end;
+		std::memmove(&_buffer[0], &_buffer[end], carry);
+	}
+	return true;
+}
+
+/**
+ * @brief Load a binary file, TERRAIN_CLOUD_CHUNK_SIZE of points per chunk
+ */
+bool	TerrainCloud::_loadBinary(std::ifstream & file, TerrainPoints & points) {
+	TerrainCloudHeader header;
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))
+	|| std::memcmp(header.magic, TERRAIN_CLOUD_MAGIC, sizeof(header.magic)) != 0
+	|| header.version != TERRAIN_CLOUD_VERSION) {
+		logErr("\"" << _path << "\" is not a points file or an older version, version "
+			<< TERRAIN_CLOUD_VERSION << " expected");
+		return false;
+	}
+
+	// the points size is checked before reserving their memory
+	file.seekg(0, std::ios::end);
+	uint64_t pointsSize = static_cast<uint64_t>(file.tellg()) - sizeof(header);
+	file.seekg(sizeof(header));
+	if (pointsSize % sizeof(glm::vec3) != 0) {
+		logErr("\"" << _path << "\": truncated point, " << pointsSize << " bytes of points");
+		return false;
+	}
+	if (header.nbPoints != pointsSize / sizeof(glm::vec3)) {
+		logErr("\"" << _path << "\": " << header.nbPoints << " points in the header, "
+			<< pointsSize / sizeof(glm::vec3) << " in the file");
+		return false;
+	}
+	points.reserve(points.size() + header.nbPoints);
+
+	uint64_t chunkPoints = TERRAIN_CLOUD_CHUNK_SIZE / sizeof(glm::vec3);
+	uint64_t first = 1;  // first point of the block
+	while (first <= header.nbPoints) {
+		uint64_t blockPoints = std::min(header.nbPoints - first + 1, chunkPoints * _chunks.size());
+		_buffer.resize(blockPoints * sizeof(glm::vec3));
+		if (!file.read(&_buffer[0], _buffer.size())) {
+			logErr("unable to read \"" << _path << "\"");
+			return false;
+		}
+
+		uint32_t nbChunks = (blockPoints + chunkPoints - 1) / chunkPoints;
+		for (uint32_t c = 0; c < nbChunks; ++c) {
+			_chunks[c].start = &_buffer[c * chunkPoints * sizeof(glm::vec3)];
+			_chunks[c].size = std::min(chunkPoints, blockPoints - c * chunkPoints) * sizeof(glm::vec3);
+		}
+		ThreadPool::get().run(nbChunks, [this](uint32_t chunkId) {
+			_parseBinary(_chunks[chunkId]);
+		});
+		if (!_addChunks(nbChunks, first, points))
+			return false;
+		first += blockPoints;
+	}
+	return true;
+}
+
+/**
+ * @brief Parse the lines of a text chunk
+ *
+ * @param chunk the chunk, its text ends with a line end
+ * @param firstLine true if the chunk starts the file, an invalid first line is
+ * a header
+ */
+void	TerrainCloud::_parseText(Chunk & chunk, bool firstLine) const {
+	auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+
+	chunk.points.clear();
+	chunk.nbLines = 0;
+	chunk.errorLine = 0;
+	char const * lineStart = chunk.start;
+	char const * end = chunk.start + chunk.size;
+	while (lineStart < end) {
+		char const * lineEnd = static_cast<char const *>(std::memchr(lineStart, '\n', end - lineStart));
+		char const * c = lineStart;
+		lineStart = lineEnd + 1;
+		++chunk.nbLines;
+
+		while (c < lineEnd && isSpace(*c))
+			++c;
+		if (c == lineEnd || *c == '#')
+			continue;
+
+		glm::vec3 point;
+		bool valid = true;
+		for (uint8_t axis = 0; valid && axis < 3; ++axis) {
+			if (axis > 0) {
+				while (c < lineEnd && isSpace(*c))
+					++c;
+				if (c < lineEnd && (*c == ',' || *c == ';'))
+					++c;
+				while (c < lineEnd && isSpace(*c))
+					++c;
+			}
+			char const * numberEnd = parseFloat(c, lineEnd, point[axis]);
+			valid = numberEnd != nullptr;
+			c = valid ? numberEnd : c;
+		}
+		// the next columns are ignored
+		valid = valid && (c == lineEnd || isSpace(*c) || *c == ',' || *c == ';');
+
+		if (!valid && firstLine && chunk.nbLines == 1)
+			continue;
+		if (!valid) {
+			chunk.error = "invalid point, expected \"x y z\"";
+			chunk.errorLine = chunk.nbLines;
+			return;
+		}
+		if (!_checkPoint(point, chunk.error)) {
+			chunk.errorLine = chunk.nbLines;
+			return;
+		}
+		chunk.points.push_back(point);
+	}
+}
+
+/**
+ * @brief Check the points of a binary chunk
+ *
+ * @param chunk the chunk, a whole number of points
+ */
+void	TerrainCloud::_parseBinary(Chunk & chunk) const {
+	chunk.points.resize(chunk.size / sizeof(glm::vec3));
+	std::memcpy(&chunk.points[0], chunk.start, chunk.size);
+	chunk.nbLines = chunk.points.size();
+	chunk.errorLine = 0;
+	for (uint64_t i = 0; i < chunk.points.size(); ++i) {
+		if (!_checkPoint(chunk.points[i], chunk.error)) {
+			chunk.errorLine = i + 1;
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Add the parsed points of a block, in the file order
+ *
+ * @param nbChunks the block chunks
+ * @param firstLine the block first line, or point for a binary file
+ * @param points the control points
+ * @return false if a chunk has an error
+ */
+bool	TerrainCloud::_addChunks(uint32_t nbChunks, uint64_t firstLine, TerrainPoints & points) {
+	for (uint32_t c = 0; c < nbChunks; ++c) {
+		Chunk const & chunk = _chunks[c];
+		if (chunk.errorLine != 0) {
+			logErr("\"" << _path << "\" " << (hasSuffix(_path, TERRAIN_CLOUD_EXT) ? "point " : "line ")
+				<< firstLine + chunk.errorLine - 1 << ": " << chunk.error);
+			return false;
+		}
+		if (points.size() + chunk.points.size() >= TERRAIN_POINTS_EMPTY) {
+			logErr("\"" << _path << "\": too many points, max number: " << TERRAIN_POINTS_EMPTY - 1);
+			return false;
+		}
+		for (glm::vec3 const & point : chunk.points) {
+			if (!points.add(point))
+				++_nbDuplicates;
+		}
+		firstLine += chunk.nbLines;
+	}
+	return true;
+}
+
+/**
+ * @brief Check a point is in the .mod1 maps bounds
+ *
+ * @param point the point
+ * @param error filled with the error message
+ * @return false if out of bounds, or not a number
+ */
+bool	TerrainCloud::_checkPoint(glm::vec3 const & point, std::string & error) {
+	if (!(point.x >= 1 && point.x <= BOX_MAX_SIZE.x - 1 && point.z >= 1 && point.z <= BOX_MAX_SIZE.z - 1)) {
+		error = "x and z must be in [1, " + std::to_string(static_cast<int>(BOX_MAX_SIZE.x) - 1) + "]";
+		return false;
+	}
+	if (!(point.y >= -BOX_GROUND_HEIGHT && point.y <= BOX_MAX_SIZE.y - BOX_GROUND_HEIGHT)) {
+		error = "y must be in [" + std::to_string(-BOX_GROUND_HEIGHT) + ", "
+			+ std::to_string(static_cast<int>(BOX_MAX_SIZE.y) - BOX_GROUND_HEIGHT) + "]";
+		return false;
+	}
+	return true;
+}
+
+// -- getters ------------------------------------------------------------------
+
+uint64_t	TerrainCloud::getNbDuplicates() const { return _nbDuplicates; }
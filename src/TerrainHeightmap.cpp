@@ -0,0 +1,296 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+	#include <iterator>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include "TerrainHeightmap.hpp"
+#include "mod1.hpp"
+#include "Logging.hpp"
+
+static_assert(sizeof(TerrainHeightmapHeader) == 32, "TerrainHeightmapHeader must be 32 bytes");
+
+namespace {
+	bool	isLittleEndian() {
+		uint16_t one = 1;
+		return *reinterpret_cast<uint8_t const *>(&one) == 1;
+	}
+
+	uint32_t	swap32(uint32_t value) {
+		return (value >> 24) | ((value >> 8) & 0xff00) | ((value << 8) & 0xff0000) | (value << 24);
+	}
+
+	// header values to the machine byte order
+	uint32_t	fromLittle(uint32_t value) {
+		return isLittleEndian() ? value : swap32(value);
+	}
+}  // namespace
+
+// -- Constructors -------------------------------------------------------------
+
+TerrainHeightmap::TerrainHeightmap()
+: _mapped(nullptr),
+  _mappedSize(0),
+  _data(nullptr),
+  _size(0),
+  _heights(nullptr),
+  _width(0),
+  _height(0) {}
+
+TerrainHeightmap::~TerrainHeightmap() {
+	_unmap();
+}
+
+TerrainHeightmap::TerrainHeightmap(TerrainHeightmap const &src)
+: _mapped(nullptr),
+  _mappedSize(0),
+  _data(nullptr),
+  _size(0),
+  _heights(nullptr),
+  _width(0),
+  _height(0) {
+	*this = src;
+}
+
+TerrainHeightmap &TerrainHeightmap::operator=(TerrainHeightmap const &rhs) {
+	if (this != &rhs) {
+		logWarn("operator= called");
+	}
+	return *this;
+}
+
+// -- Methods ------------------------------------------------------------------
+
+/**
+ * @brief Check if a map file is a heightmap, from its extension
+ *
+ * @param path the map file
+ * @return true for the TerrainHeightmap formats
+ */
+bool	TerrainHeightmap::isHeightmap(std::string const & path) {
+	return hasSuffix(path, TERRAIN_HEIGHTMAP_EXT) || hasSuffix(path, TERRAIN_HEIGHTMAP_PNG_EXT);
+}
+
+/**
+ * @brief Load a heightmap, a raw file stays mapped until the next load or the
+ * destruction
+ *
+ * @param path the heightmap, TERRAIN_HEIGHTMAP_EXT for the raw format, else png
+ * @return false if the file can't be read or is not a valid heightmap
+ */
+bool	TerrainHeightmap::load(std::string const & path) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	_decoded = std::vector<float>();
+	_heights = nullptr;
+	_width = 0;
+	_height = 0;
+	if (!_map(path))
+		return false;
+
+	std::string error;
+	bool ret = hasSuffix(path, TERRAIN_HEIGHTMAP_EXT) ? _loadRaw(error) : _loadPng(error);
+	// the decoded heights don't need the file anymore
+	if (!ret || _heights != reinterpret_cast<float const *>(_data + sizeof(TerrainHeightmapHeader)))
+		_unmap();
+	if (!ret) {
+		logErr("invalid heightmap \"" << path << "\", " << error);
+		_heights = nullptr;
+		_width = 0;
+		_height = 0;
+		return false;
+	}
+
+	logInfo("\"" << path << "\": " << _width << "x" << _height << " heightmap loaded in "
+		<< std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << "s");
+	return true;
+}
+
+/**
+ * @brief Bilinear height at a position of the grid, the integer positions
+ * are the exact heights
+ *
+ * @param u position along the rows, in [0, width - 1]
+ * @param v position along the columns, in [0, height - 1]
+ * @return the height
+ */
+float	TerrainHeightmap::sample(double u, double v) const {
+	uint32_t u0 = std::min(static_cast<uint32_t>(u), _width - 2);
+	uint32_t v0 = std::min(static_cast<uint32_t>(v), _height - 2);
+	float fu = static_cast<float>(u - u0);
+	float fv = static_cast<float>(v - v0);
+
+	float const * h = _heights + static_cast<size_t>(v0) * _width + u0;
+	float bottom = h[0] * (1 - fu) + h[1] * fu;
+	float top = h[_width] * (1 - fu) + h[_width + 1] * fu;
+	return bottom * (1 - fv) + top * fv;
+}
+
+/**
+ * @brief Map the whole file, or read it without mmap
+ */
+bool	TerrainHeightmap::_map(std::string const & path) {
+	_unmap();
+	_buffer.clear();
+
+	#ifdef _WIN32
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			logErr("unable to open the heightmap \"" << path << "\"");
+			return false;
+		}
+		_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		_data = _buffer.data();
+		_size = _buffer.size();
+	#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			logErr("unable to open the heightmap \"" << path << "\"");
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			logErr("invalid heightmap \"" << path << "\", empty file");
+			close(fd);
+			return false;
+		}
+		void * mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapped == MAP_FAILED) {
+			logErr("unable to map the heightmap \"" << path << "\"");
+			return false;
+		}
+		_mapped = mapped;
+		_mappedSize = st.st_size;
+		_data = static_cast<uint8_t const *>(mapped);
+		_size = _mappedSize;
+	#endif
+	return true;
+}
+
+void	TerrainHeightmap::_unmap() {
+	#ifndef _WIN32
+		if (_mapped)
+			munmap(_mapped, _mappedSize);
+	#endif
+	_mapped = nullptr;
+	_mappedSize = 0;
+	_buffer = std::vector<uint8_t>();
+	_data = nullptr;
+	_size = 0;
+}
+
+/**
+ * @brief Check a raw heightmap, its heights are used in place on a little
+ * endian machine
+ *
+ * @param error filled with the error message
+ */
+bool	TerrainHeightmap::_loadRaw(std::string & error) {
+	TerrainHeightmapHeader header;
+	if (_size < sizeof(header)) {
+		error = "not a heightmap file";
+		return false;
+	}
+	std::memcpy(&header, _data, sizeof(header));
+	if (std::memcmp(header.magic, TERRAIN_HEIGHTMAP_MAGIC, sizeof(header.magic)) != 0) {
+		error = "not a heightmap file";
+		return false;
+	}
+	if (fromLittle(header.version) != TERRAIN_HEIGHTMAP_VERSION) {
+		error = "version " + std::to_string(fromLittle(header.version)) + ", expected "
+			+ std::to_string(TERRAIN_HEIGHTMAP_VERSION);
+		return false;
+	}
+	_width = fromLittle(header.width);
+	_height = fromLittle(header.height);
+	if (_width < TERRAIN_HEIGHTMAP_MIN_SIZE || _width > TERRAIN_HEIGHTMAP_MAX_SIZE
+	|| _height < TERRAIN_HEIGHTMAP_MIN_SIZE || _height > TERRAIN_HEIGHTMAP_MAX_SIZE) {
+		error = "size " + std::to_string(_width) + "x" + std::to_string(_height) + " not in ["
+			+ std::to_string(TERRAIN_HEIGHTMAP_MIN_SIZE) + ", " + std::to_string(TERRAIN_HEIGHTMAP_MAX_SIZE) + "]";
+		return false;
+	}
+	size_t nbHeights = static_cast<size_t>(_width) * _height;
+	if (_size != sizeof(header) + nbHeights * sizeof(float)) {
+		error = "truncated file";
+		return false;
+	}
+
+	_heights = reinterpret_cast<float const *>(_data + sizeof(header));
+	if (!isLittleEndian()) {
+		_decoded.resize(nbHeights);
+		for (size_t i = 0; i < nbHeights; ++i) {
+			uint32_t bits;
+			std::memcpy(&bits, &_heights[i], sizeof(bits));
+			bits = swap32(bits);
+			std::memcpy(&_decoded[i], &bits, sizeof(bits));
+		}
+		_heights = _decoded.data();
+	}
+
+	// a single pass on the heights, in the .mod1 maps bounds
+	float const minH = -BOX_GROUND_HEIGHT;
+	float const maxH = BOX_MAX_SIZE.y - BOX_GROUND_HEIGHT;
+	for (size_t i = 0; i < nbHeights; ++i) {
+		if (!(_heights[i] >= minH && _heights[i] <= maxH)) {
+			error = "height " + std::to_string(i % _width) + ", " + std::to_string(i / _width)
+				+ " not in [" + std::to_string(static_cast<int>(minH)) + ", "
+				+ std::to_string(static_cast<int>(maxH)) + "]";
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Decode a png heightmap, its gray levels scaled to the .mod1 maps
+ * heights
+ *
+ * The 8 bits images are decoded to 16 bits, the black is the lowest height
+ * and the white the highest one.
+ *
+ * @param error filled with the error message
+ */
+bool	TerrainHeightmap::_loadPng(std::string & error) {
+	int width, height, nbChannels;
+	stbi_us * pixels = stbi_load_16_from_memory(_data, static_cast<int>(std::min<size_t>(_size, INT32_MAX)),
+		&width, &height, &nbChannels, 1);
+	if (!pixels) {
+		error = stbi_failure_reason();
+		return false;
+	}
+	if (nbChannels != 1 && nbChannels != 2)
+		logWarn("color heightmap, converted to gray levels");
+	if (width < TERRAIN_HEIGHTMAP_MIN_SIZE || width > TERRAIN_HEIGHTMAP_MAX_SIZE
+	|| height < TERRAIN_HEIGHTMAP_MIN_SIZE || height > TERRAIN_HEIGHTMAP_MAX_SIZE) {
+		error = "size " + std::to_string(width) + "x" + std::to_string(height) + " not in ["
+			+ std::to_string(TERRAIN_HEIGHTMAP_MIN_SIZE) + ", " + std::to_string(TERRAIN_HEIGHTMAP_MAX_SIZE) + "]";
+		stbi_image_free(pixels);
+		return false;
+	}
+	_width = width;
+	_height = height;
+
+	size_t nbHeights = static_cast<size_t>(_width) * _height;
+	float const minH = -BOX_GROUND_HEIGHT;
+	float const scale = BOX_MAX_SIZE.y / 65535.0f;
+	_decoded.resize(nbHeights);
+	for (size_t i = 0; i < nbHeights; ++i)
+		_decoded[i] = minH + pixels[i] * scale;
+	stbi_image_free(pixels);
+	_heights = _decoded.data();
+	return true;
+}
+
+// -- getters ------------------------------------------------------------------
+
+uint32_t	TerrainHeightmap::getWidth() const { return _width; }
+uint32_t	TerrainHeightmap::getHeight() const { return _height; }
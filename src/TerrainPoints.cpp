@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "TerrainPoints.hpp"
+
+// -- Constructors -------------------------------------------------------------
+
+TerrainPoints::TerrainPoints()
+: _origin(0),
+  _bucketSize(1),
+  _nbBuckets(0),
+  _truncated(true) {}
+
+TerrainPoints::~TerrainPoints() {}
+
+TerrainPoints::TerrainPoints(TerrainPoints const &src) {
+	*this = src;
+}
+
+TerrainPoints &TerrainPoints::operator=(TerrainPoints const &rhs) {
+	if (this != &rhs) {
+		_points = rhs._points;
+		_order = rhs._order;
+		_exact = rhs._exact;
+		_bucketStart = rhs._bucketStart;
+		_origin = rhs._origin;
+		_bucketSize = rhs._bucketSize;
+		_nbBuckets = rhs._nbBuckets;
+		_truncated = rhs._truncated;
+	}
+	return *this;
+}
+
+// -- Methods ------------------------------------------------------------------
+
+/**
+ * @brief Choose the distances of the closest points search
+ *
+ * @param truncated true to truncate the distances to integers, at least 1, as
+ * the .mod1 maps integer coordinates. Else the exact distances are kept, at
+ * least TERRAIN_POINTS_MIN_DIST, for the dense point clouds
+ */
+void	TerrainPoints::setTruncated(bool truncated) {
+	_truncated = truncated;
+}
+
+/**
+ * @brief Reserve the memory of the points to add
+ *
+ * @param nbPoints the total number of points
+ */
+void	TerrainPoints::reserve(size_t nbPoints) {
+	_points.reserve(nbPoints);
+	if (nbPoints * 2 > _exact.size())
+		_rehash(nbPoints * 2);
+}
+
+/**
+ * @brief Add a control point, before build()
+ *
+ * @param point the point, the y axis is the height
+ * @return false if a point was already added at this position, the first one
+ * is kept
+ */
+bool	TerrainPoints::add(glm::vec3 point) {
+	// at most half full
+	if ((_points.size() + 1) * 2 > _exact.size())
+		_rehash((_points.size() + 1) * 2);
+
+	uint32_t slot = _findSlot(_positionKey(glm::vec2(point.x, point.z)));
+	if (_exact[slot] != TERRAIN_POINTS_EMPTY)
+		return false;
+	_exact[slot] = _points.size();
+	_points.push_back(point);
+	return true;
+}
+
+/**
+ * @brief Sort the points in the buckets, TERRAIN_POINTS_PER_BUCKET per bucket
+ * on average
+ */
+void	TerrainPoints::build() {
+	_bucketStart.clear();
+	_order.clear();
+	_nbBuckets = glm::ivec2(0);
+	if (_points.empty())
+		return;
+
+	glm::vec2 minPos(_points[0].x, _points[0].z);
+	glm::vec2 maxPos = minPos;
+	for (glm::vec3 const & p : _points) {
+		minPos = glm::vec2(std::min(minPos.x, p.x), std::min(minPos.y, p.z));
+		maxPos = glm::vec2(std::max(maxPos.x, p.x), std::max(maxPos.y, p.z));
+	}
+	glm::vec2 extent = maxPos - minPos;
+
+	// square buckets, the same count on both sides of a square map
+	float nbBuckets = std::max(1.0f, static_cast<float>(_points.size()) / TERRAIN_POINTS_PER_BUCKET);
+	_bucketSize = std::sqrt(std::max(extent.x, 1.0f) * std::max(extent.y, 1.0f) / nbBuckets);
+	_origin = minPos;
+	_nbBuckets = glm::ivec2(glm::floor(extent / _bucketSize)) + 1;
+
+	// counting sort of the points by bucket, stable to keep the map order
+	std::vector<uint32_t> pointBucket(_points.size());
+	_bucketStart.assign(static_cast<size_t>(_nbBuckets.x) * _nbBuckets.y + 1, 0);
+	for (size_t i = 0; i < _points.size(); ++i) {
+		glm::ivec2 b = _bucket(glm::vec2(_points[i].x, _points[i].z));
+		pointBucket[i] = b.y * _nbBuckets.x + b.x;
+		++_bucketStart[pointBucket[i] + 1];
+	}
+	for (size_t b = 1; b < _bucketStart.size(); ++b)
+		_bucketStart[b] += _bucketStart[b - 1];
+
+	// the add() order is kept for the distance ties
+	std::vector<glm::vec3> sorted(_points.size());
+	std::vector<uint32_t> next(_bucketStart.begin(), _bucketStart.end() - 1);
+	_order.resize(_points.size());
+	for (size_t i = 0; i < _points.size(); ++i) {
+		_order[next[pointBucket[i]]] = i;
+		sorted[next[pointBucket[i]]++] = _points[i];
+	}
+	_points.swap(sorted);
+	_rehash(_exact.size());  // the indices moved
+}
+
+/**
+ * @brief Get the height of a control point position
+ *
+ * @param pos the position
+ * @param height set to the point height
+ * @return false if no point is exactly at pos
+ */
+bool	TerrainPoints::getExactHeight(glm::vec2 pos, float & height) const {
+	if (_exact.empty())
+		return false;
+	uint32_t index = _exact[_findSlot(_positionKey(pos))];
+	if (index == TERRAIN_POINTS_EMPTY)
+		return false;
+	height = _points[index].y;
+	return true;
+}
+
+/**
+ * @brief Find the n closest points of a position, needs build()
+ *
+ * On a distance tie the point added first wins, so the result doesn't
+ * depend on the buckets nor the visit order.
+ *
+ * @param pos the position
+ * @param n the number of points to find
+ * @param closest n points buffer, filled from the closest one
+ * @return uint32_t the number of points found, less than n if the map has less
+ */
+uint32_t	TerrainPoints::getNClosest(glm::vec2 pos, uint32_t n, HeightPoint * closest) const {
+	uint32_t nbClosest = 0;
+	if (_bucketStart.empty() || n == 0)
+		return 0;
+
+	glm::ivec2 center = _bucket(pos);
+	int32_t maxRing = std::max(std::max(center.x, _nbBuckets.x - 1 - center.x),
+		std::max(center.y, _nbBuckets.y - 1 - center.y));
+	for (int32_t ring = 0; ring <= maxRing; ++ring) {
+		// the ring points are at least ring - 1 buckets away, stop when they
+		// can't be closer than the farthest found
+		if (nbClosest == n && (ring - 1) * _bucketSize >= _distanceLimit(closest[n - 1]))
+			break;
+
+		int32_t yMin = std::max(center.y - ring, 0);
+		int32_t yMax = std::min(center.y + ring, _nbBuckets.y - 1);
+		for (int32_t y = yMin; y <= yMax; ++y) {
+			// whole rows on the ring top and bottom, else only its sides
+			bool fullRow = (y == center.y - ring || y == center.y + ring);
+			int32_t step = fullRow || ring == 0 ? 1 : ring * 2;
+			for (int32_t x = center.x - ring; x <= center.x + ring; x += step) {
+				if (x < 0 || x >= _nbBuckets.x)
+					continue;
+				// skip the buckets too far to hold a closer point
+				glm::vec2 bMin = _origin + glm::vec2(x, y) * _bucketSize;
+				glm::vec2 gap(std::max(std::max(bMin.x - pos.x, pos.x - bMin.x - _bucketSize), 0.0f),
+					std::max(std::max(bMin.y - pos.y, pos.y - bMin.y - _bucketSize), 0.0f));
+				float maxDist2 = nbClosest == n ? _distanceLimit(closest[n - 1]) : INFINITY;
+				maxDist2 *= maxDist2;
+				if (gap.x * gap.x + gap.y * gap.y >= maxDist2)
+					continue;
+
+				uint32_t b = y * _nbBuckets.x + x;
+				for (uint32_t i = _bucketStart[b]; i < _bucketStart[b + 1]; ++i) {
+					glm::vec3 const & p = _points[i];
+					glm::vec2 diff(p.x - pos.x, p.z - pos.y);
+					float dist2 = diff.x * diff.x + diff.y * diff.y;
+					if (dist2 >= maxDist2)
+						continue;
+					HeightPoint point;
+					if (_truncated)  // at least 1, the points between the integer coordinates could be closer
+						point.distance = std::max(1.0f, std::trunc(std::sqrt(dist2)));
+					else
+						point.distance = std::max(TERRAIN_POINTS_MIN_DIST, std::sqrt(dist2));
+					point.height = p.y;
+					point.index = _order[i];
+					if (_insertClosest(point, n, closest, nbClosest) && nbClosest == n) {
+						maxDist2 = _distanceLimit(closest[n - 1]);
+						maxDist2 *= maxDist2;
+					}
+				}
+			}
+		}
+	}
+	return nbClosest;
+}
+
+/**
+ * @brief Insert a point in the closest points sorted buffer, if closer than the
+ * farthest one
+ *
+ * @return false if the point is not inserted
+ */
+bool	TerrainPoints::_insertClosest(HeightPoint point, uint32_t n, HeightPoint * closest,
+	uint32_t & nbClosest) const
+{
+	auto closer = [](HeightPoint const & lhs, HeightPoint const & rhs) {
+		return lhs.distance < rhs.distance || (lhs.distance == rhs.distance && lhs.index < rhs.index);
+	};
+
+	uint32_t i = nbClosest;
+	if (nbClosest < n)
+		++nbClosest;
+	else if (closer(point, closest[n - 1]))
+		--i;
+	else
+		return false;
+	for (; i > 0 && closer(point, closest[i - 1]); --i)
+		closest[i] = closest[i - 1];
+	closest[i] = point;
+	return true;
+}
+
+/**
+ * @brief Hash table key of a position, its coordinates bits
+ */
+uint64_t	TerrainPoints::_positionKey(glm::vec2 pos) {
+	pos += 0.0f;  // -0 to 0
+	uint32_t x;
+	uint32_t y;
+	std::memcpy(&x, &pos.x, sizeof(x));
+	std::memcpy(&y, &pos.y, sizeof(y));
+	return static_cast<uint64_t>(x) << 32 | y;
+}
+
+/**
+ * @brief Distance from which a point can't be closer than the farthest found
+ *
+ * @param farthest the farthest of the closest points
+ * @return float the distance limit
+ */
+float	TerrainPoints::_distanceLimit(HeightPoint const & farthest) const {
+	// the truncated distances gain up to 1, the exact ones tie with the first added
+	return _truncated ? farthest.distance + 1.0f : std::nextafter(farthest.distance, INFINITY);
+}
+
+/**
+ * @brief Find the hash table slot of a position: the slot of its point, else
+ * the empty slot ending its probe sequence
+ *
+ * @param key the position key
+ * @return uint32_t the slot
+ */
+uint32_t	TerrainPoints::_findSlot(uint64_t key) const {
+	uint32_t mask = _exact.size() - 1;
+	// multiplicative hash, the high bits mix all the coordinates bits
+	uint32_t slot = (key * 0x9e3779b97f4a7c15ull) >> 32 & mask;
+	while (_exact[slot] != TERRAIN_POINTS_EMPTY) {
+		glm::vec3 const & p = _points[_exact[slot]];
+		if (_positionKey(glm::vec2(p.x, p.z)) == key)
+			break;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+/**
+ * @brief Resize the hash table and insert the points indices again
+ *
+ * @param nbSlots the minimum number of slots, rounded up to a power of 2
+ */
+void	TerrainPoints::_rehash(size_t nbSlots) {
+	size_t size = 16;
+	while (size < nbSlots)
+		size *= 2;
+	_exact.assign(size, TERRAIN_POINTS_EMPTY);
+	for (uint32_t i = 0; i < _points.size(); ++i)
+		_exact[_findSlot(_positionKey(glm::vec2(_points[i].x, _points[i].z)))] = i;
+}
+
+/**
+ * @brief Bucket of a position, the positions out of the points bounds are in
+ * the border buckets
+ */
+glm::ivec2	TerrainPoints::_bucket(glm::vec2 pos) const {
+	glm::ivec2 b(glm::floor((pos - _origin) / _bucketSize));
+	return glm::ivec2(std::min(std::max(b.x, 0), _nbBuckets.x - 1),
+		std::min(std::max(b.y, 0), _nbBuckets.y - 1));
+}
+
+// -- getters ------------------------------------------------------------------
+
+uint32_t	TerrainPoints::size() const { return _points.size(); }
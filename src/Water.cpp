@@ -1,18 +1,16 @@
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstdlib>
 
 #include "Water.hpp"
 #include "MouseRaycast.hpp"
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
+#include "Rng.hpp"
+#include "WaterKernels.hpp"
 
 // -- const --------------------------------------------------------------------
-// space between grid points
-glm::vec2 const	Water::_gridSpace = glm::vec2(
-	BOX_MAX_SIZE.x / WATER_GRID_RES.x, BOX_MAX_SIZE.z / WATER_GRID_RES.y);
-// water grid pipe length
-glm::vec2 const	Water::_pipeLen = _gridSpace / 1.5f;
-
-// grid box area
-float const	Water::_gridArea = Water::_gridSpace.x * Water::_gridSpace.y;
 // shader
 std::unique_ptr<Shader> Water::_sh = nullptr;
 // flowScenario names
@@ -23,35 +21,150 @@ const std::string	Water::flowScenarioName[] = {
 	"drain",
 	"sandbox"
 };
+// simulation phases names
+const std::string	Water::phaseName[] = {
+	"scenario",
+	"tiles",
+	"flow",
+	"limit",
+	"depth",
+	"sweep",
+	"activity",
+	"mesh",
+	"border"
+};
+// grid borders names, as in the boundary setting
+const std::string	Water::boundaryName[] = {
+	"wall",
+	"open",
+	"periodic"
+};
 
 // -- members ------------------------------------------------------------------
 Water::Water(Terrain & terrain, Gui & gui)
 : _gui(gui),
   _terrain(terrain),
-  _firstInit(true),
   _scenario(FlowScenario::EVEN_RISE),
+  _requestedScenario(FlowScenario::EVEN_RISE),
+  _quitSim(false),
+  _snapshotWriting(false),
+  _recorder(nullptr),
+  _player(nullptr),
+  _replaying(false),
   _vao(0),
   _vbo(0),
   _ebo(0),
   _vaoB(0),
   _vboB(0),
-  _eboB(0) {
+  _eboB(0),
+  _currentRiseH(0) {
 	// init static shader if null
-	if (!_sh) {
+	_headless = _terrain.isHeadless();
+	_meshVertices = !_headless;
+	if (!_headless && !_sh) {
 		_sh = std::unique_ptr<Shader>(
 			new Shader("shaders/water_vs.glsl", "shaders/water_fs.glsl"));
 	}
 
 	_gravity = 9.81;
-	// allocate _waterCols 2d array
-	_waterCols = std::vector< std::vector<WaterColum> >(
-		WATER_GRID_RES.y, std::vector<WaterColum>(WATER_GRID_RES.x, WaterColum()));
-	_lastRainUpdate = getMs();
+	// one column between each terrain points
+	glm::uvec2 gridRes = _terrain.getResolution() - 1u;
+	_gridSpace = glm::vec2(BOX_MAX_SIZE.x, BOX_MAX_SIZE.z) / glm::vec2(gridRes);
+	_pipeLen = _gridSpace / 1.5f;
+	_gridArea = _gridSpace.x * _gridSpace.y;
+	// pipes cross-sectional area factor and acceleration
+	_flowParams.csaX = _gridSpace.x;
+	_flowParams.csaY = _gridSpace.y;
+	_flowParams.accX = _gravity / _pipeLen.x;
+	_flowParams.accY = _gravity / _pipeLen.y;
+	// critical flow through the open borders, per unit of depth^1.5
+	_flowParams.openX = _flowParams.csaX * std::sqrt(_gravity);
+	_flowParams.openY = _flowParams.csaY * std::sqrt(_gravity);
+	// negative depth prevention, single pass limiter or iterative correction
+	_flowParams.limited = s.j("simulation").b("outflowLimiter");
+	// the iterative correction updates whole rows, a sparse grid needs the limiter
+	_sparse = s.j("simulation").b("sparse");
+	// grid borders, the iterative correction has wall borders only
+	_boundary = WaterBoundary::WALL;
+	std::string boundary = s.j("simulation").s("boundary");
+	while (_boundary < WaterBoundary::COUNT && boundaryName[_boundary] != boundary)
+		_boundary = static_cast<WaterBoundary::Enum>(_boundary + 1);
+	if (_boundary == WaterBoundary::COUNT) {
+		logWarn("unknown water boundary " << boundary << ", the borders are walls");
+		_boundary = WaterBoundary::WALL;
+	}
+	if (_boundary != WaterBoundary::WALL && !_flowParams.limited) {
+		logWarn("the " << boundaryName[_boundary] << " water borders need the outflow limiter, it is enabled");
+		_flowParams.limited = true;
+	}
+	// pick the update kernels according to the cpu and the borders
+	_kernels = &WaterKernels::best(_boundary);
+	if (_sparse && !_flowParams.limited) {
+		logWarn("the sparse water grid needs the outflow limiter, it is enabled");
+		_flowParams.limited = true;
+	}
+	// the temporal blocking sweeps the single pass limiter
+	_blockSteps = s.j("simulation").u("blockSteps");
+	if (_blockSteps > 1 && _boundary == WaterBoundary::PERIODIC) {
+		logWarn("the periodic water borders do not support the temporal blocking, it is disabled");
+		_blockSteps = 1;
+	}
+	if (_blockSteps > 1 && !_flowParams.limited) {
+		logWarn("the water temporal blocking needs the outflow limiter, it is enabled");
+		_flowParams.limited = true;
+	}
+	// simulation clock substeps
+	_courant = s.j("simulation").d("courant");
+	_maxSubsteps = s.j("simulation").u("maxSubsteps");
+	_rainDensity = s.j("simulation").d("rainDensity");
+	_nbSubsteps = 0;
+	_phaseTime.fill(0.0);
+	_simTime = 0;
+	// run the simulation on its own thread or inline, headless runs are inline
+	_threaded = !_headless && s.j("simulation").b("thread");
+	_background = false;
+	_pendingZMin = 0;
+	_pendingZMax = 0;
+	_pendingBorder = false;
+	// one snapshot file per map and resolution
+	std::string mapName = _terrain.getMapPath();
+	mapName = mapName.substr(mapName.find_last_of("/\\") + 1);
+	if (mapName.find_last_of('.') != std::string::npos)
+		mapName.resize(mapName.find_last_of('.'));
+	_snapshotPath = std::string(SNAPSHOTS_DIR) + mapName + "_" + std::to_string(gridRes.x)
+		+ WATER_SNAPSHOT_EXT;
+	// allocate water columns planes
+	_grid.resize(gridRes.x, gridRes.y, _sparse);
+	if (_sparse && !_grid.isSparse())
+		logWarn("sparse water grid not supported on this system, all the columns are allocated");
+	_sparse = _grid.isSparse();
+	// split the grid in tiles, all of them awake until the first update
+	_tilesW = (_grid.getWidth() + WATER_TILE_SIZE - 1) / WATER_TILE_SIZE;
+	_tilesH = (_grid.getHeight() + WATER_TILE_SIZE - 1) / WATER_TILE_SIZE;
+	_tileAwake.assign(_tilesW * _tilesH, 1);
+	_tileFlow.assign(_tilesW * _tilesH, 0);
+	_tileDepth.assign(_tilesW * _tilesH, 0);
+	_nbActiveTiles = 0;
+	_tileMesh.assign(_tilesW * _tilesH, 0);
+	_tileMaxDepth.assign(_tilesW * _tilesH, 0.0f);
+	_nbCellUpdates = 0;
 	_maxTerrainCenterDist = std::max(std::max(BOX_MAX_SIZE.x, BOX_MAX_SIZE.y),
 		BOX_MAX_SIZE.z) / 2;
 }
 
 Water::~Water() {
+	// stop the simulation before freeing its mesh
+	_quitSim = true;
+	if (_simThread.joinable())
+		_simThread.join();
+	if (_snapshotThread.joinable())
+		_snapshotThread.join();
+	// write the record index and print its report
+	delete _recorder;
+	delete _player;
+	if (_headless)
+		return;
+
 	// free vao / vbo
 	_sh->use();
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -79,47 +192,516 @@ Water &Water::operator=(Water const &rhs) {
 	return *this;
 }
 
+/**
+ * @brief Init the water columns and mesh, then start the simulation thread
+ *
+ * @return false on mesh init error
+ */
 bool	Water::init() {
-	// init water columns according to the scenario
-	for (uint32_t v = 0; v < WATER_GRID_RES.y; ++v) {
-		for (uint32_t u = 0; u < WATER_GRID_RES.x; ++u) {
-			_waterCols[v][u].lFlow = 0;
-			_waterCols[v][u].tFlow = 0;
-			_waterCols[v][u].depth = 0;
-
-			// retrieve terrain height
-			_waterCols[v][u].terrainH = _terrain.getHeight(u, v);
-			_waterCols[v][u].terrainH += _terrain.getHeight(u+1, v);
-			_waterCols[v][u].terrainH += _terrain.getHeight(u, v+1);
-			_waterCols[v][u].terrainH += _terrain.getHeight(u+1, v+1);
-			_waterCols[v][u].terrainH /= 4;
+	// lowest terrain of each tile, the even rise skips the tiles above its water
+	_tileMinTerrainH.assign(_tilesW * _tilesH, 0.0f);
+	for (uint32_t t = 0; t < _tileMinTerrainH.size(); ++t) {
+		uint32_t uStart = (t % _tilesW) * WATER_TILE_SIZE;
+		uint32_t vStart = (t / _tilesW) * WATER_TILE_SIZE;
+		uint32_t uEnd = std::min(uStart + WATER_TILE_SIZE, _grid.getWidth());
+		uint32_t vEnd = std::min(vStart + WATER_TILE_SIZE, _grid.getHeight());
+		float minH = _columnTerrainH(uStart, vStart);
+		for (uint32_t v = vStart; v < vEnd; ++v) {
+			for (uint32_t u = uStart; u < uEnd; ++u)
+				minH = std::min(minH, _columnTerrainH(u, v));
+		}
+		_tileMinTerrainH[t] = minH;
+	}
 
+	_resetColumns();
+	std::fill(_tileMesh.begin(), _tileMesh.end(), 0);
+	if (_meshVertices) {
+		_initVertices();
+		_initBorderVertices();
+	}
+	if (!_headless && (!_initMesh() || !_initMeshBorder()))
+		return false;
+
+	if (_threaded)
+		_simThread = std::thread(&Water::_simulationLoop, this);
+	return true;
+}
+
+/**
+ * @brief Init the water columns according to the scenario
+ */
+void	Water::_resetColumns() {
+	// a sparse grid gives back all its tiles, they are filled once written
+	_grid.clear();
+	if (!_sparse)
+		_grid.fillPlane(WaterPlane::OUT_SCALE, 1.0f);
+	std::fill(_tileFlow.begin(), _tileFlow.end(), 0);
+	if (_scenario == FlowScenario::EVEN_RISE)
+		_currentRiseH = _terrain.getMinHeight();
+	for (uint32_t v = 0; v < _grid.getHeight(); ++v) {
+		for (uint32_t u = 0; u < _grid.getWidth(); ++u) {
+			// a sparse grid gets its terrain with its tiles
+			if (!_sparse)
+				_grid.terrainH(u, v) = _columnTerrainH(u, v);
+
+			float startDepth = 0;
 			// init wave water columns
 			if (_scenario == FlowScenario::WAVE) {
-				// init left waters column at 0 to test
-				if (u == WATER_GRID_RES.x - 1)
-					_waterCols[v][u].depth = 26.0;
-				else if (u == WATER_GRID_RES.x - 2)
-					_waterCols[v][u].depth = 25.0;
-			}
-			else if (_scenario == FlowScenario::EVEN_RISE) {
-				_currentRiseH = _terrain.getMinHeight();
+				// init the last two world units of the right side, whatever the resolution
+				float borderDist = (_grid.getWidth() - 1 - u) * _gridSpace.x;
+				if (borderDist < 1.0f)
+					startDepth = 26.0;
+				else if (borderDist < 2.0f)
+					startDepth = 25.0;
 			}
 			else if (_scenario == FlowScenario::DRAIN) {
-				float startWaterH = _terrain.getMaxHeight() + 2 - _waterCols[v][u].terrainH;
-				_waterCols[v][u].depth = startWaterH;
+				startDepth = _terrain.getMaxHeight() + 2 - _terrainH(u, v);
+			}
+			if (startDepth > 0) {
+				_makeResident(u, v);
+				_grid.depth(u, v) = startDepth;
 			}
 		}
 	}
+	for (uint32_t t = 0; t < _tileMaxDepth.size(); ++t)
+		_tileMaxDepth[t] = _calcTileMaxDepth(t);
+	// wake up all the tiles, the flows were cleared so no tile is processed yet.
+	// The dry tiles flows stay 0, a sparse grid keeps them asleep.
+	for (uint32_t t = 0; t < _tileAwake.size(); ++t)
+		_tileAwake[t] = !_sparse || _tileMaxDepth[t] > 0;
+	_updateTileSets(0);
+	std::fill(_tileMesh.begin(), _tileMesh.end(), 1);
+	_nbCellUpdates = 0;
+	_simTime = 0;
+}
+
+/**
+ * @brief Replace the water columns and the active tiles by a snapshot
+ *
+ * @param snapshot the snapshot, checked by restoreSnapshot
+ */
+void	Water::_restoreColumns(WaterSnapshot const & snapshot) {
+	WaterSnapshotHeader const & header = snapshot.getHeader();
+	snapshot.restore(_grid);
+	_scenario = static_cast<FlowScenario::Enum>(header.scenario);
+	_currentRiseH = header.currentRiseH;
+	_simTime = header.simTime;
+
+	// the next step continues with the same tiles, wake them all up if the
+	// tiles layout changed
+	if (header.tileSize == WATER_TILE_SIZE && header.nbTiles == _tileAwake.size()) {
+		std::copy(snapshot.getTileAwake(), snapshot.getTileAwake() + header.nbTiles, _tileAwake.begin());
+		std::copy(snapshot.getTileFlow(), snapshot.getTileFlow() + header.nbTiles, _tileFlow.begin());
+	}
+	else {
+		std::fill(_tileAwake.begin(), _tileAwake.end(), 1);
+		std::fill(_tileFlow.begin(), _tileFlow.end(), 0);
+	}
+	std::fill(_tileMesh.begin(), _tileMesh.end(), 1);
+	for (uint32_t t = 0; t < _tileMaxDepth.size(); ++t)
+		_tileMaxDepth[t] = _calcTileMaxDepth(t);
+
+	// the snapshot only filled its resident tiles, set their terrain again in
+	// case it comes from a dense grid. The dry ones are given back.
+	if (_sparse) {
+		for (uint32_t t = 0; t < _tileAwake.size(); ++t) {
+			if (_grid.isResident(t % _tilesW, t / _tilesW))
+				_fillTile(t, false);
+		}
+		_releaseTiles();
+	}
+}
+
+/**
+ * @brief Get the terrain height of a column, the mean of its 4 corners
+ */
+float	Water::_columnTerrainH(uint32_t u, uint32_t v) const {
+	float terrainH = _terrain.getHeight(u, v);
+	terrainH += _terrain.getHeight(u+1, v);
+	terrainH += _terrain.getHeight(u, v+1);
+	terrainH += _terrain.getHeight(u+1, v+1);
+	return terrainH / 4;
+}
+
+/**
+ * @brief Get the terrain height of a column from the grid, computed if its
+ * sparse tile is not resident
+ */
+float	Water::_terrainH(uint32_t u, uint32_t v) const {
+	if (_grid.isResident(u / WATER_TILE_SIZE, v / WATER_TILE_SIZE))
+		return _grid.terrainH(u, v);
+	return _columnTerrainH(u, v);
+}
+
+/**
+ * @brief Fill the sparse tile of a column before writing it, the tiles only
+ * depend on themselves so the rows can be filled in parallel
+ *
+ * @param u the column id
+ * @param v the row id
+ */
+void	Water::_makeResident(uint32_t u, uint32_t v) {
+	if (!_grid.isResident(u / WATER_TILE_SIZE, v / WATER_TILE_SIZE))
+		_fillTile((v / WATER_TILE_SIZE) * _tilesW + u / WATER_TILE_SIZE, true);
+}
+
+/**
+ * @brief Allocate a sparse tile if needed and set the terrain of its
+ * columns, a new tile depth and flows are 0
+ *
+ * @param t the tile id
+ * @param outScale also reset the outflow scale factors to 1
+ */
+void	Water::_fillTile(uint32_t t, bool outScale) {
+	uint32_t uStart = (t % _tilesW) * WATER_TILE_SIZE;
+	uint32_t uEnd = std::min(uStart + WATER_TILE_SIZE, _grid.getWidth());
+	uint32_t vStart = (t / _tilesW) * WATER_TILE_SIZE;
+	uint32_t vEnd = std::min(vStart + WATER_TILE_SIZE, _grid.getHeight());
+	_grid.allocTile(t % _tilesW, t / _tilesW);
+	for (uint32_t v = vStart; v < vEnd; ++v) {
+		float * terrainH = _grid.row(WaterPlane::TERRAIN_H, uStart, v);
+		float * outScaleRun = _grid.row(WaterPlane::OUT_SCALE, uStart, v);
+		for (uint32_t u = uStart; u < uEnd; ++u) {
+			terrainH[u - uStart] = _columnTerrainH(u, v);
+			if (outScale)
+				outScaleRun[u - uStart] = 1.0f;
+		}
+	}
+}
+
+/**
+ * @brief Check if a tile or the tiles around it are processed by the step,
+ * hold water or are awake
+ *
+ * @param t the tile id
+ * @return true if the tile must stay resident
+ */
+bool	Water::_isTileNeeded(uint32_t t) const {
+	uint32_t tu = t % _tilesW;
+	uint32_t tv = t / _tilesW;
+	uint32_t tuEnd = std::min(tu + 2, _tilesW);
+	uint32_t tvEnd = std::min(tv + 2, _tilesH);
+	for (uint32_t v = tv != 0 ? tv - 1 : 0; v < tvEnd; ++v) {
+		for (uint32_t u = tu != 0 ? tu - 1 : 0; u < tuEnd; ++u) {
+			uint32_t n = v * _tilesW + u;
+			if (_tileDepth[n] || _tileAwake[n] || _tileMaxDepth[n] > 0)
+				return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Fill the sparse tiles read or written by the step, the kernels only
+ * reach the tiles next to the processed ones
+ */
+void	Water::_fillTiles() {
+	for (uint32_t t = 0; t < _tileDepth.size(); ++t) {
+		if (!_tileDepth[t])
+			continue;
+		uint32_t tu = t % _tilesW;
+		uint32_t tv = t / _tilesW;
+		uint32_t tuEnd = std::min(tu + 2, _tilesW);
+		uint32_t tvEnd = std::min(tv + 2, _tilesH);
+		for (uint32_t v = tv != 0 ? tv - 1 : 0; v < tvEnd; ++v) {
+			for (uint32_t u = tu != 0 ? tu - 1 : 0; u < tuEnd; ++u) {
+				if (!_grid.isResident(u, v))
+					_fillTile(v * _tilesW + u, true);
+			}
+		}
+	}
+}
+
+/**
+ * @brief Give back the sparse tiles far from the water and the processed
+ * tiles, their depth and flows are already 0
+ */
+void	Water::_releaseTiles() {
+	if (!_sparse)
+		return;
+	for (uint32_t t = 0; t < _tileDepth.size(); ++t) {
+		if (_grid.isResident(t % _tilesW, t / _tilesW) && !_isTileNeeded(t))
+			_grid.freeTile(t % _tilesW, t / _tilesW);
+	}
+}
+
+/**
+ * @brief Save the water state in the snapshot file
+ *
+ * The simulation only copies the columns, the file is written by a background
+ * thread. A save is skipped while the previous one is being written.
+ */
+void	Water::saveSnapshot() {
+	file::mkdir(SNAPSHOTS_DIR, true);
+
+	WaterCommand cmd;
+	cmd.type = WaterCmd::SNAPSHOT;
+	_pushCommand(cmd);
+
+	if (!_threaded)
+		_processCommands();
+}
+
+void	Water::_saveSnapshot() {
+	// never wait for the writer on the simulation thread
+	if (_snapshotWriting) {
+		logWarn("a water snapshot is still being written, save skipped");
+		return;
+	}
+	WaterSnapshot * snapshot = new WaterSnapshot();
+	snapshot->capture(_grid, _tileAwake, _tileFlow, _scenario, _currentRiseH, _simTime);
+
+	if (_snapshotThread.joinable())
+		_snapshotThread.join();  // already done
+	std::string path = _snapshotPath;
+	_snapshotWriting = true;
+	_snapshotThread = std::thread([this, snapshot, path]() {
+		if (snapshot->save(path))
+			logInfo("water snapshot saved in " << path);
+		delete snapshot;
+		_snapshotWriting = false;
+	});
+}
+
+/**
+ * @brief Replace the water state by a snapshot file
+ *
+ * The file is mapped and checked here, the simulation then only copies its
+ * planes. The snapshot must come from the same map at the same resolution.
+ *
+ * @param path the snapshot file
+ * @return false if the file is invalid or does not match this terrain
+ */
+bool	Water::restoreSnapshot(std::string const & path) {
+	WaterSnapshot * snapshot = new WaterSnapshot();
+	if (!snapshot->load(path)) {
+		delete snapshot;
+		return false;
+	}
+
+	WaterSnapshotHeader const & header = snapshot->getHeader();
+	std::string error;
+	if (header.width != _grid.getWidth() || header.height != _grid.getHeight()) {
+		error = "resolution " + std::to_string(header.width) + "x" + std::to_string(header.height)
+			+ ", expected " + std::to_string(_grid.getWidth()) + "x" + std::to_string(_grid.getHeight());
+	}
+	else if (header.scenario >= FlowScenario::COUNT) {
+		error = "unknown scenario " + std::to_string(header.scenario);
+	}
+	else {
+		// the terrain planes differ if the snapshot comes from another map
+		// the non resident tiles of a sparse grid are saved without terrain
+		float const * terrainH = snapshot->getPlane(WaterPlane::TERRAIN_H);
+		float const * depth = snapshot->getPlane(WaterPlane::DEPTH);
+		for (uint32_t v = 0; v < _grid.getHeight() && error.empty(); ++v) {
+			for (uint32_t u = 0; u < _grid.getWidth(); ++u) {
+				size_t i = static_cast<size_t>(v) * _grid.getWidth() + u;
+				if (terrainH[i] == 0 && depth[i] == 0)
+					continue;
+				if (std::fabs(terrainH[i] - _columnTerrainH(u, v)) > 1e-3f) {
+					error = "the terrain differs from " + _terrain.getMapPath();
+					break;
+				}
+			}
+		}
+	}
+	if (!error.empty()) {
+		logErr("unable to restore " << path << ", " << error);
+		delete snapshot;
+		return false;
+	}
+
+	FlowScenario::Enum scenario = static_cast<FlowScenario::Enum>(header.scenario);
+	WaterCommand cmd;
+	cmd.type = WaterCmd::RESTORE;
+	cmd.snapshot = snapshot;
+	if (!_pushCommand(cmd)) {
+		delete snapshot;
+		return false;
+	}
+	_requestedScenario = scenario;
+	_replaying = false;
+
+	if (!_threaded)
+		_processCommands();
+	return true;
+}
+
+/**
+ * @brief Write the water state in a snapshot file now, for the headless runs
+ * (the simulation must not be running in its thread)
+ *
+ * @param path the snapshot file
+ * @return false if the file can't be written
+ */
+bool	Water::writeSnapshot(std::string const & path) const {
+	WaterSnapshot snapshot;
+	snapshot.capture(_grid, _tileAwake, _tileFlow, _scenario, _currentRiseH, _simTime);
+	return snapshot.save(path);
+}
+
+/**
+ * @brief Compare the columns depth with a snapshot of the same map, usually
+ * the same run with the fp32 storage
+ *
+ * @param path the reference snapshot file
+ * @param diff filled with the depth error and the volume drift
+ * @return false if the file is invalid or its resolution differs
+ */
+bool	Water::compareSnapshot(std::string const & path, WaterDiff & diff) const {
+	WaterSnapshot snapshot;
+	if (!snapshot.load(path))
+		return false;
+	WaterSnapshotHeader const & header = snapshot.getHeader();
+	if (header.width != _grid.getWidth() || header.height != _grid.getHeight()) {
+		logErr("unable to compare with " << path << ", resolution " << header.width << "x"
+			<< header.height << ", expected " << _grid.getWidth() << "x" << _grid.getHeight());
+		return false;
+	}
+
+	float const * ref = snapshot.getPlane(WaterPlane::DEPTH);
+	double sumSq = 0;
+	double refVolume = 0;
+	diff.depthMax = 0;
+	for (uint32_t v = 0; v < _grid.getHeight(); ++v) {
+		for (uint32_t u = 0; u < _grid.getWidth(); ++u) {
+			float refDepth = *ref++;
+			float error = std::fabs(_grid.depth(u, v) - refDepth);
+			sumSq += static_cast<double>(error) * error;
+			diff.depthMax = std::max(diff.depthMax, error);
+			refVolume += refDepth;
+		}
+	}
+	diff.depthRms = std::sqrt(sumSq / (static_cast<double>(_grid.getWidth()) * _grid.getHeight()));
+	diff.volume = refVolume * _gridArea;
+	diff.volumeDrift = diff.volume > 0 ? (getVolume() - diff.volume) / diff.volume : 0;
+	return true;
+}
+
+/**
+ * @brief Send a command to the simulation
+ *
+ * @param cmd the command
+ * @return false if the queue is full, the command is dropped
+ */
+bool	Water::_pushCommand(WaterCommand const & cmd) {
+	if (!_commands.push(cmd)) {
+		logWarn("water commands queue full, command dropped");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Simulation thread main loop, run the commands until the Water
+ * destruction
+ */
+void	Water::_simulationLoop() {
+	while (!_quitSim) {
+		if (!_processCommands())
+			std::this_thread::sleep_for(std::chrono::milliseconds(WATER_IDLE_SLEEP_MS));
+	}
+}
 
-	// init/update mesh
-	if (_firstInit) {
-		_firstInit = false;
-		if (!_initMesh() || !_initMeshBorder())
-			return false;
+/**
+ * @brief Run the waiting commands then publish the new mesh
+ *
+ * The ADVANCE durations are summed, so a simulation slower than the renderer
+ * take longer steps, still bounded by the substeps clock.
+ *
+ * @return false if there was no command
+ */
+bool	Water::_processCommands() {
+	WaterCommand	cmd;
+	bool	hasCmd = false;
+	float	simTime = 0;
+
+	while (_commands.pop(cmd)) {
+		hasCmd = true;
+		if (cmd.type == WaterCmd::ADVANCE) {
+			simTime += cmd.dtTime;
+		}
+		else if (cmd.type == WaterCmd::ADD_WATER) {
+			_addWater(cmd.u, cmd.v);
+		}
+		else if (cmd.type == WaterCmd::SET_SCENARIO) {
+			_scenario = static_cast<FlowScenario::Enum>(cmd.scenarioId);
+			_resetColumns();
+			simTime = 0;
+			// a new scenario ends the replay
+			delete _player;
+			_player = nullptr;
+		}
+		else if (cmd.type == WaterCmd::SNAPSHOT) {
+			// save the state after the previous commands
+			_advance(simTime);
+			simTime = 0;
+			_saveSnapshot();
+		}
+		else if (cmd.type == WaterCmd::RESTORE) {
+			_restoreColumns(*cmd.snapshot);
+			delete cmd.snapshot;
+			simTime = 0;
+			delete _player;
+			_player = nullptr;
+		}
+		else if (cmd.type == WaterCmd::RECORD) {
+			// record the steps of the previous commands in the old record
+			if (_player)
+				_replay(simTime);
+			else
+				_advance(simTime);
+			if (_recorder && simTime > 0)
+				_recorder->record(_grid, _simTime);
+			simTime = 0;
+			delete _recorder;
+			_recorder = cmd.recorder;
+		}
+		else if (cmd.type == WaterCmd::REPLAY) {
+			delete _player;
+			_player = cmd.player;
+			simTime = 0;
+			if (_player)
+				_replay(0);
+		}
+		else if (_player && cmd.type == WaterCmd::REPLAY_SEEK) {
+			_player->seek(_player->getTime() + cmd.dtTime);
+			_replay(0);
+		}
+		else if (_player && cmd.type == WaterCmd::REPLAY_STEP) {
+			_player->step(cmd.u);
+			_replay(0);
+		}
+		else if (_player && cmd.type == WaterCmd::REPLAY_SPEED) {
+			_player->setSpeed(_player->getSpeed() * cmd.dtTime);
+			logInfo("replay speed x" << _player->getSpeed());
+		}
 	}
-	else if (!_updateMesh() || !_updateMeshBorder()) {
+	if (!hasCmd)
 		return false;
+
+	if (_player)
+		_replay(simTime);
+	else
+		_advance(simTime);
+	if (_recorder && simTime > 0)
+		_recorder->record(_grid, _simTime);
+	// the tiles stay marked until the water is displayed again
+	if (!_meshVertices || _background)
+		return true;
+
+	// update the mesh of the tiles touched by the steps
+	std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+	uint32_t zMin, zMax;
+	_updateVertices(zMin, zMax);
+	_endPhase(WaterPhase::MESH, phaseStart);
+	if (zMin < zMax) {
+		bool borderChanged = _updateBorderVertices();
+		_endPhase(WaterPhase::BORDER, phaseStart);
+		if (!_headless) {
+			_publishMesh(zMin, zMax, borderChanged);
+			_endPhase(WaterPhase::MESH, phaseStart);
+		}
 	}
 	return true;
 }
@@ -131,10 +713,23 @@ void	Water::_scenarioUpdate(float dtTime) {
 		float maxRiseH = (_terrain.getMaxHeight() - _terrain.getMinHeight()) * 2.0;
 
 		if (_currentRiseH < maxRiseH) {
-			for (uint32_t v = 0; v < WATER_GRID_RES.y; ++v) {
-				for (uint32_t u = 0; u < WATER_GRID_RES.x; ++u) {
-					if (_waterCols[v][u].terrainH <= maxPorousH) {
-						_waterCols[v][u].depth += riseSpeed * dtTime;
+			// only the tiles with a column under the porous height
+			for (uint32_t t = 0; t < _tileMinTerrainH.size(); ++t) {
+				if (_tileMinTerrainH[t] > maxPorousH)
+					continue;
+				uint32_t uStart = (t % _tilesW) * WATER_TILE_SIZE;
+				uint32_t vStart = (t / _tilesW) * WATER_TILE_SIZE;
+				uint32_t uEnd = std::min(uStart + WATER_TILE_SIZE, _grid.getWidth());
+				uint32_t vEnd = std::min(vStart + WATER_TILE_SIZE, _grid.getHeight());
+				_makeResident(uStart, vStart);
+				for (uint32_t v = vStart; v < vEnd; ++v) {
+					WaterValue * depth = _grid.cells(WaterPlane::DEPTH, uStart, v);
+					float const * terrainH = _grid.row(WaterPlane::TERRAIN_H, uStart, v);
+					for (uint32_t u = uStart; u < uEnd; ++u) {
+						if (terrainH[u - uStart] <= maxPorousH) {
+							depth[u - uStart] += riseSpeed * dtTime;
+							_wakeCell(u, v);
+						}
 					}
 				}
 			}
@@ -145,252 +740,768 @@ void	Water::_scenarioUpdate(float dtTime) {
 	else if (_scenario == FlowScenario::RAINING) {
 		float rainAmount = 1.0;
 
-		// rain drop
-		if (getMs().count() - _lastRainUpdate.count() > 100) {
-			_lastRainUpdate = getMs();
-
-			for (uint32_t v = 0; v < WATER_GRID_RES.y; ++v) {
-				for (uint32_t u = 0; u < WATER_GRID_RES.x; ++u) {
-					if (rand() % 100 < 30) {
-						_waterCols[v][u].depth += rainAmount * dtTime;
-					}
-				}
-			}
-		}
+		// a shower every WATER_RAIN_PERIOD of simulated time
+		uint64_t shower = (_simTime + dtTime) / WATER_RAIN_PERIOD;
+		if (shower > static_cast<uint64_t>(_simTime / WATER_RAIN_PERIOD))
+			_rain(shower, rainAmount * dtTime);
 	}
 	else if (_scenario == FlowScenario::DRAIN) {
 		float drainSpeed = 1.5;
 		float porousH = 5.0f;
 
-		for (uint32_t v = 0; v < WATER_GRID_RES.y; ++v) {
-			for (uint32_t u = 0; u < WATER_GRID_RES.x; ++u) {
-				if (_waterCols[v][u].terrainH <= porousH && _waterCols[v][u].depth > 0) {
-					_waterCols[v][u].depth -= drainSpeed * dtTime;
-					_waterCols[v][u].depth = std::max(0.0f, _waterCols[v][u].depth);
+		// only the tiles with water and a column under the porous height
+		for (uint32_t t = 0; t < _tileMaxDepth.size(); ++t) {
+			if (_tileMaxDepth[t] <= 0 || _tileMinTerrainH[t] > porousH)
+				continue;
+			uint32_t uStart = (t % _tilesW) * WATER_TILE_SIZE;
+			uint32_t vStart = (t / _tilesW) * WATER_TILE_SIZE;
+			uint32_t uEnd = std::min(uStart + WATER_TILE_SIZE, _grid.getWidth());
+			uint32_t vEnd = std::min(vStart + WATER_TILE_SIZE, _grid.getHeight());
+			for (uint32_t v = vStart; v < vEnd; ++v) {
+				WaterValue * depth = _grid.cells(WaterPlane::DEPTH, uStart, v);
+				float const * terrainH = _grid.row(WaterPlane::TERRAIN_H, uStart, v);
+				for (uint32_t u = uStart; u < uEnd; ++u) {
+					WaterValue & d = depth[u - uStart];
+					if (terrainH[u - uStart] <= porousH && d > 0) {
+						d -= drainSpeed * dtTime;
+						d = std::max<float>(0.0f, d);
+						_wakeCell(u, v);
+					}
 				}
 			}
 		}
 	}
-	else if (_scenario == FlowScenario::SANDBOX) {
-		if (Inputs::getLeftClick() && Inputs::getKey(InputType::MODIFIER_1)) {
-			// init ray
-			glm::vec3 rayWord = MouseRaycast::calcMouseRay(_gui);
-			float orbitDist = _terrain.getOrbitDistance();
-			float len = orbitDist + _maxTerrainCenterDist + 2;
-
-			glm::vec3 intersection;
-			// add water on raycast hit
-			if (MouseRaycast::updateTerrainPos(_terrain, _gui.cam->pos, rayWord, len, intersection)) {
-				glm::vec2 waterGrid(intersection.x, intersection.z);
-				waterGrid.x = std::round(intersection.x / _gridSpace.x);
-				waterGrid.y = std::round(intersection.z / _gridSpace.y);
-				if (waterGrid.x >= 0 && waterGrid.x < WATER_GRID_RES.x &&
-					waterGrid.y >= 0 && waterGrid.y < WATER_GRID_RES.y)
-				{
-					_waterCols[waterGrid.y][waterGrid.x].depth += 5;
-				}
+}
+
+/**
+ * @brief Raycast the sandbox clicks and send the hit column to the simulation
+ */
+void	Water::_sandboxClick() {
+	if (Inputs::getLeftClick() && Inputs::getKey(InputType::MODIFIER_1)) {
+		// init ray
+		glm::vec3 rayWord = MouseRaycast::calcMouseRay(_gui);
+		float orbitDist = _terrain.getOrbitDistance();
+		float len = orbitDist + _maxTerrainCenterDist + 2;
+
+		glm::vec3 intersection;
+		// add water on raycast hit
+		if (MouseRaycast::updateTerrainPos(_terrain, _gui.cam->pos, rayWord, len, intersection)) {
+			WaterCommand cmd;
+			cmd.type = WaterCmd::ADD_WATER;
+			cmd.u = std::round(intersection.x / _gridSpace.x);
+			cmd.v = std::round(intersection.z / _gridSpace.y);
+			_pushCommand(cmd);
+		}
+	}
+}
+
+/**
+ * @brief Add water on the columns in WATER_SANDBOX_RADIUS, at least the
+ * (cu, cv) one
+ *
+ * @param cu the clicked column
+ * @param cv the clicked row
+ */
+void	Water::_addWater(int64_t cu, int64_t cv) {
+	int64_t ru = WATER_SANDBOX_RADIUS / _gridSpace.x;
+	int64_t rv = WATER_SANDBOX_RADIUS / _gridSpace.y;
+	for (int64_t v = std::max<int64_t>(0, cv - rv);
+		v <= std::min<int64_t>(_grid.getHeight() - 1, cv + rv); ++v)
+	{
+		for (int64_t u = std::max<int64_t>(0, cu - ru);
+			u <= std::min<int64_t>(_grid.getWidth() - 1, cu + ru); ++u)
+		{
+			glm::vec2 dist((u - cu) * _gridSpace.x, (v - cv) * _gridSpace.y);
+			if (glm::length(dist) <= WATER_SANDBOX_RADIUS) {
+				_makeResident(u, v);
+				_grid.depth(u, v) += 5;
+				_wakeCell(u, v);
 			}
 		}
 	}
 }
 
+/**
+ * @brief Advance the simulation by a frame, called by the render thread
+ *
+ * The simulation run on its own thread and only receive the frame duration
+ * and the sandbox clicks, the mesh is uploaded by draw() once computed.
+ *
+ * @param dtTime frame delta time
+ * @return true
+ */
 bool	Water::update(float dtTime) {
-	// update water columns according to the scenario
-	_scenarioUpdate(dtTime);
+	// the raycast need the camera, do it here and only send the hit column
+	if (!_headless && _requestedScenario == FlowScenario::SANDBOX)
+		_sandboxClick();
+
+	WaterCommand cmd;
+	cmd.type = WaterCmd::ADVANCE;
+	cmd.dtTime = dtTime;
+	_pushCommand(cmd);
 
-	// update all water columns
-	for (uint32_t v = 0; v < WATER_GRID_RES.y; ++v) {
-		for (uint32_t u = 0; u < WATER_GRID_RES.x; ++u) {
-			_updateFlow(u, v, dtTime);
+	if (!_threaded)
+		_processCommands();
+	return true;
+}
+
+/**
+ * @brief Advance the simulation by dtTime
+ *
+ * The time is integrated in equal substeps no longer than the stable step,
+ * which shrinks as the water gets deeper. A frame needing more than
+ * _maxSubsteps substeps is only partially simulated, the simulation slows
+ * down instead of taking an unstable step. With the temporal blocking, up to
+ * _blockSteps substeps are run by a single step, on the same tiles and with
+ * the stable step computed before them.
+ *
+ * @param dtTime simulated duration
+ */
+void	Water::_advance(float dtTime) {
+	float stableStep = _stableStep();
+	float simTime = std::min(dtTime, stableStep * _maxSubsteps);
+	if (simTime <= 0)
+		return;
+
+	// update water columns according to the scenario, wake up the modified tiles
+	std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+	_scenarioUpdate(simTime);
+	_endPhase(WaterPhase::SCENARIO, phaseStart);
+
+	uint32_t nbSubsteps = 0;
+	while (simTime > 0 && nbSubsteps < _maxSubsteps) {
+		// split the remaining time in equal substeps
+		uint32_t nbSteps = std::ceil(simTime / stableStep);
+		float stepTime = nbSteps > 1 ? simTime / nbSteps : simTime;
+		// the first substep runs alone, it puts back to sleep the calm tiles
+		// woken by the scenario before they are blocked for several substeps
+		uint32_t blockSteps = nbSubsteps == 0 ? 1
+			: std::min(std::min(_blockSteps, nbSteps), _maxSubsteps - nbSubsteps);
+		_step(stepTime, blockSteps);
+		for (uint32_t i = 0; i < blockSteps; ++i) {
+			_simTime += stepTime;
+			simTime = nbSteps - i > 1 ? simTime - stepTime : 0;
+			++nbSubsteps;
 		}
+		// the water moved, update the bound
+		stableStep = _stableStep();
 	}
+	_nbSubsteps = nbSubsteps;
+	Stats::addValue("Water::update substeps", nbSubsteps);
+	_releaseTiles();
+}
 
-	// scale flow to prevent negative water depth
-	_correctNegWaterDepth(dtTime);
+/**
+ * @brief Advance the replay by dtTime and copy its frame in the depth plane,
+ * only the tiles with a changed column are meshed again
+ *
+ * @param dtTime elapsed time, scaled by the replay speed
+ */
+void	Water::_replay(float dtTime) {
+	std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+	bool changed = _player->update(dtTime);
+	_simTime = _player->getTime();
+	if (_player->hasFailed()) {
+		// the error is logged once, the water stays at the last decoded frame
+		logErr("replay stopped");
+		delete _player;
+		_player = nullptr;
+		_replaying = false;
+		return;
+	}
+	if (!changed)
+		return;
+
+	uint16_t const * frame = _player->getFrame();
+	float scale = 1.0f / _player->getHeader().scale;
+	ThreadPool::get().run(_tilesH, [this, frame, scale](uint32_t tv) {
+		uint32_t vStart = tv * WATER_TILE_SIZE;
+		uint32_t vEnd = std::min(vStart + WATER_TILE_SIZE, _grid.getHeight());
+		for (uint32_t v = vStart; v < vEnd; ++v) {
+			uint16_t const * src = frame + static_cast<size_t>(v) * _grid.getWidth();
+			for (uint32_t tu = 0; tu < _tilesW; ++tu) {
+				uint32_t uStart = tu * WATER_TILE_SIZE;
+				uint32_t uEnd = std::min(uStart + WATER_TILE_SIZE, _grid.getWidth());
+				bool tileChanged = false;
+				for (uint32_t u = uStart; u < uEnd; ++u) {
+					float d = src[u] * scale;
+					if (d != _grid.depth(u, v)) {
+						_makeResident(u, v);
+						_grid.depth(u, v) = d;
+						tileChanged = true;
+					}
+				}
+				if (tileChanged)
+					_tileMesh[tv * _tilesW + tu] = 1;
+			}
+		}
+		// the max depth of the changed tiles, once all their rows are copied
+		for (uint32_t tu = 0; tu < _tilesW; ++tu) {
+			if (_tileMesh[tv * _tilesW + tu])
+				_tileMaxDepth[tv * _tilesW + tu] = _calcTileMaxDepth(tv * _tilesW + tu);
+		}
+	}, _background);
+	_releaseTiles();
+	_endPhase(WaterPhase::DEPTH, phaseStart);
+}
 
-	// update all water columns
-	for (uint32_t v = 0; v < WATER_GRID_RES.y; ++v) {
-		for (uint32_t u = 0; u < WATER_GRID_RES.x; ++u) {
-			_updateDepth(u, v, dtTime);
+/**
+ * @brief Add the drops of a rain shower
+ *
+ * Each row draws its drops from its own Rng stream, keyed by the shower and
+ * the row, so the drops only depend on the seed and the shower, not on the
+ * threads. A dense rain tests every column with the vectorized kernel, a
+ * sparse one jumps from drop to drop with geometric gaps.
+ *
+ * @param shower the shower id
+ * @param amount water depth of a drop
+ */
+void	Water::_rain(uint64_t shower, float amount) {
+	if (_rainDensity <= 0)
+		return;
+	uint32_t threshold = std::min(_rainDensity, 1.0f) * (1u << 24) + 0.5f;
+	bool sparse = _rainDensity < WATER_RAIN_SPARSE_DENSITY;
+	float logNoDrop = std::log1p(-_rainDensity);
+
+	ThreadPool::get().run(_tilesH, [&](uint32_t tv) {
+		uint32_t vStart = tv * WATER_TILE_SIZE;
+		uint32_t vEnd = std::min(vStart + WATER_TILE_SIZE, _grid.getHeight());
+		uint32_t width = _grid.getWidth();
+		std::vector<uint8_t> rained(_tilesW, 0);
+
+		for (uint32_t v = vStart; v < vEnd; ++v) {
+			uint32_t key = Rng::key(shower, v);
+			if (sparse) {
+				// the gap before the next drop follows a geometric distribution
+				uint32_t counter = 0;
+				uint64_t u = std::log(Rng::unit(Rng::at(key, counter++))) / logNoDrop;
+				for (; u < width; u += 1 + static_cast<uint64_t>(
+					std::log(Rng::unit(Rng::at(key, counter++))) / logNoDrop))
+				{
+					_makeResident(u, v);
+					_grid.depth(u, v) += amount;
+					rained[u / WATER_TILE_SIZE] = 1;
+				}
+				continue;
+			}
+			// the kernel writes all the columns
+			for (uint32_t tu = 0; tu < _tilesW; ++tu) {
+				uint32_t uStart = tu * WATER_TILE_SIZE;
+				uint32_t uEnd = std::min(uStart + WATER_TILE_SIZE, width);
+				_makeResident(uStart, v);
+				if (_kernels->rainRow(_grid.cells(WaterPlane::DEPTH, uStart, v), uStart, uEnd, key,
+					threshold, amount))
+					rained[tu] = 1;
+			}
 		}
-	}
 
-	// update the mesh accordingly
-	if (!_updateMesh())
-		return false;
-	if (!_updateMeshBorder())
-		return false;
+		// a column gets at most one drop, its tile max depth grows by amount at most
+		for (uint32_t tu = 0; tu < _tilesW; ++tu) {
+			if (!rained[tu])
+				continue;
+			uint32_t t = tv * _tilesW + tu;
+			_tileAwake[t] = 1;
+			_tileMaxDepth[t] += amount;
+		}
+	}, _background);
+}
 
-	return true;
+/**
+ * @brief Get the longest stable substep for the current water depth
+ *
+ * Gravity waves in the pipe model are stable as long as
+ * dt < 1 / sqrt(g * maxDepth * (csaX / pipeLenX + csaY / pipeLenY) / gridArea),
+ * the step is this bound scaled by _courant, at most WATER_MAX_STEP_DT.
+ *
+ * @return float the substep duration
+ */
+float	Water::_stableStep() const {
+	float maxDepth = *std::max_element(_tileMaxDepth.begin(), _tileMaxDepth.end());
+	float waveFactor = maxDepth * (_flowParams.csaX * _flowParams.accX
+		+ _flowParams.csaY * _flowParams.accY) / _gridArea;
+	if (waveFactor <= 0)
+		return WATER_MAX_STEP_DT;
+	return std::min(WATER_MAX_STEP_DT, _courant / std::sqrt(waveFactor));
 }
 
-void	Water::_updateFlow(uint32_t u, uint32_t v, float dtTime) {
-	/*
-		pipeCSA is the cross-sectional area of the pipe
-		Artificially varying pipeCSA leads to an approximate method for modeling viscosity
-		(larger values make the water more lively).
-	*/
-	float pipeCSA = _gridArea;
+/**
+ * @brief Run nbSteps simulation substeps on the active tiles
+ *
+ * A single substep runs each phase on all the rows before the next one,
+ * several substeps are swept together by _sweep.
+ *
+ * @param dtTime substep duration
+ * @param nbSteps number of substeps, more than 1 with the temporal blocking only
+ */
+void	Water::_step(float dtTime, uint32_t nbSteps) {
+	std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+
+	// choose the tiles to process this step
+	_updateTileSets(nbSteps);
+	if (_sparse)
+		_fillTiles();
+	_endPhase(WaterPhase::TILES, phaseStart);
+
+	if (nbSteps > 1) {
+		_sweep(dtTime, nbSteps);
+		_endPhase(WaterPhase::SWEEP, phaseStart);
+		_updateTileActivity();
+		_endPhase(WaterPhase::ACTIVITY, phaseStart);
+		return;
+	}
 
-	// column water total height
-	float totalH = _waterCols[v][u].terrainH + _waterCols[v][u].depth;
+	// update active water columns flow, only read the [v-1] and [u-1] neighbours
+	_forEachBand([this, dtTime](uint32_t vStart, uint32_t vEnd) {
+		for (uint32_t v = vStart; v < vEnd; ++v) {
+			_forEachSpan(v, _tileFlow, [this, v, dtTime](uint32_t uStart, uint32_t uEnd) {
+				_updateFlow(v, uStart, uEnd, dtTime);
+			});
+		}
+	});
+	_endPhase(WaterPhase::FLOW, phaseStart);
 
-	/* left flow */
-	// if there is a wall, set the flow to 0
-	// verify area limit or terain wall
-	bool wall = u == 0;
-	float totalHLeft = 0.0;
-	if (!wall) {
-		totalHLeft = _waterCols[v][u - 1].terrainH + _waterCols[v][u - 1].depth;
-		bool wallLeft = _waterCols[v][u - 1].depth == 0 && _waterCols[v][u - 1].terrainH > totalH;
-		bool wallRight = _waterCols[v][u].depth == 0 && _waterCols[v][u].terrainH > totalHLeft;
-		wall = wallLeft || wallRight;
-	}
-	if (wall) {
-		_waterCols[v][u].lFlow = 0.0;
+	// scale flow to prevent negative water depth
+	if (_flowParams.limited) {
+		// outflow scale factors, applied by the depth update
+		_forEachBand([this, dtTime](uint32_t vStart, uint32_t vEnd) {
+			for (uint32_t v = vStart; v < vEnd; ++v) {
+				_forEachSpan(v, _tileDepth, [this, v, dtTime](uint32_t uStart, uint32_t uEnd) {
+					_kernels->limitRow(_grid, v, uStart, uEnd, dtTime, _gridArea, _flowParams);
+				});
+			}
+		});
 	}
 	else {
-		float hDiff = 0.0;
-		float freeWaterH = 0.0;
-		if (totalH > totalHLeft) {
-			float totalHDiff = totalH - totalHLeft;
-			freeWaterH = totalHDiff > _waterCols[v][u].depth ? _waterCols[v][u].depth : totalHDiff;
-			hDiff = -freeWaterH;
-		}
-		else {
-			float totalHDiff = totalHLeft - totalH;
-			freeWaterH = totalHDiff > _waterCols[v][u - 1].depth ? _waterCols[v][u - 1].depth : totalHDiff;
-			hDiff = freeWaterH;
-		}
-		// * comment for static cross-sectional area of the pipe
-		pipeCSA = _gridSpace.x * freeWaterH;
-
-		_waterCols[v][u].lFlow += pipeCSA * (_gravity / _pipeLen.x) * hDiff * dtTime;
-	}
-
-	/* top flow */
-	// if there is a wall, set the flow to 0
-	// verify area limit or terain wall
-	wall = v == 0;
-	float totalHTop = 0.0;
-	if (!wall) {
-		totalHTop = _waterCols[v - 1][u].terrainH + _waterCols[v - 1][u].depth;
-		bool wallTop = _waterCols[v - 1][u].depth == 0 && _waterCols[v - 1][u].terrainH > totalH;
-		bool wallBottom = _waterCols[v][u].depth == 0 && _waterCols[v][u].terrainH > totalHTop;
-		wall = wallTop || wallBottom;
-	}
-	if (wall) {
-		_waterCols[v][u].tFlow = 0.0;
+		_correctNegWaterDepth(dtTime);
 	}
-	else {
-		float hDiff = 0.0;
-		float freeWaterH = 0.0;
-		if (totalH > totalHTop) {
-			float totalHDiff = totalH - totalHTop;
-			freeWaterH = totalHDiff > _waterCols[v][u].depth ? _waterCols[v][u].depth : totalHDiff;
-			hDiff = -freeWaterH;
+	_endPhase(WaterPhase::LIMIT, phaseStart);
+
+	// update active water columns depth, only read the [v+1] and [u+1] neighbours
+	_forEachBand([this, dtTime](uint32_t vStart, uint32_t vEnd) {
+		for (uint32_t v = vStart; v < vEnd; ++v) {
+			_forEachSpan(v, _tileDepth, [this, v, dtTime](uint32_t uStart, uint32_t uEnd) {
+				_updateDepth(v, uStart, uEnd, dtTime);
+			});
 		}
-		else {
-			float totalHDiff = totalHTop - totalH;
-			freeWaterH = totalHDiff > _waterCols[v - 1][u].depth ? _waterCols[v - 1][u].depth : totalHDiff;
-			hDiff = freeWaterH;
-		}
-		// * comment for static cross-sectional area of the pipe
-		pipeCSA = _gridSpace.y * freeWaterH;
+	});
+	_endPhase(WaterPhase::DEPTH, phaseStart);
+
+	// put the settled tiles to sleep
+	_updateTileActivity();
+	_endPhase(WaterPhase::ACTIVITY, phaseStart);
+}
+
+/**
+ * @brief Run the flow, limit and depth passes of nbSteps substeps in a single
+ * sweep of the rows (temporal blocking)
+ *
+ * Each pass of each substep is a level, a level only reads the rows v - 1 to
+ * v + 1 of the previous levels and its own row. Sweeping the rows with the
+ * level q on the row r - q, in increasing q, gives the same result as running
+ * the levels one after the other while the rows r - q stay in cache.
+ *
+ * The bands are swept in parallel as trapezoids shrinking by a row per level
+ * on each side, so they never read a row their neighbours write. Then the
+ * triangles left around the bands limits are swept, they need bands at least
+ * 2 * nbLevels high to not overlap.
+ *
+ * @param dtTime substep duration
+ * @param nbSteps number of substeps
+ */
+void	Water::_sweep(float dtTime, uint32_t nbSteps) {
+	uint32_t height = _grid.getHeight();
+	uint32_t nbLevels = nbSteps * WATER_SWEEP_PASSES;
+	uint32_t nbBands = std::max(1u, std::min(ThreadPool::get().getNbThreads(), height / (2 * nbLevels + 2)));
+
+	ThreadPool::get().run(nbBands, [this, dtTime, height, nbBands, nbLevels](uint32_t bandId) {
+		int64_t vStart = static_cast<uint64_t>(height) * bandId / nbBands;
+		int64_t vEnd = static_cast<uint64_t>(height) * (bandId + 1) / nbBands;
+		_sweepRows(dtTime, nbLevels, vStart, vEnd, bandId != 0 ? 1 : 0, bandId + 1 != nbBands ? -1 : 0);
+	}, _background);
+	if (nbBands < 2)
+		return;
+	ThreadPool::get().run(nbBands - 1, [this, dtTime, height, nbBands, nbLevels](uint32_t limitId) {
+		int64_t v = static_cast<uint64_t>(height) * (limitId + 1) / nbBands;
+		_sweepRows(dtTime, nbLevels, v, v, -1, 1);
+	}, _background);
+}
 
-		_waterCols[v][u].tFlow += pipeCSA * (_gravity / _pipeLen.y) * hDiff * dtTime;
+/**
+ * @brief Sweep the levels of a rows trapezoid, the level q updates the rows
+ * [vStart + topSlope * q, vEnd + bottomSlope * q[
+ *
+ * @param dtTime substep duration
+ * @param nbLevels number of levels, WATER_SWEEP_PASSES per substep
+ * @param vStart first row of the level 0
+ * @param vEnd last row + 1 of the level 0
+ * @param topSlope rows added to the first row at each level
+ * @param bottomSlope rows added to the last row at each level
+ */
+void	Water::_sweepRows(float dtTime, uint32_t nbLevels, int64_t vStart, int64_t vEnd,
+	int32_t topSlope, int32_t bottomSlope)
+{
+	int64_t height = _grid.getHeight();
+	int64_t rEnd = std::max(vEnd, vEnd + (bottomSlope + 1) * static_cast<int64_t>(nbLevels - 1));
+	int64_t rStart = std::min(vStart, vStart + (topSlope + 1) * static_cast<int64_t>(nbLevels - 1));
+
+	for (int64_t r = std::max<int64_t>(rStart, 0); r < rEnd; ++r) {
+		for (uint32_t q = 0; q < nbLevels; ++q) {
+			int64_t v = r - q;
+			if (v < std::max<int64_t>(vStart + topSlope * static_cast<int64_t>(q), 0)
+				|| v >= std::min<int64_t>(vEnd + bottomSlope * static_cast<int64_t>(q), height))
+				continue;
+			uint32_t row = v;
+			switch (q % WATER_SWEEP_PASSES) {
+				case 0:
+					_forEachSpan(row, _tileFlow, [this, row, dtTime](uint32_t uStart, uint32_t uEnd) {
+						_updateFlow(row, uStart, uEnd, dtTime);
+					});
+					break;
+				case 1:
+					_forEachSpan(row, _tileDepth, [this, row, dtTime](uint32_t uStart, uint32_t uEnd) {
+						_kernels->limitRow(_grid, row, uStart, uEnd, dtTime, _gridArea, _flowParams);
+					});
+					break;
+				default:
+					_forEachSpan(row, _tileDepth, [this, row, dtTime](uint32_t uStart, uint32_t uEnd) {
+						_updateDepth(row, uStart, uEnd, dtTime);
+					});
+					break;
+			}
+		}
 	}
+}
 
-	// right and bottom flow will be processed by right and bottom column update
+/**
+ * @brief Add the time elapsed since start to a phase, then restart start
+ *
+ * @param phase the phase to account the time to
+ * @param start the phase start time, set to now
+ */
+void	Water::_endPhase(WaterPhase::Enum phase, std::chrono::steady_clock::time_point & start) {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	_phaseTime[phase] += std::chrono::duration<double>(now - start).count();
+	start = now;
 }
 
-void	Water::_updateDepth(uint32_t u, uint32_t v, float dtTime) {
-	float totalFlow = 0.0;  // we store the total amount of flow here
-	// left flow
-	totalFlow += _waterCols[v][u].lFlow;
-	// top flow
-	totalFlow += _waterCols[v][u].tFlow;
-	// right flow
-	if (u < WATER_GRID_RES.x - 1)
-		totalFlow += -_waterCols[v][u + 1].lFlow;
-	// bottom flow
-	if (v < WATER_GRID_RES.y - 1)
-		totalFlow += -_waterCols[v + 1][u].tFlow;
+void	Water::_updateFlow(uint32_t v, uint32_t uStart, uint32_t uEnd, float dtTime) {
+	_kernels->flowRow(_grid, v, uStart, uEnd, dtTime, _flowParams);
+}
 
-	// calculate the new depth
-	_waterCols[v][u].depth += (totalFlow / _gridArea) * dtTime;
-	// prevent the depth from going bellow 0
-	_waterCols[v][u].depth = std::max(0.0f, _waterCols[v][u].depth);
+void	Water::_updateDepth(uint32_t v, uint32_t uStart, uint32_t uEnd, float dtTime) {
+	_kernels->depthRow(_grid, v, uStart, uEnd, dtTime, _gridArea, _flowParams);
 }
 
+/**
+ * @brief Scale down the outflows that would make a column depth negative
+ *
+ * Each sweep first computes the outflow scale factor of every column, then
+ * applies it on the flows leaving the column. A flow is only written by the
+ * row owning it, so both passes can run on parallel bands.
+ *
+ * @param dtTime delta time
+ */
 void	Water::_correctNegWaterDepth(float dtTime) {
-	bool asNegDepth = true;
+	std::atomic<bool> asNegDepth(true);
 	for (uint16_t i = 0; asNegDepth && i < 5; ++i) {
 		asNegDepth = false;
-		// search for negativ depth and correct them
-		for (uint32_t v = 0; v < WATER_GRID_RES.y; ++v) {
-			for (uint32_t u = 0; u < WATER_GRID_RES.x; ++u) {
-				float lFlow = 0, tFlow = 0, rFlow = 0, bFlow = 0;
-				float totNegFlow = 0;  // store the total negative flow
-				float totPosFlow = 0;  // store the total negative flow
-
-				// left flow
-				lFlow = _waterCols[v][u].lFlow;
-				if (lFlow < 0)
-					totNegFlow += lFlow;
-				else
-					totPosFlow += lFlow;
-				// top flow
-				tFlow = _waterCols[v][u].tFlow;
-				if (tFlow < 0)
-					totNegFlow += tFlow;
-				else
-					totPosFlow += tFlow;
-				// right flow
-				if (u < WATER_GRID_RES.x - 1) {
-					rFlow = -_waterCols[v][u + 1].lFlow;
-					if (rFlow < 0)
-						totNegFlow += rFlow;
-					else
-						totPosFlow += rFlow;
-				}
-				// bottom flow
-				if (v < WATER_GRID_RES.y - 1) {
-					bFlow = -_waterCols[v + 1][u].tFlow;
-					if (bFlow < 0)
-						totNegFlow += bFlow;
-					else
-						totPosFlow += bFlow;
-				}
+		// search for negativ depth and calculate their correction ratio
+		_forEachBand([this, dtTime, &asNegDepth](uint32_t vStart, uint32_t vEnd) {
+			bool bandNegDepth = false;
+			for (uint32_t v = vStart; v < vEnd; ++v)
+				bandNegDepth |= _calcOutScale(v, dtTime);
+			if (bandNegDepth)
+				asNegDepth = true;
+		});
+
+		if (!asNegDepth)
+			break;
+		// correct them
+		_forEachBand([this](uint32_t vStart, uint32_t vEnd) {
+			for (uint32_t v = vStart; v < vEnd; ++v)
+				_applyOutScale(v);
+		});
+	}
+}
 
-				float totalFlow = lFlow + tFlow + rFlow + bFlow;
-				float depthChange = (totalFlow / _gridArea) * dtTime;
-				float newDepth = _waterCols[v][u].depth + depthChange;
-
-				// if the new depth is negative, scale down the negative flow
-				if (newDepth < 0) {
-					asNegDepth = true;
-
-					double totPosDepth = (totPosFlow / _gridArea) * dtTime;
-					double desNegDepth = -_waterCols[v][u].depth + totPosDepth;
-					double corNegFlow = (desNegDepth * _gridArea) / dtTime;
-					double corRatio = corNegFlow / totNegFlow;
-
-					if (lFlow < 0)
-						_waterCols[v][u].lFlow *= corRatio;
-					if (tFlow < 0)
-						_waterCols[v][u].tFlow *= corRatio;
-					if (rFlow < 0)
-						_waterCols[v][u + 1].lFlow *= corRatio;
-					if (bFlow < 0)
-						_waterCols[v + 1][u].tFlow *= corRatio;
-				}
+/**
+ * @brief Calculate the outflow scale factor of a row columns
+ *
+ * @param v the row id
+ * @param dtTime delta time
+ * @return true if at least one column of the row has a negative depth
+ */
+bool	Water::_calcOutScale(uint32_t v, float dtTime) {
+	// the iterative correction is only used on a dense grid, its rows are contiguous
+	uint32_t lastU = _grid.getWidth() - 1;
+	WaterValue const * depth = _grid.cells(WaterPlane::DEPTH, 0, v);
+	WaterValue const * lFlowRow = _grid.cells(WaterPlane::L_FLOW, 0, v);
+	WaterValue const * tFlowRow = _grid.cells(WaterPlane::T_FLOW, 0, v);
+	WaterValue const * tFlowBottom = v < _grid.getHeight() - 1
+		? _grid.cells(WaterPlane::T_FLOW, 0, v + 1) : nullptr;
+	float * outScale = _grid.row(WaterPlane::OUT_SCALE, 0, v);
+	bool asNegDepth = false;
+
+	for (uint32_t u = 0; u <= lastU; ++u) {
+		float lFlow = 0, tFlow = 0, rFlow = 0, bFlow = 0;
+		float totNegFlow = 0;  // store the total negative flow
+		float totPosFlow = 0;  // store the total negative flow
+
+		// left flow
+		lFlow = lFlowRow[u];
+		if (lFlow < 0)
+			totNegFlow += lFlow;
+		else
+			totPosFlow += lFlow;
+		// top flow
+		tFlow = tFlowRow[u];
+		if (tFlow < 0)
+			totNegFlow += tFlow;
+		else
+			totPosFlow += tFlow;
+		// right flow
+		if (u < lastU) {
+			rFlow = -lFlowRow[u + 1];
+			if (rFlow < 0)
+				totNegFlow += rFlow;
+			else
+				totPosFlow += rFlow;
+		}
+		// bottom flow
+		if (tFlowBottom) {
+			bFlow = -tFlowBottom[u];
+			if (bFlow < 0)
+				totNegFlow += bFlow;
+			else
+				totPosFlow += bFlow;
+		}
+
+		float totalFlow = lFlow + tFlow + rFlow + bFlow;
+		float depthChange = (totalFlow / _gridArea) * dtTime;
+		float newDepth = depth[u] + depthChange;
+
+		outScale[u] = 1.0f;
+		// if the new depth is negative, scale down the negative flow
+		if (newDepth < 0) {
+			asNegDepth = true;
+
+			double totPosDepth = (totPosFlow / _gridArea) * dtTime;
+			double desNegDepth = -depth[u] + totPosDepth;
+			double corNegFlow = (desNegDepth * _gridArea) / dtTime;
+			outScale[u] = corNegFlow / totNegFlow;
+		}
+	}
+	return asNegDepth;
+}
+
+/**
+ * @brief Scale the row left and top flows by the outflow scale factor of the
+ * column they are leaving
+ *
+ * @param v the row id
+ */
+void	Water::_applyOutScale(uint32_t v) {
+	WaterValue * lFlow = _grid.cells(WaterPlane::L_FLOW, 0, v);
+	WaterValue * tFlow = _grid.cells(WaterPlane::T_FLOW, 0, v);
+	float const * outScale = _grid.row(WaterPlane::OUT_SCALE, 0, v);
+	float const * outScaleTop = v != 0 ? _grid.row(WaterPlane::OUT_SCALE, 0, v - 1) : nullptr;
+
+	for (uint32_t u = 0; u < _grid.getWidth(); ++u) {
+		// negative flow leave this column, positive one leave the left/top column
+		if (lFlow[u] < 0)
+			lFlow[u] *= outScale[u];
+		else if (u != 0)
+			lFlow[u] *= outScale[u - 1];
+
+		if (tFlow[u] < 0)
+			tFlow[u] *= outScale[u];
+		else if (outScaleTop)
+			tFlow[u] *= outScaleTop[u];
+	}
+}
+
+/**
+ * @brief Split the grid rows in bands, one per thread of the pool, and call
+ * func on each band in parallel. Return once all the bands are done.
+ *
+ * @param func function called with the band rows [vStart, vEnd[
+ */
+void	Water::_forEachBand(std::function<void(uint32_t vStart, uint32_t vEnd)> const & func) {
+	uint32_t height = _grid.getHeight();
+	uint32_t nbBands = std::min(ThreadPool::get().getNbThreads(), height);
+
+	ThreadPool::get().run(nbBands, [&func, height, nbBands](uint32_t bandId) {
+		uint32_t vStart = static_cast<uint64_t>(height) * bandId / nbBands;
+		uint32_t vEnd = static_cast<uint64_t>(height) * (bandId + 1) / nbBands;
+		func(vStart, vEnd);
+	}, _background);
+}
+
+/**
+ * @brief Call func on each span of consecutive flagged tiles crossing the row v
+ *
+ * @param v the row id
+ * @param tiles one flag per tile
+ * @param func function called with the span columns [uStart, uEnd[
+ */
+void	Water::_forEachSpan(uint32_t v, std::vector<uint8_t> const & tiles,
+	std::function<void(uint32_t uStart, uint32_t uEnd)> const & func) const
+{
+	uint8_t const * tilesRow = &tiles[(v / WATER_TILE_SIZE) * _tilesW];
+	uint32_t tu = 0;
+	while (tu < _tilesW) {
+		if (!tilesRow[tu]) {
+			++tu;
+			continue;
+		}
+		uint32_t tuStart = tu;
+		while (tu < _tilesW && tilesRow[tu])
+			++tu;
+		func(tuStart * WATER_TILE_SIZE, std::min(tu * WATER_TILE_SIZE, _grid.getWidth()));
+	}
+}
+
+/**
+ * @brief Wake up the tile of a column, call it when modifying the column depth
+ *
+ * @param u the column id
+ * @param v the row id
+ */
+void	Water::_wakeCell(uint32_t u, uint32_t v) {
+	uint32_t t = (v / WATER_TILE_SIZE) * _tilesW + u / WATER_TILE_SIZE;
+	_tileAwake[t] = 1;
+	_tileMaxDepth[t] = std::max<float>(_tileMaxDepth[t], _grid.depth(u, v));
+}
+
+/**
+ * @brief Get the max column depth of a tile
+ *
+ * @param t the tile id
+ * @return float the max depth
+ */
+float	Water::_calcTileMaxDepth(uint32_t t) const {
+	uint32_t uStart = (t % _tilesW) * WATER_TILE_SIZE;
+	uint32_t vStart = (t / _tilesW) * WATER_TILE_SIZE;
+	uint32_t uEnd = std::min(uStart + WATER_TILE_SIZE, _grid.getWidth());
+	uint32_t vEnd = std::min(vStart + WATER_TILE_SIZE, _grid.getHeight());
+	float maxDepth = 0;
+	for (uint32_t v = vStart; v < vEnd; ++v) {
+		WaterValue const * depth = _grid.cells(WaterPlane::DEPTH, uStart, v);
+		for (uint32_t u = uStart; u < uEnd; ++u)
+			maxDepth = std::max<float>(maxDepth, depth[u - uStart]);
+	}
+	return maxDepth;
+}
+
+/**
+ * @brief Choose the tiles processed by the next step from the awake ones
+ *
+ * The flows are updated on the awake tiles and their neighbours, so the water
+ * can reach a sleeping tile and wake it up. The depth is updated on the flow
+ * tiles and their left/top neighbours, as each column own its left and top
+ * flows. The tiles that stop being processed get their flows reset, it keep
+ * the flows between an updated and a non updated column to 0 and the mass
+ * conserved. The periodic borders make the opposite border tiles neighbours.
+ *
+ * @param nbSteps number of substeps run on these tiles
+ */
+void	Water::_updateTileSets(uint32_t nbSteps) {
+	uint32_t nbTiles = _tilesW * _tilesH;
+	bool periodic = _boundary == WaterBoundary::PERIODIC;
+	// the tile neighbours, the tile itself beyond a non periodic border
+	auto right = [this, periodic](uint32_t t, uint32_t tu) {
+		return tu + 1 < _tilesW ? t + 1 : (periodic ? t + 1 - _tilesW : t);
+	};
+	auto bottom = [this, periodic, nbTiles](uint32_t t, uint32_t tv) {
+		return tv + 1 < _tilesH ? t + _tilesW : (periodic ? t + _tilesW - nbTiles : t);
+	};
+
+	for (uint32_t t = 0; t < nbTiles; ++t) {
+		uint32_t tu = t % _tilesW;
+		uint32_t tv = t / _tilesW;
+		uint32_t tLeft = tu != 0 ? t - 1 : (periodic ? t + _tilesW - 1 : t);
+		uint32_t tTop = tv != 0 ? t - _tilesW : (periodic ? t + nbTiles - _tilesW : t);
+		bool flow = _tileAwake[t] || _tileAwake[tLeft] || _tileAwake[right(t, tu)]
+			|| _tileAwake[tTop] || _tileAwake[bottom(t, tv)];
+
+		// the tile go to sleep, reset its flows, a non resident one has none
+		if (_tileFlow[t] && !flow && _grid.isResident(tu, tv)) {
+			uint32_t uStart = tu * WATER_TILE_SIZE;
+			uint32_t uEnd = std::min(uStart + WATER_TILE_SIZE, _grid.getWidth());
+			uint32_t vEnd = std::min((tv + 1) * WATER_TILE_SIZE, _grid.getHeight());
+			for (uint32_t v = tv * WATER_TILE_SIZE; v < vEnd; ++v) {
+				WaterValue * lFlow = _grid.cells(WaterPlane::L_FLOW, uStart, v);
+				WaterValue * tFlow = _grid.cells(WaterPlane::T_FLOW, uStart, v);
+				std::fill(lFlow, lFlow + (uEnd - uStart), 0.0f);
+				std::fill(tFlow, tFlow + (uEnd - uStart), 0.0f);
 			}
 		}
+		_tileFlow[t] = flow;
+	}
+
+	uint32_t nbActiveTiles = 0;
+	uint64_t nbCells = 0;
+	for (uint32_t t = 0; t < nbTiles; ++t) {
+		uint32_t tu = t % _tilesW;
+		uint32_t tv = t / _tilesW;
+		_tileDepth[t] = _tileFlow[t] || _tileFlow[right(t, tu)] || _tileFlow[bottom(t, tv)];
+		_tileMesh[t] |= _tileDepth[t];
+		nbActiveTiles += _tileDepth[t];
+		if (_tileDepth[t])
+			nbCells += (std::min((tu + 1) * WATER_TILE_SIZE, _grid.getWidth()) - tu * WATER_TILE_SIZE)
+				* (std::min((tv + 1) * WATER_TILE_SIZE, _grid.getHeight()) - tv * WATER_TILE_SIZE);
 	}
+	_nbActiveTiles = nbActiveTiles;
+	_nbCellUpdates += nbCells * nbSteps;
+}
+
+/**
+ * @brief Keep awake the flow tiles with at least one flow (their border ones
+ * included) above WATER_TILE_SLEEP_FLOW, put the others to sleep. Also update
+ * the max depth of the tiles whose depth changed.
+ */
+void	Water::_updateTileActivity() {
+	ThreadPool::get().run(_tilesH, [this](uint32_t tv) {
+		uint32_t vStart = tv * WATER_TILE_SIZE;
+		uint32_t vEnd = std::min(vStart + WATER_TILE_SIZE, _grid.getHeight());
+
+		for (uint32_t tu = 0; tu < _tilesW; ++tu) {
+			uint32_t t = tv * _tilesW + tu;
+			if (_tileDepth[t])
+				_tileMaxDepth[t] = _calcTileMaxDepth(t);
+			if (!_tileFlow[t]) {
+				_tileAwake[t] = 0;
+				continue;
+			}
+
+			uint32_t uStart = tu * WATER_TILE_SIZE;
+			uint32_t uEnd = std::min(uStart + WATER_TILE_SIZE, _grid.getWidth());
+			float maxFlow = 0;
+			for (uint32_t v = vStart; v < vEnd; ++v) {
+				WaterValue const * lFlow = _grid.cells(WaterPlane::L_FLOW, uStart, v);
+				WaterValue const * tFlow = _grid.cells(WaterPlane::T_FLOW, uStart, v);
+				for (uint32_t u = uStart; u < uEnd; ++u) {
+					maxFlow = std::max(maxFlow, std::fabs(lFlow[u - uStart]));
+					maxFlow = std::max(maxFlow, std::fabs(tFlow[u - uStart]));
+				}
+				// the right border flows are owned by the next tile
+				if (uEnd < _grid.getWidth())
+					maxFlow = std::max(maxFlow, std::fabs(_grid.lFlow(uEnd, v)));
+			}
+			// the bottom border flows too
+			if (vEnd < _grid.getHeight()) {
+				WaterValue const * tFlow = _grid.cells(WaterPlane::T_FLOW, uStart, vEnd);
+				for (uint32_t u = uStart; u < uEnd; ++u)
+					maxFlow = std::max(maxFlow, std::fabs(tFlow[u - uStart]));
+			}
+			_tileAwake[t] = maxFlow > WATER_TILE_SLEEP_FLOW;
+		}
+	}, _background);
 }
 
 bool	Water::draw(bool wireframe) {
+	_uploadMesh();
+
 	_sh->use();
 
 	// update uniforms
@@ -424,16 +1535,259 @@ bool	Water::draw(bool wireframe) {
 	return true;
 }
 
+/**
+ * @brief Reset the water columns with a new scenario
+ *
+ * @param scenarioId the FlowScenario
+ */
 void	Water::setScenario(uint16_t scenarioId) {
-	_scenario = static_cast<FlowScenario::Enum>(scenarioId);
-	init();
+	_requestedScenario = static_cast<FlowScenario::Enum>(scenarioId);
+	_replaying = false;
+
+	WaterCommand cmd;
+	cmd.type = WaterCmd::SET_SCENARIO;
+	cmd.scenarioId = scenarioId;
+	_pushCommand(cmd);
+
+	if (!_threaded)
+		_processCommands();
 }
 
-bool	Water::_initMesh() {
+/**
+ * @brief Compute the mesh vertices even without GL, to time them in headless
+ * mode, must be called before init()
+ *
+ * @param enabled true to compute the vertices
+ */
+void	Water::setMeshVertices(bool enabled) {
+	_meshVertices = enabled || !_headless;
+}
+
+/**
+ * @brief Simulate a water which is not displayed, its mesh is not updated and
+ * its pool runs give way to the displayed water ones
+ *
+ * The mesh of the steps simulated in background is updated when the water is
+ * displayed again.
+ *
+ * @param background true if the water is not displayed
+ */
+void	Water::setBackground(bool background) {
+	if (_background == background)
+		return;
+	_background = background;
+	if (background)
+		return;
+
+	// an empty step publishes the mesh of the background steps
+	WaterCommand cmd;
+	cmd.type = WaterCmd::ADVANCE;
+	cmd.dtTime = 0;
+	_pushCommand(cmd);
+
+	if (!_threaded)
+		_processCommands();
+}
+
+/**
+ * @brief Record the water depth after each update, replace the current record
+ *
+ * @param path the record file
+ * @return false if the file can't be created
+ */
+bool	Water::startRecording(std::string const & path) {
+	WaterRecorder * recorder = new WaterRecorder(path, _terrain.getMapPath(), _grid.getWidth(),
+		_grid.getHeight());
+	if (!recorder->start()) {
+		delete recorder;
+		return false;
+	}
+
+	WaterCommand cmd;
+	cmd.type = WaterCmd::RECORD;
+	cmd.recorder = recorder;
+	if (!_pushCommand(cmd)) {
+		delete recorder;
+		return false;
+	}
+
+	if (!_threaded)
+		_processCommands();
+	return true;
+}
+
+/**
+ * @brief Stop the current record, its report is printed
+ */
+void	Water::stopRecording() {
+	WaterCommand cmd;
+	cmd.type = WaterCmd::RECORD;
+	cmd.recorder = nullptr;
+	_pushCommand(cmd);
+
+	if (!_threaded)
+		_processCommands();
+}
+
+/**
+ * @brief Replace the simulation by the replay of a record, until the next
+ * scenario change
+ *
+ * The record must have the resolution of this water, a record from another
+ * map is played over this terrain.
+ *
+ * @param path the record file
+ * @return false if the record is invalid or has another resolution
+ */
+bool	Water::startReplay(std::string const & path) {
+	WaterPlayer * player = new WaterPlayer(path);
+	if (!player->open()) {
+		delete player;
+		return false;
+	}
+	WaterRecordHeader const & header = player->getHeader();
+	if (header.width != _grid.getWidth() || header.height != _grid.getHeight()) {
+		logErr("unable to replay " << path << ", resolution " << header.width << "x"
+			<< header.height << ", expected " << _grid.getWidth() << "x" << _grid.getHeight());
+		delete player;
+		return false;
+	}
+	if (player->getMapPath() != _terrain.getMapPath())
+		logWarn("replay of " << player->getMapPath() << " over " << _terrain.getMapPath());
+	logInfo("replay " << path << ": " << player->getNbFrames() << " frames");
+
+	WaterCommand cmd;
+	cmd.type = WaterCmd::REPLAY;
+	cmd.player = player;
+	// set before the simulation can clear it on a decode error
+	_replaying = true;
+	if (!_pushCommand(cmd)) {
+		_replaying = false;
+		delete player;
+		return false;
+	}
+
+	if (!_threaded)
+		_processCommands();
+	return true;
+}
+
+/**
+ * @brief Move the replay, clamped to the record
+ *
+ * @param offset time offset (s), negative to go back
+ */
+void	Water::replaySeek(float offset) {
+	WaterCommand cmd;
+	cmd.type = WaterCmd::REPLAY_SEEK;
+	cmd.dtTime = offset;
+	_sendReplayCommand(cmd);
+}
+
+/**
+ * @brief Move the replay frame by frame, clamped to the record
+ *
+ * @param nbFrames frames to move, negative to go back
+ */
+void	Water::replayStep(int32_t nbFrames) {
+	WaterCommand cmd;
+	cmd.type = WaterCmd::REPLAY_STEP;
+	cmd.u = nbFrames;
+	_sendReplayCommand(cmd);
+}
+
+/**
+ * @brief Change the replay speed, between WATER_REPLAY_MIN_SPEED and
+ * WATER_REPLAY_MAX_SPEED
+ *
+ * @param factor speed multiplier
+ */
+void	Water::replaySpeed(float factor) {
+	WaterCommand cmd;
+	cmd.type = WaterCmd::REPLAY_SPEED;
+	cmd.dtTime = factor;
+	_sendReplayCommand(cmd);
+}
+
+void	Water::_sendReplayCommand(WaterCommand const & cmd) {
+	if (!_replaying)
+		return;
+	_pushCommand(cmd);
+
+	if (!_threaded)
+		_processCommands();
+}
+
+// -- getters ------------------------------------------------------------------
+uint32_t	Water::getNbActiveTiles() const { return _nbActiveTiles; }
+uint32_t	Water::getNbTiles() const { return _tilesW * _tilesH; }
+uint32_t	Water::getNbSubsteps() const { return _nbSubsteps; }
+/**
+ * @brief Get the number of columns updated since the scenario start
+ */
+uint64_t	Water::getNbCellUpdates() const { return _nbCellUpdates; }
+/**
+ * @brief Get the memory used by the water columns planes, only the blocks of
+ * the resident tiles of a sparse grid
+ */
+uint64_t	Water::getResidentBytes() const { return _grid.getResidentBytes(); }
+std::string const &	Water::getSnapshotPath() const { return _snapshotPath; }
+uint16_t	Water::getScenario() const { return _requestedScenario; }
+bool	Water::isReplaying() const { return _replaying; }
+/**
+ * @brief Get the simulated time since the scenario start, only read it when
+ * the simulation is not running (headless or inline update)
+ */
+double	Water::getSimTime() const { return _simTime; }
+/**
+ * @brief Get the total time spent in a phase, only read it when the
+ * simulation is not running (headless or inline update)
+ */
+double	Water::getPhaseTime(WaterPhase::Enum phase) const { return _phaseTime[phase]; }
+
+/**
+ * @brief Get the total water volume
+ *
+ * @return double the volume (m3)
+ */
+double	Water::getVolume() const {
+	double volume = 0;
+	for (uint32_t v = 0; v < _grid.getHeight(); ++v) {
+		for (uint32_t u = 0; u < _grid.getWidth(); ++u)
+			volume += _grid.depth(u, v);
+	}
+	return volume * _gridArea;
+}
+
+/**
+ * @brief Get a FNV-1a hash of the columns depth, to compare two runs
+ *
+ * @return uint64_t the hash
+ */
+uint64_t	Water::getChecksum() const {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	// the row runs in order, the same bytes for a dense and a sparse grid
+	for (uint32_t v = 0; v < _grid.getHeight(); ++v) {
+		for (uint32_t u = 0; u < _grid.getWidth(); u = _grid.getRunEnd(u)) {
+			uint8_t const * bytes = reinterpret_cast<uint8_t const *>(_grid.cells(WaterPlane::DEPTH, u, v));
+			for (size_t i = 0; i < (_grid.getRunEnd(u) - u) * sizeof(WaterValue); ++i) {
+				hash ^= bytes[i];
+				hash *= 0x100000001b3ULL;
+			}
+		}
+	}
+	return hash;
+}
+
+void	Water::_initVertices() {
 	// fill vertices
+	uint32_t vertW = _grid.getWidth() + 1;
+	uint32_t vertH = _grid.getHeight() + 1;
 	float waterDepth;
-	for (uint16_t z = 0; z < WATER_GRID_RES.y + 1; ++z) {
-		for (uint16_t x = 0; x < WATER_GRID_RES.x + 1; ++x) {
+	_vertices.clear();
+	_vertices.reserve(static_cast<size_t>(vertW) * vertH);
+	for (uint32_t z = 0; z < vertH; ++z) {
+		for (uint32_t x = 0; x < vertW; ++x) {
 			WaterVert vert;
 			vert.pos = {_gridSpace.x * x, _calculateHeight(x, z, waterDepth), _gridSpace.y * z};
 			vert.visible = waterDepth <= WATER_MIN_DISPLAY_H ? 0.0 : 1.0;
@@ -442,11 +1796,18 @@ bool	Water::_initMesh() {
 	}
 
 	// calc vertices normals
-	for (WaterVert & vert : _vertices) {
-		uint16_t x = std::round(vert.pos.x / _gridSpace.x);
-		uint16_t z = std::round(vert.pos.z / _gridSpace.y);
-		vert.norm = _calculateNormal(x, z);
+	for (uint32_t z = 0; z < vertH; ++z) {
+		for (uint32_t x = 0; x < vertW; ++x)
+			_vertices[z * vertW + x].norm = _calculateNormal(x, z);
 	}
+	// the published meshes are all outdated
+	_slotRows.fill(glm::uvec2(0, vertH));
+	_slotBorder.fill(true);
+}
+
+bool	Water::_initMesh() {
+	uint32_t vertW = _grid.getWidth() + 1;
+	uint32_t vertH = _grid.getHeight() + 1;
 
 	// fill indices
 	// By repeating the last vertex and the first vertex, we created four
@@ -454,22 +1815,23 @@ bool	Water::_initMesh() {
 	// with the second. We could link an arbitrary number of rows this way and
 	// draw the entire mesh with only one call
 	// cf: learnopengles.com/tag/triangle-strips
-	for (uint16_t y = 0; y < WATER_GRID_RES.y; ++y) {
+	_indices.reserve(static_cast<size_t>(vertW * 2 + 2) * (vertH - 1));
+	for (uint32_t y = 0; y < vertH - 1; ++y) {
 		// duplicate first vertice to generate degenerate triangle
 		if (y > 0)
-			_indices.push_back(y * (WATER_GRID_RES.x + 1));
+			_indices.push_back(y * vertW);
 
 		uint32_t a = 0;
 		uint32_t b = 0;
-		for (uint16_t x = 0; x < WATER_GRID_RES.x + 1; ++x) {
-			a = x + y * (WATER_GRID_RES.x + 1);
-			b = a + (WATER_GRID_RES.x + 1);
+		for (uint32_t x = 0; x < vertW; ++x) {
+			a = x + y * vertW;
+			b = a + vertW;
 			_indices.push_back(a);
 			_indices.push_back(b);
 		}
 
 		// duplicate last vertice to generate degenerate triangle
-		if (y != WATER_GRID_RES.y - 1)
+		if (y != vertH - 2)
 			_indices.push_back(b);
 	}
 
@@ -511,42 +1873,146 @@ bool	Water::_initMesh() {
 	return true;
 }
 
-bool	Water::_updateMesh() {
-	// update vertices pos/visibility
+/**
+ * @brief Update the vertices around the tiles updated since the last call
+ *
+ * @param zMin filled with the first updated vertices row
+ * @param zMax filled with the last updated vertices row + 1, zMin >= zMax if
+ * nothing was updated
+ */
+void	Water::_updateVertices(uint32_t & zMin, uint32_t & zMax) {
+	uint32_t vertW = _grid.getWidth() + 1;
+	uint32_t vertH = _grid.getHeight() + 1;
+	zMin = vertH;
+	zMax = 0;
+
+	// update vertices pos/visibility around the tiles updated since the last call
 	float waterDepth;
-	for (WaterVert & vert : _vertices) {
-		uint16_t x = std::round(vert.pos.x / _gridSpace.x);
-		uint16_t z = std::round(vert.pos.z / _gridSpace.y);
-		vert.pos = glm::vec3(vert.pos.x, _calculateHeight(x, z, waterDepth), vert.pos.z);
-		vert.visible = waterDepth <= WATER_MIN_DISPLAY_H ? 0.0 : 1.0;
+	for (uint32_t t = 0; t < _tileMesh.size(); ++t) {
+		if (!_tileMesh[t])
+			continue;
+		uint32_t xStart = (t % _tilesW) * WATER_TILE_SIZE;
+		uint32_t zStart = (t / _tilesW) * WATER_TILE_SIZE;
+		uint32_t xEnd = std::min(xStart + WATER_TILE_SIZE + 1, vertW);
+		uint32_t zEnd = std::min(zStart + WATER_TILE_SIZE + 1, vertH);
+		for (uint32_t z = zStart; z < zEnd; ++z) {
+			for (uint32_t x = xStart; x < xEnd; ++x) {
+				WaterVert & vert = _vertices[z * vertW + x];
+				vert.pos.y = _calculateHeight(x, z, waterDepth);
+				vert.visible = waterDepth <= WATER_MIN_DISPLAY_H ? 0.0 : 1.0;
+			}
+		}
 	}
 
-	// update normals
-	for (WaterVert & vert : _vertices) {
-		uint16_t x = std::round(vert.pos.x / _gridSpace.x);
-		uint16_t z = std::round(vert.pos.z / _gridSpace.y);
-		vert.norm = _calculateNormal(x, z);
+	// update normals, they also depend on the neighbours vertices
+	for (uint32_t t = 0; t < _tileMesh.size(); ++t) {
+		if (!_tileMesh[t])
+			continue;
+		uint32_t xStart = (t % _tilesW) * WATER_TILE_SIZE;
+		uint32_t zStart = (t / _tilesW) * WATER_TILE_SIZE;
+		uint32_t xEnd = std::min(xStart + WATER_TILE_SIZE + 2, vertW);
+		uint32_t zEnd = std::min(zStart + WATER_TILE_SIZE + 2, vertH);
+		xStart = xStart != 0 ? xStart - 1 : 0;
+		zStart = zStart != 0 ? zStart - 1 : 0;
+		for (uint32_t z = zStart; z < zEnd; ++z) {
+			for (uint32_t x = xStart; x < xEnd; ++x)
+				_vertices[z * vertW + x].norm = _calculateNormal(x, z);
+		}
+		zMin = std::min(zMin, zStart);
+		zMax = std::max(zMax, zEnd);
 	}
+	std::fill(_tileMesh.begin(), _tileMesh.end(), 0);
+}
 
-	// update vbo data
+/**
+ * @brief Copy the vertices in the mesh buffer for the renderer
+ *
+ * The renderer only upload the changed rows, so the rows of the meshes it
+ * skipped are added to the published ones. Each buffer slot keeps its
+ * vertices, only the rows changed since the slot was last published are
+ * copied in it, and the border when it changed.
+ *
+ * @param zMin first updated vertices row
+ * @param zMax last updated vertices row + 1
+ * @param borderChanged the border vertices changed
+ */
+void	Water::_publishMesh(uint32_t zMin, uint32_t zMax, bool borderChanged) {
+	if (_meshBuffer.consumed()) {
+		_pendingZMin = zMin;
+		_pendingZMax = zMax;
+		_pendingBorder = borderChanged;
+	}
+	else {
+		_pendingZMin = std::min(_pendingZMin, zMin);
+		_pendingZMax = std::max(_pendingZMax, zMax);
+		_pendingBorder = _pendingBorder || borderChanged;
+	}
+	for (uint8_t slot = 0; slot < _slotRows.size(); ++slot) {
+		_slotRows[slot] = glm::uvec2(std::min(_slotRows[slot].x, zMin), std::max(_slotRows[slot].y, zMax));
+		_slotBorder[slot] = _slotBorder[slot] || borderChanged;
+	}
+
+	uint8_t slot = _meshBuffer.backSlot();
+	WaterMeshFrame & frame = _meshBuffer.back();
+	size_t vertW = _grid.getWidth() + 1;
+	if (frame.vertices.size() != _vertices.size()) {  // first use of the slot
+		frame.vertices = _vertices;
+		frame.verticesB = _verticesB;
+	}
+	else {
+		if (_slotRows[slot].x < _slotRows[slot].y) {
+			std::copy(_vertices.begin() + _slotRows[slot].x * vertW, _vertices.begin() + _slotRows[slot].y * vertW,
+				frame.vertices.begin() + _slotRows[slot].x * vertW);
+		}
+		if (_slotBorder[slot])
+			std::copy(_verticesB.begin(), _verticesB.end(), frame.verticesB.begin());
+	}
+	_slotRows[slot] = glm::uvec2(_vertices.size() / vertW, 0);
+	_slotBorder[slot] = false;
+
+	frame.zMin = _pendingZMin;
+	frame.zMax = _pendingZMax;
+	frame.borderChanged = _pendingBorder;
+	_meshBuffer.publish();
+}
+
+/**
+ * @brief Upload the last mesh published by the simulation, if any
+ */
+void	Water::_uploadMesh() {
+	if (!_meshBuffer.update())
+		return;
+
+	WaterMeshFrame const & frame = _meshBuffer.front();
+	uint32_t vertW = _grid.getWidth() + 1;
+
+	// update vbo data, only the updated rows
 	glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, _vertices.size() * sizeof(WaterVert), &_vertices[0]);
+	glBufferSubData(GL_ARRAY_BUFFER, frame.zMin * vertW * sizeof(WaterVert),
+		(frame.zMax - frame.zMin) * vertW * sizeof(WaterVert), &frame.vertices[frame.zMin * vertW]);
+	// update border vbo data
+	if (frame.borderChanged) {
+		glBindBuffer(GL_ARRAY_BUFFER, _vboB);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, frame.verticesB.size() * sizeof(WaterVert), &frame.verticesB[0]);
+	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	return true;
 }
 
-bool	Water::_initMeshBorder() {
+void	Water::_initBorderVertices() {
 	// fill vertices
-	float meshWidth = (WATER_GRID_RES.x + 1) * 2 + (WATER_GRID_RES.y + 1) * 2;
+	uint32_t meshWidth = (_grid.getWidth() + 1) * 2 + (_grid.getHeight() + 1) * 2;
 	_verticesB = std::vector<WaterVert>(meshWidth * 2, WaterVert());
 	_updateBorderVertices();
+}
+
+bool	Water::_initMeshBorder() {
+	uint32_t meshWidth = (_grid.getWidth() + 1) * 2 + (_grid.getHeight() + 1) * 2;
 
 	// fill indices
 	// We create a triangle strip to draw all the borders in one call
 	uint32_t a, b;
 	_indicesB.push_back(0);
-	for (uint16_t x = 0; x < meshWidth; ++x) {
+	for (uint32_t x = 0; x < meshWidth; ++x) {
 		a = x;
 		b = a + meshWidth;
 		_indicesB.push_back(a);
@@ -589,94 +2055,61 @@ bool	Water::_initMeshBorder() {
 	return true;
 }
 
-bool	Water::_updateMeshBorder() {
-	_updateBorderVertices();
-
-	// update vbo data
-	glBindBuffer(GL_ARRAY_BUFFER, _vboB);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, _verticesB.size() * sizeof(WaterVert), &_verticesB[0]);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	return true;
-}
-
-void	Water::_updateBorderVertices() {
+/**
+ * @brief Update the border vertices from the water of the border columns
+ *
+ * @return true if a vertex changed
+ */
+bool	Water::_updateBorderVertices() {
 	// update vertices pos/normals/visibility
-	float meshWidth = (WATER_GRID_RES.x + 1) * 2 + (WATER_GRID_RES.y + 1) * 2;
+	int32_t gridW = _grid.getWidth();
+	int32_t gridH = _grid.getHeight();
+	uint32_t meshWidth = (gridW + 1) * 2 + (gridH + 1) * 2;
 	uint32_t i = 0;
-	WaterVert vert;
+	bool changed = false;
 	float waterDepth;
-	for (int32_t x = 0; x < WATER_GRID_RES.x + 1; ++x) {
-		float depth = _calculateHeight(x, 0, waterDepth);
-		vert.pos = {x * _gridSpace.x, depth, 0};
-		vert.norm = {0, 0, -1};
-		vert.visible = waterDepth <= WATER_MIN_DISPLAY_H ? 0.0 : 1.0;
-		_verticesB[i] = vert;
-		vert.pos = {vert.pos.x, 0.0, vert.pos.z};
-		_verticesB[i + meshWidth] = vert;
+	// set the top vertex, and the bottom one at the ground
+	auto setVert = [&](glm::vec3 pos, glm::vec3 norm) {
+		WaterVert & top = _verticesB[i];
+		WaterVert & bottom = _verticesB[i + meshWidth];
+		float visible = waterDepth <= WATER_MIN_DISPLAY_H ? 0.0 : 1.0;
+		changed = changed || top.pos != pos || top.norm != norm || top.visible != visible;
+		top.pos = pos;
+		top.norm = norm;
+		top.visible = visible;
+		bottom.pos = {pos.x, 0.0, pos.z};
+		bottom.norm = norm;
+		bottom.visible = visible;
 		++i;
+	};
+	for (int32_t x = 0; x < gridW + 1; ++x) {
+		float depth = _calculateHeight(x, 0, waterDepth);
+		setVert({x * _gridSpace.x, depth, 0}, {0, 0, -1});
 	}
-	for (int32_t z = 0; z < WATER_GRID_RES.y + 1; ++z) {
-		float depth = _calculateHeight(WATER_GRID_RES.x, z, waterDepth);
-		vert.pos = {WATER_GRID_RES.x * _gridSpace.x, depth, z * _gridSpace.y};
-		vert.norm = {1, 0, 0};
-		vert.visible = waterDepth <= WATER_MIN_DISPLAY_H ? 0.0 : 1.0;
-		_verticesB[i] = vert;
-		vert.pos = {vert.pos.x, 0.0, vert.pos.z};
-		_verticesB[i + meshWidth] = vert;
-		++i;
+	for (int32_t z = 0; z < gridH + 1; ++z) {
+		float depth = _calculateHeight(gridW, z, waterDepth);
+		setVert({gridW * _gridSpace.x, depth, z * _gridSpace.y}, {1, 0, 0});
 	}
-	for (int32_t x = WATER_GRID_RES.x; x >= 0; --x) {
-		float depth = _calculateHeight(x, WATER_GRID_RES.y, waterDepth);
-		vert.pos = {x * _gridSpace.x, depth, WATER_GRID_RES.y * _gridSpace.y};
-		vert.norm = {0, 0, 1};
-		vert.visible = waterDepth <= WATER_MIN_DISPLAY_H ? 0.0 : 1.0;
-		_verticesB[i] = vert;
-		vert.pos = {vert.pos.x, 0.0, vert.pos.z};
-		_verticesB[i + meshWidth] = vert;
-		++i;
+	for (int32_t x = gridW; x >= 0; --x) {
+		float depth = _calculateHeight(x, gridH, waterDepth);
+		setVert({x * _gridSpace.x, depth, gridH * _gridSpace.y}, {0, 0, 1});
 	}
-	for (int32_t z = WATER_GRID_RES.y; z >= 0; --z) {
+	for (int32_t z = gridH; z >= 0; --z) {
 		float depth = _calculateHeight(0, z, waterDepth);
-		vert.pos = {0, depth, z * _gridSpace.y};
-		vert.norm = {-1, 0, 0};
-		vert.visible = waterDepth <= WATER_MIN_DISPLAY_H ? 0.0 : 1.0;
-		_verticesB[i] = vert;
-		vert.pos = {vert.pos.x, 0.0, vert.pos.z};
-		_verticesB[i + meshWidth] = vert;
-		++i;
+		setVert({0, depth, z * _gridSpace.y}, {-1, 0, 0});
 	}
+	return changed;
 }
 
 float	Water::_calculateHeight(uint32_t x, uint32_t z, float & waterDepth) {
-	float tL, tR, bL, bR;
-	float terrainH = 0.0f;
-	glm::vec2 uv;
-
-	// top
-	uv.y = z != 0 ? z - 1 : 0;
-	// tL, (x-1, y-1)
-	uv.x = x != 0 ? x - 1 : 0;
-	tL = _waterCols[uv.y][uv.x].depth;
-	terrainH += _waterCols[uv.y][uv.x].terrainH;
-	// tR, (x, y-1)
-	uv.x = x < WATER_GRID_RES.x ? x : x - 1;
-	tR = _waterCols[uv.y][uv.x].depth;
-	terrainH += _waterCols[uv.y][uv.x].terrainH;
-
-	// bottom
-	uv.y = z < WATER_GRID_RES.y ? z : z - 1;
-	// bL, (x-1, y)
-	uv.x = x != 0 ? x - 1 : 0;
-	bL = _waterCols[uv.y][uv.x].depth;
-	terrainH += _waterCols[uv.y][uv.x].terrainH;
-	// bR, (x, y)
-	uv.x = x < WATER_GRID_RES.x ? x : x - 1;
-	bR = _waterCols[uv.y][uv.x].depth;
-	terrainH += _waterCols[uv.y][uv.x].terrainH;
-
-	waterDepth = (tL + tR + bL + bR) / 4.0;
-	terrainH /= 4;
+	// a vertex is shared by the 4 columns around it, clamped on the borders
+	uint32_t uL = x != 0 ? x - 1 : 0;
+	uint32_t uR = x < _grid.getWidth() ? x : x - 1;
+	uint32_t vT = z != 0 ? z - 1 : 0;
+	uint32_t vB = z < _grid.getHeight() ? z : z - 1;
+
+	waterDepth = (_grid.depth(uL, vT) + _grid.depth(uR, vT) + _grid.depth(uL, vB) + _grid.depth(uR, vB)) / 4.0;
+	float terrainH = (_terrainH(uL, vT) + _terrainH(uR, vT) + _terrainH(uL, vB) + _terrainH(uR, vB)) / 4;
 
 	return waterDepth + terrainH;
 }
@@ -690,12 +2123,12 @@ glm::vec3	Water::_calculateNormal(uint32_t x, uint32_t z) {
 	else
 		hL = WATER_H(x, z);
 	// hR
-	if (x < WATER_GRID_RES.x)
+	if (x < _grid.getWidth())
 		hR = WATER_H(x + 1, z);
 	else
 		hR = WATER_H(x, z);
 	// hT
-	if (z < WATER_GRID_RES.y)
+	if (z < _grid.getHeight())
 		hT = WATER_H(x, z + 1);
 	else
 		hT = WATER_H(x, z);
@@ -706,14 +2139,15 @@ glm::vec3	Water::_calculateNormal(uint32_t x, uint32_t z) {
 		hB = WATER_H(x, z);
 
 	float sx = hR - hL;
-	if (x == 0 || x == WATER_GRID_RES.x)
+	if (x == 0 || x == _grid.getWidth())
 		sx *= 2;
 
 	float sy = hB - hT;
-	if (z == 0 || z == WATER_GRID_RES.y)
+	if (z == 0 || z == _grid.getHeight())
 		sy *= 2;
 
-	glm::vec3 norm(-sx, 2.0, sy);
+	// the height differences are taken over 2 points spaces
+	glm::vec3 norm(-sx, 2.0 * (BOX_MAX_SIZE.x - 1) / _grid.getWidth(), sy);
 
 	return glm::normalize(norm);
 }
@@ -744,11 +2178,3 @@ void	Water::_staticUniform() {
 
 	_sh->unuse();
 }
-
-// -- WaterColum ---------------------------------------------------------------
-WaterColum::WaterColum() {
-	depth = 0.0;
-	lFlow = 0.0;
-	tFlow = 0.0;
-	terrainH = 0.0;
-}
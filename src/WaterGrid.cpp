@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+	#include <malloc.h>
+#else
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+#include "WaterGrid.hpp"
+
+static_assert(sizeof(WaterValue) <= sizeof(float), "WaterValue must fit in a float");
+
+// -- Constructors -------------------------------------------------------------
+
+WaterGrid::WaterGrid()
+: _width(0),
+  _height(0),
+  _stride(0),
+  _sparse(false),
+  _data(nullptr),
+  _tilesW(0),
+  _tilesH(0),
+  _zeroTile(nullptr),
+  _pool(nullptr),
+  _poolUsed(0),
+  _nbResidentTiles(0) {
+	for (uint8_t i = 0; i < WaterPlane::COUNT; ++i) {
+		_planes[i] = nullptr;
+		_tileOffsets[i] = 0;
+	}
+}
+
+WaterGrid::WaterGrid(uint32_t width, uint32_t height)
+: WaterGrid() {
+	resize(width, height);
+}
+
+WaterGrid::~WaterGrid() {
+	_free();
+}
+
+WaterGrid::WaterGrid(WaterGrid const &src)
+: WaterGrid() {
+	*this = src;
+}
+
+WaterGrid &WaterGrid::operator=(WaterGrid const &rhs) {
+	if (this != &rhs) {
+		resize(rhs._width, rhs._height, rhs._sparse);
+		if (_data)
+			std::memcpy(_data, rhs._data, getPlaneSize() * getCellBytes());
+		for (uint32_t t = 0; t < _tiles.size(); ++t) {
+			if (rhs._tiles[t] == rhs._zeroTile)
+				continue;
+			allocTile(t % _tilesW, t / _tilesW);
+			std::memcpy(_tiles[t], rhs._tiles[t], _getTileBytes());
+		}
+	}
+	return *this;
+}
+
+// -- Methods ------------------------------------------------------------------
+
+/**
+ * @brief Reallocate the planes for a new grid size, all cells are set to 0
+ *
+ * @param width number of columns
+ * @param height number of rows
+ * @param sparse true to only use memory for the allocated tiles
+ */
+void	WaterGrid::resize(uint32_t width, uint32_t height, bool sparse) {
+	_free();
+	_width = width;
+	_height = height;
+	#ifdef _WIN32
+		_sparse = false;
+	#else
+		_sparse = sparse;
+	#endif
+	// rows of the smallest values start on a cache line
+	uint32_t alignCols = WATER_GRID_BYTE_ALIGN / std::min(sizeof(WaterValue), sizeof(float));
+	_stride = (width + alignCols - 1) / alignCols * alignCols;
+
+	if (_sparse) {
+		_tilesW = (width + WATER_GRID_TILE_SIZE - 1) / WATER_GRID_TILE_SIZE;
+		_tilesH = (height + WATER_GRID_TILE_SIZE - 1) / WATER_GRID_TILE_SIZE;
+		size_t offset = 0;
+		for (uint8_t i = 0; i < WaterPlane::COUNT; ++i) {
+			_tileOffsets[i] = offset;
+			offset += WATER_GRID_TILE_SIZE * WATER_GRID_TILE_SIZE * valueSize(static_cast<WaterPlane::Enum>(i));
+		}
+		size_t nbTiles = static_cast<size_t>(_tilesW) * _tilesH;
+		if (nbTiles == 0)
+			return;
+		#ifndef _WIN32
+			// a block for each tile is reserved, only the taken ones are
+			// committed, on first write
+			void * pool = mmap(nullptr, nbTiles * _getTileBytes(), PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			void * zero = mmap(nullptr, _getTileBytes(), PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			_pool = pool != MAP_FAILED ? static_cast<uint8_t *>(pool) : nullptr;
+			_zeroTile = zero != MAP_FAILED ? static_cast<uint8_t *>(zero) : nullptr;
+		#endif
+		if (!_pool || !_zeroTile) {
+			_free();
+			throw std::bad_alloc();
+		}
+		_tiles.assign(nbTiles, _zeroTile);
+		_blockFree.assign(nbTiles, 1);
+		return;
+	}
+
+	size_t bytes = getPlaneSize() * getCellBytes();
+	if (bytes == 0)
+		return;
+
+	#ifdef _WIN32
+		_data = static_cast<uint8_t *>(_aligned_malloc(bytes, WATER_GRID_BYTE_ALIGN));
+	#else
+		_data = static_cast<uint8_t *>(std::aligned_alloc(WATER_GRID_BYTE_ALIGN, bytes));
+	#endif
+	if (!_data)
+		throw std::bad_alloc();
+
+	uint8_t * plane = _data;
+	for (uint8_t i = 0; i < WaterPlane::COUNT; ++i) {
+		_planes[i] = plane;
+		plane += getPlaneSize() * valueSize(static_cast<WaterPlane::Enum>(i));
+	}
+	clear();
+}
+
+/**
+ * @brief Set all the cells of all the planes to 0, a sparse grid gives back
+ * all its tiles and their memory
+ */
+void	WaterGrid::clear() {
+	if (_data)
+		std::memset(_data, 0, getPlaneSize() * getCellBytes());
+	#ifndef _WIN32
+		if (_pool) {
+			std::lock_guard<std::mutex> lock(_poolMutex);
+			madvise(_pool, static_cast<size_t>(_poolUsed) * _getTileBytes(), MADV_DONTNEED);
+			std::fill(_tiles.begin(), _tiles.end(), _zeroTile);
+			std::fill(_blockFree.begin(), _blockFree.end(), 1);
+			_freeBlocks.clear();
+			_poolUsed = 0;
+			_nbResidentTiles = 0;
+		}
+	#endif
+}
+
+/**
+ * @brief Set all the cells of one plane to a value, padding included. Only
+ * the resident tiles of a sparse grid are set.
+ *
+ * @param plane the plane to fill
+ * @param value the value to set
+ */
+void	WaterGrid::fillPlane(WaterPlane::Enum plane, float value) {
+	if (_data) {
+		if (plane < WaterPlane::TERRAIN_H)
+			std::fill_n(cells(plane, 0, 0), getPlaneSize(), WaterValue(value));
+		else
+			std::fill_n(row(plane, 0, 0), getPlaneSize(), value);
+	}
+	size_t tileSize = WATER_GRID_TILE_SIZE * WATER_GRID_TILE_SIZE;
+	for (uint8_t * tile : _tiles) {
+		if (tile == _zeroTile)
+			continue;
+		if (plane < WaterPlane::TERRAIN_H)
+			std::fill_n(reinterpret_cast<WaterValue *>(tile + _tileOffsets[plane]), tileSize, WaterValue(value));
+		else
+			std::fill_n(reinterpret_cast<float *>(tile + _tileOffsets[plane]), tileSize, value);
+	}
+}
+
+/**
+ * @brief Give a block to a sparse grid tile, its cells are set to 0. The
+ * tiles of different rows can be allocated in parallel.
+ *
+ * @param tu the tile column
+ * @param tv the tile row
+ * @return true if the tile was not resident
+ */
+bool	WaterGrid::allocTile(uint32_t tu, uint32_t tv) {
+	if (isResident(tu, tv))
+		return false;
+	uint8_t * block;
+	{
+		std::lock_guard<std::mutex> lock(_poolMutex);
+		uint32_t id = _poolUsed;
+		if (!_freeBlocks.empty()) {
+			id = _freeBlocks.back();
+			_freeBlocks.pop_back();
+		}
+		else {
+			++_poolUsed;
+		}
+		block = _pool + static_cast<size_t>(id) * _getTileBytes();
+		_blockFree[id] = 0;
+		++_nbResidentTiles;
+	}
+	std::memset(block, 0, _getTileBytes());
+	_tiles[static_cast<size_t>(tv) * _tilesW + tu] = block;
+	return true;
+}
+
+/**
+ * @brief Give back the block of a sparse grid tile, its cells read 0 again.
+ * Its memory is released, the block is kept in the pool for the next
+ * allocated tile.
+ *
+ * @param tu the tile column
+ * @param tv the tile row
+ */
+void	WaterGrid::freeTile(uint32_t tu, uint32_t tv) {
+	if (!isResident(tu, tv))
+		return;
+	uint8_t *& tile = _tiles[static_cast<size_t>(tv) * _tilesW + tu];
+	uint32_t id = (tile - _pool) / _getTileBytes();
+	std::lock_guard<std::mutex> lock(_poolMutex);
+	_freeBlocks.push_back(id);
+	_blockFree[id] = 1;
+	--_nbResidentTiles;
+	tile = _zeroTile;
+	_releaseBlock(id);
+}
+
+/**
+ * @brief Copy the simulated cells of a plane row as floats
+ *
+ * @param plane the plane to read
+ * @param v the row id
+ * @param dst width floats
+ */
+void	WaterGrid::readRow(WaterPlane::Enum plane, uint32_t v, float * dst) const {
+	for (uint32_t u = 0; u < _width; u = getRunEnd(u)) {
+		if (plane < WaterPlane::TERRAIN_H)
+			std::copy_n(cells(plane, u, v), getRunEnd(u) - u, dst + u);
+		else
+			std::memcpy(dst + u, row(plane, u, v), (getRunEnd(u) - u) * sizeof(float));
+	}
+}
+
+/**
+ * @brief Set the simulated cells of a plane row from floats, rounded to the
+ * storage format. The sparse grid tiles are allocated for the non 0 values.
+ *
+ * @param plane the plane to write
+ * @param v the row id
+ * @param src width floats
+ */
+void	WaterGrid::writeRow(WaterPlane::Enum plane, uint32_t v, float const * src) {
+	for (uint32_t u = 0; u < _width; u = getRunEnd(u)) {
+		uint32_t uEnd = getRunEnd(u);
+		if (!isResident(u / WATER_GRID_TILE_SIZE, v / WATER_GRID_TILE_SIZE)) {
+			if (std::all_of(src + u, src + uEnd, [](float value) { return value == 0; }))
+				continue;
+			allocTile(u / WATER_GRID_TILE_SIZE, v / WATER_GRID_TILE_SIZE);
+		}
+		if (plane < WaterPlane::TERRAIN_H)
+			std::copy(src + u, src + uEnd, cells(plane, u, v));
+		else
+			std::memcpy(row(plane, u, v), src + u, (uEnd - u) * sizeof(float));
+	}
+}
+
+void	WaterGrid::_free() {
+	#ifdef _WIN32
+		_aligned_free(_data);
+	#else
+		std::free(_data);
+		if (_pool)
+			munmap(_pool, _tiles.size() * _getTileBytes());
+		if (_zeroTile)
+			munmap(_zeroTile, _getTileBytes());
+	#endif
+	_data = nullptr;
+	for (uint8_t i = 0; i < WaterPlane::COUNT; ++i)
+		_planes[i] = nullptr;
+	_pool = nullptr;
+	_zeroTile = nullptr;
+	_tiles.clear();
+	_blockFree.clear();
+	_freeBlocks.clear();
+	_poolUsed = 0;
+	_nbResidentTiles = 0;
+}
+
+/**
+ * @brief Give the memory pages of a free block back to the system, but the
+ * ones shared with a used block (the blocks are not page aligned), the pool
+ * must be locked
+ *
+ * @param id the block id
+ */
+void	WaterGrid::_releaseBlock(uint32_t id) {
+	#ifndef _WIN32
+		size_t pageSize = sysconf(_SC_PAGESIZE);
+		size_t tileBytes = _getTileBytes();
+		// a page is released if all the blocks it holds are free
+		auto isPageFree = [&](size_t page) {
+			uint32_t lastBlock = std::min<size_t>((page + pageSize - 1) / tileBytes, _poolUsed - 1);
+			for (uint32_t b = page / tileBytes; b <= lastBlock; ++b) {
+				if (!_blockFree[b])
+					return false;
+			}
+			return true;
+		};
+		size_t start = static_cast<size_t>(id) * tileBytes / pageSize * pageSize;
+		size_t end = (static_cast<size_t>(id + 1) * tileBytes + pageSize - 1) / pageSize * pageSize;
+		if (start < end && !isPageFree(start))
+			start += pageSize;
+		if (start < end && !isPageFree(end - pageSize))
+			end -= pageSize;
+		if (start < end)
+			madvise(_pool + start, end - start, MADV_DONTNEED);
+	#else
+		(void)id;
+	#endif
+}
+
+/**
+ * @brief Get the bytes of a sparse grid tile block, all its planes
+ */
+size_t	WaterGrid::_getTileBytes() const {
+	return WATER_GRID_TILE_SIZE * WATER_GRID_TILE_SIZE * getCellBytes();
+}
+
+// -- getters ------------------------------------------------------------------
+uint32_t	WaterGrid::getWidth() const { return _width; }
+uint32_t	WaterGrid::getHeight() const { return _height; }
+uint32_t	WaterGrid::getStride() const { return _stride; }
+size_t		WaterGrid::getPlaneSize() const { return static_cast<size_t>(_stride) * _height; }
+/**
+ * @brief Get the bytes used by one cell of all the planes
+ */
+size_t		WaterGrid::getCellBytes() const {
+	return WaterPlane::TERRAIN_H * sizeof(WaterValue) + (WaterPlane::COUNT - WaterPlane::TERRAIN_H) * sizeof(float);
+}
+bool		WaterGrid::isSparse() const { return _sparse; }
+uint32_t	WaterGrid::getNbResidentTiles() const { return _nbResidentTiles; }
+/**
+ * @brief Get the memory used by the planes: all of them for a dense grid, the
+ * blocks of the resident tiles and the tiles index for a sparse one
+ */
+uint64_t	WaterGrid::getResidentBytes() const {
+	if (!_sparse)
+		return static_cast<uint64_t>(getPlaneSize()) * getCellBytes();
+	return static_cast<uint64_t>(_nbResidentTiles) * _getTileBytes() + _tiles.size() * sizeof(uint8_t *);
+}
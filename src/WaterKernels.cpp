@@ -0,0 +1,1077 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "WaterKernels.hpp"
+#include "mod1.hpp"
+#include "Logging.hpp"
+#include "Rng.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	#define WATER_KERNELS_X86 1
+	#include <immintrin.h>
+#else
+	#define WATER_KERNELS_X86 0
+#endif
+
+// the AVX2 kernels convert the half floats with F16C
+#if WATER_STORAGE == WATER_STORAGE_FP16
+	#define WATER_KERNELS_AVX2 "avx2,f16c"
+#else
+	#define WATER_KERNELS_AVX2 "avx2"
+#endif
+
+namespace WaterKernels {
+	// -- scalar ---------------------------------------------------------------
+
+	/**
+	 * @brief Update the flow of the pipe between a column and its left or top
+	 * neighbour (N), positive flow mean increasing the column water level
+	 */
+	static inline float	pipeFlow(float flow, float depth, float terrainH,
+		float depthN, float terrainHN, float csa, float acc, float dtTime)
+	{
+		// column water total height
+		float totalH = terrainH + depth;
+		float totalHN = terrainHN + depthN;
+
+		// if there is a wall, set the flow to 0
+		bool wallN = depthN == 0 && terrainHN > totalH;
+		bool wall = depth == 0 && terrainH > totalHN;
+		if (wallN || wall)
+			return 0.0;
+
+		float hDiff = 0.0;
+		float freeWaterH = 0.0;
+		if (totalH > totalHN) {
+			float totalHDiff = totalH - totalHN;
+			freeWaterH = totalHDiff > depth ? depth : totalHDiff;
+			hDiff = -freeWaterH;
+		}
+		else {
+			float totalHDiff = totalHN - totalH;
+			freeWaterH = totalHDiff > depthN ? depthN : totalHDiff;
+			hDiff = freeWaterH;
+		}
+		/*
+			pipeCSA is the cross-sectional area of the pipe
+			Artificially varying pipeCSA leads to an approximate method for modeling viscosity
+			(larger values make the water more lively).
+		*/
+		float pipeCSA = csa * freeWaterH;
+
+		return flow + pipeCSA * acc * hDiff * dtTime;
+	}
+
+	/**
+	 * @brief Scale a flow by the outflow scale factor of the column it leave,
+	 * negative flow leave the column, positive one leave its neighbour (N)
+	 */
+	static inline float	limitFlow(float flow, float outScale, float outScaleN) {
+		return flow * (flow < 0 ? outScale : outScaleN);
+	}
+
+	/**
+	 * @brief Flow leaving a column through its open border faces, the critical
+	 * flow of a free outfall: open * depth * sqrt(depth)
+	 */
+	static inline float	openFlow(float depth, float open) {
+		return open * depth * std::sqrt(depth);
+	}
+
+	/**
+	 * @brief Rows read by the limit and depth updates of a run of contiguous
+	 * cells of a row, the row pointers start at the run first column
+	 *
+	 * The periodic border wraps the first and last rows neighbours. The other
+	 * borders have no pipe there: the first row top flows are 0 and scaled by
+	 * the row itself, the last row has no bottom pipe. The run first and last
+	 * columns neighbours are outside the run, their values are read once.
+	 */
+	struct RowPipes {
+		WaterValue *		depth;
+		WaterValue const *	lFlow;
+		WaterValue const *	tFlow;
+		WaterValue const *	tFlowBottom;
+		float *				outScale;
+		float const *		outScaleTop;
+		float const *		outScaleBottom;
+		float				outScaleL;  /**< outflow scale factor of the run first column left neighbour */
+		float				lFlowR;  /**< left flow of the run last column right neighbour */
+		float				outScaleR;  /**< outflow scale factor of the run last column right neighbour */
+		uint32_t			first;  /**< run first column id */
+		uint32_t			nbCols;  /**< run columns */
+		uint32_t			lastU;  /**< last column id */
+		bool				bottom;  /**< the row has a bottom pipe */
+		float				open;  /**< open discharge factor of the row faces on the top or bottom border */
+	};
+
+	/**
+	 * @brief Get the pipes of the run holding the column u
+	 */
+	template <WaterBoundary::Enum B>
+	static inline RowPipes	rowPipes(WaterGrid & grid, uint32_t v, uint32_t u, FlowParams const & p) {
+		uint32_t lastV = grid.getHeight() - 1;
+		uint32_t vTop = v != 0 ? v - 1 : (B == WaterBoundary::PERIODIC ? lastV : v);
+		uint32_t vBottom = v != lastV ? v + 1 : (B == WaterBoundary::PERIODIC ? 0 : v);
+		RowPipes r;
+		r.first = grid.getRunStart(u);
+		r.nbCols = grid.getRunEnd(u) - r.first;
+		r.lastU = grid.getWidth() - 1;
+		r.depth = grid.cells(WaterPlane::DEPTH, r.first, v);
+		r.lFlow = grid.cells(WaterPlane::L_FLOW, r.first, v);
+		r.tFlow = grid.cells(WaterPlane::T_FLOW, r.first, v);
+		r.tFlowBottom = grid.cells(WaterPlane::T_FLOW, r.first, vBottom);
+		r.outScale = grid.row(WaterPlane::OUT_SCALE, r.first, v);
+		r.outScaleTop = grid.row(WaterPlane::OUT_SCALE, r.first, vTop);
+		r.outScaleBottom = grid.row(WaterPlane::OUT_SCALE, r.first, vBottom);
+		// the first column left pipe is scaled by the column itself on the
+		// non periodic borders, the last column has no right pipe
+		uint32_t uL = r.first != 0 ? r.first - 1 : (B == WaterBoundary::PERIODIC ? r.lastU : 0);
+		uint32_t uR = r.first + r.nbCols <= r.lastU ? r.first + r.nbCols : 0;
+		r.outScaleL = grid.at(WaterPlane::OUT_SCALE, uL, v);
+		r.lFlowR = grid.cell(WaterPlane::L_FLOW, uR, v);
+		r.outScaleR = grid.at(WaterPlane::OUT_SCALE, uR, v);
+		r.bottom = v != lastV || B == WaterBoundary::PERIODIC;
+		r.open = 0.0f;
+		if (B == WaterBoundary::OPEN)
+			r.open = p.openY * ((v == 0) + (v == lastV));
+		return r;
+	}
+
+	/**
+	 * @brief Update the left and top flow of the columns [uStart, uEnd[, in a
+	 * single run
+	 */
+	template <WaterBoundary::Enum B>
+	static inline void	flowCells(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, FlowParams const & p)
+	{
+		// the vector kernels tail can be empty, uStart is then past the run
+		if (uStart >= uEnd)
+			return;
+		uint32_t lastU = grid.getWidth() - 1;
+		uint32_t first = grid.getRunStart(uStart);
+		WaterValue const * depth = grid.cells(WaterPlane::DEPTH, first, v);
+		float const * terrainH = grid.row(WaterPlane::TERRAIN_H, first, v);
+		WaterValue * lFlow = grid.cells(WaterPlane::L_FLOW, first, v);
+		WaterValue * tFlow = grid.cells(WaterPlane::T_FLOW, first, v);
+		float const * outScale = grid.row(WaterPlane::OUT_SCALE, first, v);
+
+		// the run first column left pipe reaches the previous run, or crosses
+		// the border where only the periodic one has a neighbour: the last column
+		uint32_t i = uStart - first;
+		uint32_t iEnd = uEnd - first;
+		if (i == 0 && i < iEnd) {
+			float flow = 0.0f;
+			if (first != 0 || B == WaterBoundary::PERIODIC) {
+				uint32_t uL = first != 0 ? first - 1 : lastU;
+				flow = lFlow[0];
+				if (p.limited)
+					flow = limitFlow(flow, outScale[0], grid.at(WaterPlane::OUT_SCALE, uL, v));
+				flow = pipeFlow(flow, depth[0], terrainH[0],
+					grid.cell(WaterPlane::DEPTH, uL, v), grid.at(WaterPlane::TERRAIN_H, uL, v),
+					p.csaX, p.accX, dtTime);
+			}
+			lFlow[0] = flow;
+			i = 1;
+		}
+		for (; i < iEnd; ++i) {
+			float flow = lFlow[i];
+			if (p.limited)
+				flow = limitFlow(flow, outScale[i], outScale[i - 1]);
+			lFlow[i] = pipeFlow(flow, depth[i], terrainH[i],
+				depth[i - 1], terrainH[i - 1], p.csaX, p.accX, dtTime);
+		}
+
+		// the first row top pipes cross the border, same for the last row
+		if (v == 0 && B != WaterBoundary::PERIODIC) {
+			std::fill(tFlow + (uStart - first), tFlow + iEnd, 0.0f);
+			return;
+		}
+		uint32_t vTop = v != 0 ? v - 1 : grid.getHeight() - 1;
+		WaterValue const * depthTop = grid.cells(WaterPlane::DEPTH, first, vTop);
+		float const * terrainHTop = grid.row(WaterPlane::TERRAIN_H, first, vTop);
+		float const * outScaleTop = grid.row(WaterPlane::OUT_SCALE, first, vTop);
+		for (i = uStart - first; i < iEnd; ++i) {
+			float flow = tFlow[i];
+			if (p.limited)
+				flow = limitFlow(flow, outScale[i], outScaleTop[i]);
+			tFlow[i] = pipeFlow(flow, depth[i], terrainH[i],
+				depthTop[i], terrainHTop[i], p.csaY, p.accY, dtTime);
+		}
+		// right and bottom flow will be processed by right and bottom column update
+	}
+
+	/**
+	 * @brief Compute the outflow scale factor of the run column i, whose right
+	 * neighbour has the left flow lFlowR
+	 *
+	 * @tparam bottom the row has a bottom pipe
+	 * @tparam open the column has open border faces, of discharge factor open
+	 * @param right the column has a right pipe
+	 */
+	template <bool bottom, bool open>
+	static inline void	limitCell(RowPipes const & r, uint32_t i, float lFlowR, bool right, float openFactor,
+		float dtTime, float gridArea)
+	{
+		float outFlow = 0.0f;
+		outFlow += std::max(0.0f, -r.lFlow[i]);
+		outFlow += std::max(0.0f, -r.tFlow[i]);
+		if (right)
+			outFlow += std::max(0.0f, lFlowR);
+		if (bottom)
+			outFlow += std::max<float>(0.0f, r.tFlowBottom[i]);
+		if (open)
+			outFlow += openFlow(r.depth[i], openFactor);
+
+		float outDepth = (outFlow / gridArea) * dtTime;
+		r.outScale[i] = outDepth > r.depth[i] ? r.depth[i] / outDepth : 1.0f;
+	}
+
+	/**
+	 * @brief Update the depth of the run column i, from the outflow scale
+	 * factor of its left neighbour and the left flow and outflow scale factor
+	 * of its right one
+	 *
+	 * @tparam bottom the row has a bottom pipe
+	 * @tparam open the column has open border faces, of discharge factor open
+	 * @param right the column has a right pipe
+	 */
+	template <bool bottom, bool open>
+	static inline void	depthCell(RowPipes const & r, uint32_t i, float outScaleL, float lFlowR, float outScaleR,
+		bool right, float openFactor, float dtTime, float gridArea, bool limited)
+	{
+		float lF = r.lFlow[i];
+		float tF = r.tFlow[i];
+		float rF = right ? lFlowR : 0.0f;
+		float bF = bottom ? static_cast<float>(r.tFlowBottom[i]) : 0.0f;
+		float oF = open ? openFlow(r.depth[i], openFactor) : 0.0f;
+		if (limited) {
+			float k = r.outScale[i];
+			lF = limitFlow(lF, k, outScaleL);
+			tF = limitFlow(tF, k, r.outScaleTop[i]);
+			if (right)
+				rF = limitFlow(rF, outScaleR, k);
+			if (bottom)
+				bF = limitFlow(bF, r.outScaleBottom[i], k);
+			if (open)
+				oF *= k;
+		}
+
+		float totalFlow = 0.0;  // we store the total amount of flow here
+		// left flow
+		totalFlow += lF;
+		// top flow
+		totalFlow += tF;
+		// right flow
+		if (right)
+			totalFlow += -rF;
+		// bottom flow
+		if (bottom)
+			totalFlow += -bF;
+		// open border faces
+		if (open)
+			totalFlow += -oF;
+
+		// calculate the new depth
+		r.depth[i] += (totalFlow / gridArea) * dtTime;
+		// prevent the depth from going bellow 0
+		r.depth[i] = std::max<float>(0.0f, r.depth[i]);
+	}
+
+	/**
+	 * @brief Call cell(i, outScaleL, lFlowR, outScaleR, right, openFactor) on
+	 * the columns [uStart, uEnd[ of a run, with the run first and last columns
+	 * peeled
+	 *
+	 * The peeled columns read their neighbours outside the run from r. On
+	 * the grid borders they call borderCell: the first column left pipe is
+	 * stored 0 by the wall and open borders, it is scaled by the column
+	 * itself. The last column has a right pipe only on a periodic border, the
+	 * first column. The open border columns add the left and right faces
+	 * discharge to the row one.
+	 */
+	template <WaterBoundary::Enum B, typename BorderCell, typename Cell>
+	static inline void	forEachCell(RowPipes const & r, uint32_t uStart, uint32_t uEnd,
+		FlowParams const & p, BorderCell const & borderCell, Cell const & cell)
+	{
+		bool const periodic = B == WaterBoundary::PERIODIC;
+		float openX = B == WaterBoundary::OPEN ? p.openX : 0.0f;
+		uint32_t last = r.nbCols - 1;
+		auto edgeCell = [&r, &borderCell, &cell, periodic, openX, last](uint32_t i) {
+			uint32_t u = r.first + i;
+			float outScaleL = i != 0 ? r.outScale[i - 1] : r.outScaleL;
+			float lFlowR = i != last ? static_cast<float>(r.lFlow[i + 1]) : r.lFlowR;
+			float outScaleR = i != last ? r.outScale[i + 1] : r.outScaleR;
+			if (u == 0 || u == r.lastU)
+				borderCell(i, outScaleL, lFlowR, outScaleR, u != r.lastU || periodic, r.open + openX);
+			else
+				cell(i, outScaleL, lFlowR, outScaleR, true, r.open);
+		};
+
+		uint32_t i = uStart - r.first;
+		uint32_t iEnd = uEnd - r.first;
+		if (i == 0 && i < iEnd) {
+			edgeCell(0);
+			i = 1;
+		}
+		uint32_t iInEnd = std::min(iEnd, last);
+		for (; i < iInEnd; ++i)
+			cell(i, r.outScale[i - 1], r.lFlow[i + 1], r.outScale[i + 1], true, r.open);
+		if (i < iEnd)
+			edgeCell(i);
+	}
+
+	/**
+	 * @brief Compute the outflow scale factor of the columns [uStart, uEnd[
+	 */
+	template <WaterBoundary::Enum B, bool bottom, bool open>
+	static inline void	limitCells(RowPipes const & r, uint32_t uStart, uint32_t uEnd, float dtTime,
+		float gridArea, FlowParams const & p)
+	{
+		bool const openB = B == WaterBoundary::OPEN;
+		forEachCell<B>(r, uStart, uEnd, p,
+			[&r, dtTime, gridArea](uint32_t i, float, float lFlowR, float, bool right, float openFactor) {
+				limitCell<bottom, open || openB>(r, i, lFlowR, right, openFactor, dtTime, gridArea);
+			},
+			[&r, dtTime, gridArea](uint32_t i, float, float lFlowR, float, bool right, float openFactor) {
+				limitCell<bottom, open>(r, i, lFlowR, right, openFactor, dtTime, gridArea);
+			});
+	}
+
+	/**
+	 * @brief Update the depth of the columns [uStart, uEnd[
+	 */
+	template <WaterBoundary::Enum B, bool bottom, bool open>
+	static inline void	depthCells(RowPipes const & r, uint32_t uStart, uint32_t uEnd, float dtTime,
+		float gridArea, FlowParams const & p)
+	{
+		bool const openB = B == WaterBoundary::OPEN;
+		bool limited = p.limited;
+		forEachCell<B>(r, uStart, uEnd, p,
+			[&r, dtTime, gridArea, limited](uint32_t i, float outScaleL, float lFlowR, float outScaleR,
+				bool right, float openFactor) {
+				depthCell<bottom, open || openB>(r, i, outScaleL, lFlowR, outScaleR, right, openFactor,
+					dtTime, gridArea, limited);
+			},
+			[&r, dtTime, gridArea, limited](uint32_t i, float outScaleL, float lFlowR, float outScaleR,
+				bool right, float openFactor) {
+				depthCell<bottom, open>(r, i, outScaleL, lFlowR, outScaleR, right, openFactor,
+					dtTime, gridArea, limited);
+			});
+	}
+
+	/**
+	 * @brief Update the depth of the run columns [uStart, uEnd[, pick the cells
+	 * update according to the row borders
+	 */
+	template <WaterBoundary::Enum B>
+	static inline void	depthRowCells(RowPipes const & r, uint32_t uStart, uint32_t uEnd, float dtTime,
+		float gridArea, FlowParams const & p)
+	{
+		if (r.bottom && r.open == 0)
+			depthCells<B, true, false>(r, uStart, uEnd, dtTime, gridArea, p);
+		else if (r.bottom)
+			depthCells<B, true, true>(r, uStart, uEnd, dtTime, gridArea, p);
+		else if (r.open == 0)
+			depthCells<B, false, false>(r, uStart, uEnd, dtTime, gridArea, p);
+		else
+			depthCells<B, false, true>(r, uStart, uEnd, dtTime, gridArea, p);
+	}
+
+	/**
+	 * @brief Prefetch the cells of a sparse grid run two rows ahead, the passes
+	 * read up to the next row. Its tile blocks are too many streams for the
+	 * hardware prefetchers. Nothing without the GNU builtins.
+	 */
+	static inline void	prefetchRun(WaterGrid & grid, uint32_t v, uint32_t u) {
+		#if defined(__GNUC__)
+			if (!grid.isSparse() || v + 2 >= grid.getHeight())
+				return;
+			for (uint8_t plane = 0; plane < WaterPlane::COUNT; ++plane)
+				__builtin_prefetch(grid.row(static_cast<WaterPlane::Enum>(plane), u, v + 2));
+		#else
+			(void)grid;
+			(void)v;
+			(void)u;
+		#endif
+	}
+
+	/**
+	 * @brief Add the rain drops of the columns [uStart, uEnd[, a column gets a
+	 * drop if its random number is below threshold (24 bits)
+	 *
+	 * @param depth the cells of the columns [uStart, uEnd[
+	 * @return uint32_t the number of drops
+	 */
+	static inline uint32_t	rainCells(WaterValue * depth, uint32_t uStart, uint32_t uEnd, uint32_t key,
+		uint32_t threshold, float amount)
+	{
+		uint32_t nbDrops = 0;
+		for (uint32_t u = uStart; u < uEnd; ++u) {
+			bool drop = (Rng::at(key, u) >> 8) < threshold;
+			depth[u - uStart] += drop ? amount : 0.0f;
+			nbDrops += drop;
+		}
+		return nbDrops;
+	}
+
+	template <WaterBoundary::Enum B>
+	static void	flowRowScalar(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, FlowParams const & p)
+	{
+		for (uint32_t u = uStart; u < uEnd; u = grid.getRunEnd(u)) {
+			prefetchRun(grid, v, u);
+			flowCells<B>(grid, v, u, std::min(uEnd, grid.getRunEnd(u)), dtTime, p);
+		}
+	}
+
+	/**
+	 * @brief Compute the outflow scale factor of the row columns [uStart, uEnd[
+	 *
+	 * The factor is the part of the column outflows its water can supply during
+	 * dtTime, 1 if the column has enough water. Only read the flows, so the rows
+	 * can be processed in any order. Shared by all the kernels sets.
+	 */
+	template <WaterBoundary::Enum B>
+	static void	limitRowScalar(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, float gridArea, FlowParams const & p)
+	{
+		for (uint32_t u = uStart; u < uEnd; u = grid.getRunEnd(u)) {
+			prefetchRun(grid, v, u);
+			RowPipes r = rowPipes<B>(grid, v, u, p);
+			uint32_t runEnd = std::min(uEnd, r.first + r.nbCols);
+			if (r.bottom && r.open == 0)
+				limitCells<B, true, false>(r, u, runEnd, dtTime, gridArea, p);
+			else if (r.bottom)
+				limitCells<B, true, true>(r, u, runEnd, dtTime, gridArea, p);
+			else if (r.open == 0)
+				limitCells<B, false, false>(r, u, runEnd, dtTime, gridArea, p);
+			else
+				limitCells<B, false, true>(r, u, runEnd, dtTime, gridArea, p);
+		}
+	}
+
+	template <WaterBoundary::Enum B>
+	static void	depthRowScalar(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, float gridArea, FlowParams const & p)
+	{
+		for (uint32_t u = uStart; u < uEnd; u = grid.getRunEnd(u)) {
+			prefetchRun(grid, v, u);
+			depthRowCells<B>(rowPipes<B>(grid, v, u, p), u, std::min(uEnd, grid.getRunEnd(u)), dtTime, gridArea, p);
+		}
+	}
+
+	static uint32_t	rainRowScalar(WaterValue * depth, uint32_t uStart, uint32_t uEnd, uint32_t key,
+		uint32_t threshold, float amount)
+	{
+		return rainCells(depth, uStart, uEnd, key, threshold, amount);
+	}
+
+	#if WATER_KERNELS_X86
+	// -- storage, the state planes values to and from float vectors -----------
+
+	#if WATER_STORAGE == WATER_STORAGE_FP16
+	// no SSE2 half floats conversion, go through the scalar one
+	static inline __m128	loadSse2(WaterValue const * cells) {
+		return _mm_setr_ps(cells[0], cells[1], cells[2], cells[3]);
+	}
+
+	static inline void	storeSse2(WaterValue * cells, __m128 values) {
+		alignas(16) float tmp[4];
+		_mm_store_ps(tmp, values);
+		std::copy_n(tmp, 4, cells);
+	}
+
+	__attribute__((target(WATER_KERNELS_AVX2), always_inline))
+	static inline __m256	loadAvx2(WaterValue const * cells) {
+		return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<__m128i const *>(cells)));
+	}
+
+	__attribute__((target(WATER_KERNELS_AVX2), always_inline))
+	static inline void	storeAvx2(WaterValue * cells, __m256 values) {
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(cells),
+			_mm256_cvtps_ph(values, _MM_FROUND_TO_NEAREST_INT));
+	}
+	#elif WATER_STORAGE == WATER_STORAGE_FIXED
+	static inline __m128	loadSse2(WaterValue const * cells) {
+		__m128i fixed = _mm_loadu_si128(reinterpret_cast<__m128i const *>(cells));
+		return _mm_mul_ps(_mm_cvtepi32_ps(fixed), _mm_set1_ps(WATER_FIXED_STEP));
+	}
+
+	// saturated as WaterStorage::floatToFixed
+	static inline void	storeSse2(WaterValue * cells, __m128 values) {
+		__m128 scaled = _mm_mul_ps(values, _mm_set1_ps(1 << WATER_FIXED_FRAC_BITS));
+		scaled = _mm_min_ps(_mm_max_ps(scaled, _mm_set1_ps(WATER_FIXED_MIN)), _mm_set1_ps(WATER_FIXED_MAX));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(cells), _mm_cvtps_epi32(scaled));
+	}
+
+	__attribute__((target(WATER_KERNELS_AVX2), always_inline))
+	static inline __m256	loadAvx2(WaterValue const * cells) {
+		__m256i fixed = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(cells));
+		return _mm256_mul_ps(_mm256_cvtepi32_ps(fixed), _mm256_set1_ps(WATER_FIXED_STEP));
+	}
+
+	__attribute__((target(WATER_KERNELS_AVX2), always_inline))
+	static inline void	storeAvx2(WaterValue * cells, __m256 values) {
+		__m256 scaled = _mm256_mul_ps(values, _mm256_set1_ps(1 << WATER_FIXED_FRAC_BITS));
+		scaled = _mm256_min_ps(_mm256_max_ps(scaled, _mm256_set1_ps(WATER_FIXED_MIN)),
+			_mm256_set1_ps(WATER_FIXED_MAX));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(cells), _mm256_cvtps_epi32(scaled));
+	}
+	#else
+	static inline __m128	loadSse2(WaterValue const * cells) { return _mm_loadu_ps(cells); }
+	static inline void	storeSse2(WaterValue * cells, __m128 values) { _mm_storeu_ps(cells, values); }
+
+	__attribute__((target(WATER_KERNELS_AVX2), always_inline))
+	static inline __m256	loadAvx2(WaterValue const * cells) { return _mm256_loadu_ps(cells); }
+
+	__attribute__((target(WATER_KERNELS_AVX2), always_inline))
+	static inline void	storeAvx2(WaterValue * cells, __m256 values) { _mm256_storeu_ps(cells, values); }
+	#endif
+
+	// -- SSE2, 4 columns at a time --------------------------------------------
+
+	// mask ? b : a
+	static inline __m128	selectSse2(__m128 mask, __m128 a, __m128 b) {
+		return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+	}
+
+	static inline __m128	pipeFlowSse2(__m128 flow, __m128 depth, __m128 terrainH,
+		__m128 depthN, __m128 terrainHN, __m128 csa, __m128 acc, __m128 dtTime)
+	{
+		__m128 zero = _mm_setzero_ps();
+		__m128 totalH = _mm_add_ps(terrainH, depth);
+		__m128 totalHN = _mm_add_ps(terrainHN, depthN);
+
+		__m128 wall = _mm_or_ps(
+			_mm_and_ps(_mm_cmpeq_ps(depthN, zero), _mm_cmpgt_ps(terrainHN, totalH)),
+			_mm_and_ps(_mm_cmpeq_ps(depth, zero), _mm_cmpgt_ps(terrainH, totalHN)));
+
+		// both free water height, then keep the one of the higher column
+		__m128 outMask = _mm_cmpgt_ps(totalH, totalHN);
+		__m128 diffOut = _mm_sub_ps(totalH, totalHN);
+		__m128 freeOut = selectSse2(_mm_cmpgt_ps(diffOut, depth), diffOut, depth);
+		__m128 diffIn = _mm_sub_ps(totalHN, totalH);
+		__m128 freeIn = selectSse2(_mm_cmpgt_ps(diffIn, depthN), diffIn, depthN);
+		__m128 freeWaterH = selectSse2(outMask, freeIn, freeOut);
+		__m128 hDiff = selectSse2(outMask, freeIn, _mm_xor_ps(freeOut, _mm_set1_ps(-0.0f)));
+
+		__m128 pipeCSA = _mm_mul_ps(csa, freeWaterH);
+		__m128 newFlow = _mm_add_ps(flow,
+			_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(pipeCSA, acc), hDiff), dtTime));
+		return _mm_andnot_ps(wall, newFlow);
+	}
+
+	static inline __m128	limitFlowSse2(__m128 flow, __m128 outScale, __m128 outScaleN) {
+		return _mm_mul_ps(flow, selectSse2(_mm_cmplt_ps(flow, _mm_setzero_ps()), outScaleN, outScale));
+	}
+
+	// the values of the previous columns, prev the one before the first column
+	static inline __m128	prevColsSse2(__m128 values, float prev) {
+		return _mm_move_ss(_mm_shuffle_ps(values, values, _MM_SHUFFLE(2, 1, 0, 0)), _mm_set_ss(prev));
+	}
+
+	// the values of the next columns, next the one after the last column
+	static inline __m128	nextColsSse2(__m128 values, float next) {
+		__m128 last = _mm_move_ss(values, _mm_set_ss(next));
+		return _mm_shuffle_ps(last, last, _MM_SHUFFLE(0, 3, 2, 1));
+	}
+
+	template <WaterBoundary::Enum B>
+	static void	flowRunSse2(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, FlowParams const & p)
+	{
+		uint32_t first = grid.getRunStart(uStart);
+		WaterValue const * depth = grid.cells(WaterPlane::DEPTH, first, v);
+		float const * terrainH = grid.row(WaterPlane::TERRAIN_H, first, v);
+		WaterValue * lFlow = grid.cells(WaterPlane::L_FLOW, first, v);
+		WaterValue * tFlow = grid.cells(WaterPlane::T_FLOW, first, v);
+		float const * outScale = grid.row(WaterPlane::OUT_SCALE, first, v);
+		__m128 csaX = _mm_set1_ps(p.csaX), accX = _mm_set1_ps(p.accX);
+		__m128 csaY = _mm_set1_ps(p.csaY), accY = _mm_set1_ps(p.accY);
+		__m128 dt = _mm_set1_ps(dtTime);
+
+		// the grid first column left pipe crosses the border, start the vectors
+		// after it. The other runs first column left neighbour ends the
+		// previous run.
+		uint32_t i = uStart - first;
+		uint32_t iEnd = uEnd - first;
+		if (first == 0 && i == 0 && i < iEnd) {
+			flowCells<B>(grid, v, first, first + 1, dtTime, p);
+			i = 1;
+		}
+		uint32_t uL = first != 0 ? first - 1 : 0;
+		float depthL = grid.cell(WaterPlane::DEPTH, uL, v);
+		float terrainHL = grid.at(WaterPlane::TERRAIN_H, uL, v);
+		float outScaleL = grid.at(WaterPlane::OUT_SCALE, uL, v);
+		if (v == 0 && B != WaterBoundary::PERIODIC) {
+			for (; i + 4 <= iEnd; i += 4) {
+				__m128 d = loadSse2(depth + i);
+				__m128 tH = _mm_loadu_ps(terrainH + i);
+				__m128 lF = loadSse2(lFlow + i);
+				if (p.limited) {
+					__m128 k = _mm_loadu_ps(outScale + i);
+					lF = limitFlowSse2(lF, k, i != 0 ? _mm_loadu_ps(outScale + i - 1) : prevColsSse2(k, outScaleL));
+				}
+				__m128 dL = i != 0 ? loadSse2(depth + i - 1) : prevColsSse2(d, depthL);
+				__m128 tHL = i != 0 ? _mm_loadu_ps(terrainH + i - 1) : prevColsSse2(tH, terrainHL);
+				storeSse2(lFlow + i, pipeFlowSse2(lF, d, tH, dL, tHL, csaX, accX, dt));
+				storeSse2(tFlow + i, _mm_setzero_ps());
+			}
+		}
+		else {
+			uint32_t vTop = v != 0 ? v - 1 : grid.getHeight() - 1;
+			WaterValue const * depthTop = grid.cells(WaterPlane::DEPTH, first, vTop);
+			float const * terrainHTop = grid.row(WaterPlane::TERRAIN_H, first, vTop);
+			float const * outScaleTop = grid.row(WaterPlane::OUT_SCALE, first, vTop);
+			for (; i + 4 <= iEnd; i += 4) {
+				__m128 d = loadSse2(depth + i);
+				__m128 tH = _mm_loadu_ps(terrainH + i);
+				__m128 lF = loadSse2(lFlow + i);
+				__m128 tF = loadSse2(tFlow + i);
+				if (p.limited) {
+					__m128 k = _mm_loadu_ps(outScale + i);
+					lF = limitFlowSse2(lF, k, i != 0 ? _mm_loadu_ps(outScale + i - 1) : prevColsSse2(k, outScaleL));
+					tF = limitFlowSse2(tF, k, _mm_loadu_ps(outScaleTop + i));
+				}
+				__m128 dL = i != 0 ? loadSse2(depth + i - 1) : prevColsSse2(d, depthL);
+				__m128 tHL = i != 0 ? _mm_loadu_ps(terrainH + i - 1) : prevColsSse2(tH, terrainHL);
+				storeSse2(lFlow + i, pipeFlowSse2(lF, d, tH, dL, tHL, csaX, accX, dt));
+				storeSse2(tFlow + i, pipeFlowSse2(tF, d, tH,
+					loadSse2(depthTop + i), _mm_loadu_ps(terrainHTop + i), csaY, accY, dt));
+			}
+		}
+		flowCells<B>(grid, v, first + i, uEnd, dtTime, p);
+	}
+
+	template <WaterBoundary::Enum B>
+	static void	depthRunSse2(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, float gridArea, FlowParams const & p)
+	{
+		RowPipes r = rowPipes<B>(grid, v, uStart, p);
+		// every column of an open border row has a discharge, keep them scalar
+		if (r.open != 0) {
+			depthRowCells<B>(r, uStart, uEnd, dtTime, gridArea, p);
+			return;
+		}
+		// the grid first and last columns pipes cross the borders, keep them
+		// scalar. The other runs edges neighbours are in the next runs.
+		uint32_t iEnd = uEnd - r.first;
+		uint32_t iVecEnd = r.first + r.nbCols <= r.lastU ? iEnd : std::min(iEnd, r.nbCols - 1);
+		__m128 zero = _mm_setzero_ps();
+		__m128 area = _mm_set1_ps(gridArea);
+		__m128 dt = _mm_set1_ps(dtTime);
+
+		uint32_t i = uStart - r.first;
+		if (r.first == 0 && i == 0 && i < iEnd) {
+			depthRowCells<B>(r, r.first, r.first + 1, dtTime, gridArea, p);
+			i = 1;
+		}
+		for (; i + 4 <= iVecEnd; i += 4) {
+			__m128 lF = loadSse2(r.lFlow + i);
+			__m128 tF = loadSse2(r.tFlow + i);
+			__m128 rF = i + 4 < r.nbCols ? loadSse2(r.lFlow + i + 1) : nextColsSse2(lF, r.lFlowR);
+			__m128 bF = loadSse2(r.tFlowBottom + i);
+			if (p.limited) {
+				__m128 k = _mm_loadu_ps(r.outScale + i);
+				__m128 kL = i != 0 ? _mm_loadu_ps(r.outScale + i - 1) : prevColsSse2(k, r.outScaleL);
+				__m128 kR = i + 4 < r.nbCols ? _mm_loadu_ps(r.outScale + i + 1) : nextColsSse2(k, r.outScaleR);
+				lF = limitFlowSse2(lF, k, kL);
+				tF = limitFlowSse2(tF, k, _mm_loadu_ps(r.outScaleTop + i));
+				rF = limitFlowSse2(rF, kR, k);
+				bF = limitFlowSse2(bF, _mm_loadu_ps(r.outScaleBottom + i), k);
+			}
+			__m128 totalFlow = _mm_sub_ps(_mm_add_ps(lF, tF), rF);
+			if (r.bottom)
+				totalFlow = _mm_sub_ps(totalFlow, bF);
+			__m128 d = _mm_add_ps(loadSse2(r.depth + i),
+				_mm_mul_ps(_mm_div_ps(totalFlow, area), dt));
+			storeSse2(r.depth + i, _mm_max_ps(d, zero));
+		}
+		depthRowCells<B>(r, r.first + i, uEnd, dtTime, gridArea, p);
+	}
+
+	template <WaterBoundary::Enum B>
+	static void	flowRowSse2(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, FlowParams const & p)
+	{
+		for (uint32_t u = uStart; u < uEnd; u = grid.getRunEnd(u)) {
+			prefetchRun(grid, v, u);
+			flowRunSse2<B>(grid, v, u, std::min(uEnd, grid.getRunEnd(u)), dtTime, p);
+		}
+	}
+
+	template <WaterBoundary::Enum B>
+	static void	depthRowSse2(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, float gridArea, FlowParams const & p)
+	{
+		for (uint32_t u = uStart; u < uEnd; u = grid.getRunEnd(u)) {
+			prefetchRun(grid, v, u);
+			depthRunSse2<B>(grid, v, u, std::min(uEnd, grid.getRunEnd(u)), dtTime, gridArea, p);
+		}
+	}
+
+	// SSE2 has no 32 bits multiply, multiply the even then the odd lanes
+	static inline __m128i	mulloSse2(__m128i a, __m128i b) {
+		__m128i even = _mm_mul_epu32(a, b);
+		__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+		return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	}
+
+	// Rng::mix32 of 4 values
+	static inline __m128i	mix32Sse2(__m128i x) {
+		x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+		x = mulloSse2(x, _mm_set1_epi32(static_cast<int>(0x7feb352du)));
+		x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+		x = mulloSse2(x, _mm_set1_epi32(static_cast<int>(0x846ca68bu)));
+		return _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+	}
+
+	static uint32_t	rainRowSse2(WaterValue * depth, uint32_t uStart, uint32_t uEnd, uint32_t key,
+		uint32_t threshold, float amount)
+	{
+		// the 24 bits values compare as signed integers
+		__m128i thres = _mm_set1_epi32(threshold);
+		__m128 amountV = _mm_set1_ps(amount);
+		__m128i counter = _mm_add_epi32(_mm_set1_epi32(key + uStart), _mm_setr_epi32(0, 1, 2, 3));
+		uint32_t nbDrops = 0;
+
+		uint32_t i = 0;
+		for (; i + 4 <= uEnd - uStart; i += 4) {
+			__m128i random = _mm_srli_epi32(mix32Sse2(counter), 8);
+			__m128 drop = _mm_castsi128_ps(_mm_cmplt_epi32(random, thres));
+			storeSse2(depth + i, _mm_add_ps(loadSse2(depth + i), _mm_and_ps(drop, amountV)));
+			nbDrops += __builtin_popcount(_mm_movemask_ps(drop));
+			counter = _mm_add_epi32(counter, _mm_set1_epi32(4));
+		}
+		return nbDrops + rainCells(depth + i, uStart + i, uEnd, key, threshold, amount);
+	}
+
+	// -- AVX2, 8 columns at a time --------------------------------------------
+
+	__attribute__((target(WATER_KERNELS_AVX2), always_inline))
+	static inline __m256	pipeFlowAvx2(__m256 flow, __m256 depth, __m256 terrainH,
+		__m256 depthN, __m256 terrainHN, __m256 csa, __m256 acc, __m256 dtTime)
+	{
+		__m256 zero = _mm256_setzero_ps();
+		__m256 totalH = _mm256_add_ps(terrainH, depth);
+		__m256 totalHN = _mm256_add_ps(terrainHN, depthN);
+
+		__m256 wall = _mm256_or_ps(
+			_mm256_and_ps(_mm256_cmp_ps(depthN, zero, _CMP_EQ_OQ),
+				_mm256_cmp_ps(terrainHN, totalH, _CMP_GT_OQ)),
+			_mm256_and_ps(_mm256_cmp_ps(depth, zero, _CMP_EQ_OQ),
+				_mm256_cmp_ps(terrainH, totalHN, _CMP_GT_OQ)));
+
+		// both free water height, then keep the one of the higher column
+		__m256 outMask = _mm256_cmp_ps(totalH, totalHN, _CMP_GT_OQ);
+		__m256 diffOut = _mm256_sub_ps(totalH, totalHN);
+		__m256 freeOut = _mm256_blendv_ps(diffOut, depth, _mm256_cmp_ps(diffOut, depth, _CMP_GT_OQ));
+		__m256 diffIn = _mm256_sub_ps(totalHN, totalH);
+		__m256 freeIn = _mm256_blendv_ps(diffIn, depthN, _mm256_cmp_ps(diffIn, depthN, _CMP_GT_OQ));
+		__m256 freeWaterH = _mm256_blendv_ps(freeIn, freeOut, outMask);
+		__m256 hDiff = _mm256_blendv_ps(freeIn, _mm256_xor_ps(freeOut, _mm256_set1_ps(-0.0f)), outMask);
+
+		__m256 pipeCSA = _mm256_mul_ps(csa, freeWaterH);
+		__m256 newFlow = _mm256_add_ps(flow,
+			_mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(pipeCSA, acc), hDiff), dtTime));
+		return _mm256_andnot_ps(wall, newFlow);
+	}
+
+	__attribute__((target(WATER_KERNELS_AVX2), always_inline))
+	static inline __m256	limitFlowAvx2(__m256 flow, __m256 outScale, __m256 outScaleN) {
+		return _mm256_mul_ps(flow, _mm256_blendv_ps(outScaleN, outScale,
+			_mm256_cmp_ps(flow, _mm256_setzero_ps(), _CMP_LT_OQ)));
+	}
+
+	// the values of the previous columns, prev the one before the first column
+	__attribute__((target(WATER_KERNELS_AVX2), always_inline))
+	static inline __m256	prevColsAvx2(__m256 values, float prev) {
+		__m256 shifted = _mm256_permutevar8x32_ps(values, _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6));
+		return _mm256_blend_ps(shifted, _mm256_set1_ps(prev), 0x01);
+	}
+
+	// the values of the next columns, next the one after the last column
+	__attribute__((target(WATER_KERNELS_AVX2), always_inline))
+	static inline __m256	nextColsAvx2(__m256 values, float next) {
+		__m256 shifted = _mm256_permutevar8x32_ps(values, _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 7));
+		return _mm256_blend_ps(shifted, _mm256_set1_ps(next), 0x80);
+	}
+
+	template <WaterBoundary::Enum B>
+	__attribute__((target(WATER_KERNELS_AVX2)))
+	static void	flowRunAvx2(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, FlowParams const & p)
+	{
+		uint32_t first = grid.getRunStart(uStart);
+		WaterValue const * depth = grid.cells(WaterPlane::DEPTH, first, v);
+		float const * terrainH = grid.row(WaterPlane::TERRAIN_H, first, v);
+		WaterValue * lFlow = grid.cells(WaterPlane::L_FLOW, first, v);
+		WaterValue * tFlow = grid.cells(WaterPlane::T_FLOW, first, v);
+		float const * outScale = grid.row(WaterPlane::OUT_SCALE, first, v);
+		__m256 csaX = _mm256_set1_ps(p.csaX), accX = _mm256_set1_ps(p.accX);
+		__m256 csaY = _mm256_set1_ps(p.csaY), accY = _mm256_set1_ps(p.accY);
+		__m256 dt = _mm256_set1_ps(dtTime);
+
+		// the grid first column left pipe crosses the border, start the vectors
+		// after it. The other runs first column left neighbour ends the
+		// previous run.
+		uint32_t i = uStart - first;
+		uint32_t iEnd = uEnd - first;
+		if (first == 0 && i == 0 && i < iEnd) {
+			flowCells<B>(grid, v, first, first + 1, dtTime, p);
+			i = 1;
+		}
+		uint32_t uL = first != 0 ? first - 1 : 0;
+		float depthL = grid.cell(WaterPlane::DEPTH, uL, v);
+		float terrainHL = grid.at(WaterPlane::TERRAIN_H, uL, v);
+		float outScaleL = grid.at(WaterPlane::OUT_SCALE, uL, v);
+		if (v == 0 && B != WaterBoundary::PERIODIC) {
+			for (; i + 8 <= iEnd; i += 8) {
+				__m256 d = loadAvx2(depth + i);
+				__m256 tH = _mm256_loadu_ps(terrainH + i);
+				__m256 lF = loadAvx2(lFlow + i);
+				if (p.limited) {
+					__m256 k = _mm256_loadu_ps(outScale + i);
+					lF = limitFlowAvx2(lF, k, i != 0 ? _mm256_loadu_ps(outScale + i - 1) : prevColsAvx2(k, outScaleL));
+				}
+				__m256 dL = i != 0 ? loadAvx2(depth + i - 1) : prevColsAvx2(d, depthL);
+				__m256 tHL = i != 0 ? _mm256_loadu_ps(terrainH + i - 1) : prevColsAvx2(tH, terrainHL);
+				storeAvx2(lFlow + i, pipeFlowAvx2(lF, d, tH, dL, tHL, csaX, accX, dt));
+				storeAvx2(tFlow + i, _mm256_setzero_ps());
+			}
+		}
+		else {
+			uint32_t vTop = v != 0 ? v - 1 : grid.getHeight() - 1;
+			WaterValue const * depthTop = grid.cells(WaterPlane::DEPTH, first, vTop);
+			float const * terrainHTop = grid.row(WaterPlane::TERRAIN_H, first, vTop);
+			float const * outScaleTop = grid.row(WaterPlane::OUT_SCALE, first, vTop);
+			for (; i + 8 <= iEnd; i += 8) {
+				__m256 d = loadAvx2(depth + i);
+				__m256 tH = _mm256_loadu_ps(terrainH + i);
+				__m256 lF = loadAvx2(lFlow + i);
+				__m256 tF = loadAvx2(tFlow + i);
+				if (p.limited) {
+					__m256 k = _mm256_loadu_ps(outScale + i);
+					lF = limitFlowAvx2(lF, k, i != 0 ? _mm256_loadu_ps(outScale + i - 1) : prevColsAvx2(k, outScaleL));
+					tF = limitFlowAvx2(tF, k, _mm256_loadu_ps(outScaleTop + i));
+				}
+				__m256 dL = i != 0 ? loadAvx2(depth + i - 1) : prevColsAvx2(d, depthL);
+				__m256 tHL = i != 0 ? _mm256_loadu_ps(terrainH + i - 1) : prevColsAvx2(tH, terrainHL);
+				storeAvx2(lFlow + i, pipeFlowAvx2(lF, d, tH, dL, tHL, csaX, accX, dt));
+				storeAvx2(tFlow + i, pipeFlowAvx2(tF, d, tH,
+					loadAvx2(depthTop + i), _mm256_loadu_ps(terrainHTop + i), csaY, accY, dt));
+			}
+		}
+		flowCells<B>(grid, v, first + i, uEnd, dtTime, p);
+	}
+
+	template <WaterBoundary::Enum B>
+	__attribute__((target(WATER_KERNELS_AVX2)))
+	static void	depthRunAvx2(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, float gridArea, FlowParams const & p)
+	{
+		RowPipes r = rowPipes<B>(grid, v, uStart, p);
+		// every column of an open border row has a discharge, keep them scalar
+		if (r.open != 0) {
+			depthRowCells<B>(r, uStart, uEnd, dtTime, gridArea, p);
+			return;
+		}
+		// the grid first and last columns pipes cross the borders, keep them
+		// scalar. The other runs edges neighbours are in the next runs.
+		uint32_t iEnd = uEnd - r.first;
+		uint32_t iVecEnd = r.first + r.nbCols <= r.lastU ? iEnd : std::min(iEnd, r.nbCols - 1);
+		__m256 zero = _mm256_setzero_ps();
+		__m256 area = _mm256_set1_ps(gridArea);
+		__m256 dt = _mm256_set1_ps(dtTime);
+
+		uint32_t i = uStart - r.first;
+		if (r.first == 0 && i == 0 && i < iEnd) {
+			depthRowCells<B>(r, r.first, r.first + 1, dtTime, gridArea, p);
+			i = 1;
+		}
+		if (p.limited) {
+			for (; i + 8 <= iVecEnd; i += 8) {
+				__m256 k = _mm256_loadu_ps(r.outScale + i);
+				__m256 kL = i != 0 ? _mm256_loadu_ps(r.outScale + i - 1) : prevColsAvx2(k, r.outScaleL);
+				__m256 kR = i + 8 < r.nbCols ? _mm256_loadu_ps(r.outScale + i + 1) : nextColsAvx2(k, r.outScaleR);
+				__m256 lF = loadAvx2(r.lFlow + i);
+				__m256 rF = i + 8 < r.nbCols ? loadAvx2(r.lFlow + i + 1) : nextColsAvx2(lF, r.lFlowR);
+				lF = limitFlowAvx2(lF, k, kL);
+				__m256 tF = limitFlowAvx2(loadAvx2(r.tFlow + i), k, _mm256_loadu_ps(r.outScaleTop + i));
+				rF = limitFlowAvx2(rF, kR, k);
+				__m256 totalFlow = _mm256_sub_ps(_mm256_add_ps(lF, tF), rF);
+				if (r.bottom) {
+					totalFlow = _mm256_sub_ps(totalFlow, limitFlowAvx2(loadAvx2(r.tFlowBottom + i),
+						_mm256_loadu_ps(r.outScaleBottom + i), k));
+				}
+				__m256 d = _mm256_add_ps(loadAvx2(r.depth + i),
+					_mm256_mul_ps(_mm256_div_ps(totalFlow, area), dt));
+				storeAvx2(r.depth + i, _mm256_max_ps(d, zero));
+			}
+		}
+		else {
+			for (; i + 8 <= iVecEnd; i += 8) {
+				__m256 lF = loadAvx2(r.lFlow + i);
+				__m256 rF = i + 8 < r.nbCols ? loadAvx2(r.lFlow + i + 1) : nextColsAvx2(lF, r.lFlowR);
+				__m256 totalFlow = _mm256_add_ps(lF, loadAvx2(r.tFlow + i));
+				totalFlow = _mm256_sub_ps(totalFlow, rF);
+				if (r.bottom)
+					totalFlow = _mm256_sub_ps(totalFlow, loadAvx2(r.tFlowBottom + i));
+				__m256 d = _mm256_add_ps(loadAvx2(r.depth + i),
+					_mm256_mul_ps(_mm256_div_ps(totalFlow, area), dt));
+				storeAvx2(r.depth + i, _mm256_max_ps(d, zero));
+			}
+		}
+		depthRowCells<B>(r, r.first + i, uEnd, dtTime, gridArea, p);
+	}
+
+	template <WaterBoundary::Enum B>
+	__attribute__((target(WATER_KERNELS_AVX2)))
+	static void	flowRowAvx2(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, FlowParams const & p)
+	{
+		for (uint32_t u = uStart; u < uEnd; u = grid.getRunEnd(u)) {
+			prefetchRun(grid, v, u);
+			flowRunAvx2<B>(grid, v, u, std::min(uEnd, grid.getRunEnd(u)), dtTime, p);
+		}
+	}
+
+	template <WaterBoundary::Enum B>
+	__attribute__((target(WATER_KERNELS_AVX2)))
+	static void	depthRowAvx2(WaterGrid & grid, uint32_t v, uint32_t uStart, uint32_t uEnd,
+		float dtTime, float gridArea, FlowParams const & p)
+	{
+		for (uint32_t u = uStart; u < uEnd; u = grid.getRunEnd(u)) {
+			prefetchRun(grid, v, u);
+			depthRunAvx2<B>(grid, v, u, std::min(uEnd, grid.getRunEnd(u)), dtTime, gridArea, p);
+		}
+	}
+
+	// Rng::mix32 of 8 values
+	__attribute__((target(WATER_KERNELS_AVX2), always_inline))
+	static inline __m256i	mix32Avx2(__m256i x) {
+		x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+		x = _mm256_mullo_epi32(x, _mm256_set1_epi32(static_cast<int>(0x7feb352du)));
+		x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+		x = _mm256_mullo_epi32(x, _mm256_set1_epi32(static_cast<int>(0x846ca68bu)));
+		return _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+	}
+
+	__attribute__((target(WATER_KERNELS_AVX2)))
+	static uint32_t	rainRowAvx2(WaterValue * depth, uint32_t uStart, uint32_t uEnd, uint32_t key,
+		uint32_t threshold, float amount)
+	{
+		// the 24 bits values compare as signed integers
+		__m256i thres = _mm256_set1_epi32(threshold);
+		__m256 amountV = _mm256_set1_ps(amount);
+		__m256i counter = _mm256_add_epi32(_mm256_set1_epi32(key + uStart),
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		uint32_t nbDrops = 0;
+
+		uint32_t i = 0;
+		for (; i + 8 <= uEnd - uStart; i += 8) {
+			__m256i random = _mm256_srli_epi32(mix32Avx2(counter), 8);
+			__m256 drop = _mm256_castsi256_ps(_mm256_cmpgt_epi32(thres, random));
+			storeAvx2(depth + i, _mm256_add_ps(loadAvx2(depth + i),
+				_mm256_and_ps(drop, amountV)));
+			nbDrops += __builtin_popcount(_mm256_movemask_ps(drop));
+			counter = _mm256_add_epi32(counter, _mm256_set1_epi32(8));
+		}
+		return nbDrops + rainCells(depth + i, uStart + i, uEnd, key, threshold, amount);
+	}
+	#endif  // WATER_KERNELS_X86
+
+	// -- dispatch -------------------------------------------------------------
+
+	// one set per WaterBoundary, the limit update is scalar in all of them
+	static Kernels const	scalarKernels[WaterBoundary::COUNT] = {
+		{"scalar", WaterBoundary::WALL, flowRowScalar<WaterBoundary::WALL>,
+			limitRowScalar<WaterBoundary::WALL>, depthRowScalar<WaterBoundary::WALL>, rainRowScalar},
+		{"scalar", WaterBoundary::OPEN, flowRowScalar<WaterBoundary::OPEN>,
+			limitRowScalar<WaterBoundary::OPEN>, depthRowScalar<WaterBoundary::OPEN>, rainRowScalar},
+		{"scalar", WaterBoundary::PERIODIC, flowRowScalar<WaterBoundary::PERIODIC>,
+			limitRowScalar<WaterBoundary::PERIODIC>, depthRowScalar<WaterBoundary::PERIODIC>, rainRowScalar},
+	};
+	#if WATER_KERNELS_X86
+	static Kernels const	sse2Kernels[WaterBoundary::COUNT] = {
+		{"sse2", WaterBoundary::WALL, flowRowSse2<WaterBoundary::WALL>,
+			limitRowScalar<WaterBoundary::WALL>, depthRowSse2<WaterBoundary::WALL>, rainRowSse2},
+		{"sse2", WaterBoundary::OPEN, flowRowSse2<WaterBoundary::OPEN>,
+			limitRowScalar<WaterBoundary::OPEN>, depthRowSse2<WaterBoundary::OPEN>, rainRowSse2},
+		{"sse2", WaterBoundary::PERIODIC, flowRowSse2<WaterBoundary::PERIODIC>,
+			limitRowScalar<WaterBoundary::PERIODIC>, depthRowSse2<WaterBoundary::PERIODIC>, rainRowSse2},
+	};
+	static Kernels const	avx2Kernels[WaterBoundary::COUNT] = {
+		{"avx2", WaterBoundary::WALL, flowRowAvx2<WaterBoundary::WALL>,
+			limitRowScalar<WaterBoundary::WALL>, depthRowAvx2<WaterBoundary::WALL>, rainRowAvx2},
+		{"avx2", WaterBoundary::OPEN, flowRowAvx2<WaterBoundary::OPEN>,
+			limitRowScalar<WaterBoundary::OPEN>, depthRowAvx2<WaterBoundary::OPEN>, rainRowAvx2},
+		{"avx2", WaterBoundary::PERIODIC, flowRowAvx2<WaterBoundary::PERIODIC>,
+			limitRowScalar<WaterBoundary::PERIODIC>, depthRowAvx2<WaterBoundary::PERIODIC>, rainRowAvx2},
+	};
+	#endif
+
+	static Kernels const *	select() {
+		Kernels const * kernels = scalarKernels;
+
+		#if WATER_KERNELS_X86
+		if (s.j("simulation").b("simd")) {
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2")
+				&& (WATER_STORAGE != WATER_STORAGE_FP16 || __builtin_cpu_supports("f16c")))
+				kernels = avx2Kernels;
+			else if (__builtin_cpu_supports("sse2"))
+				kernels = sse2Kernels;
+		}
+		#endif
+
+		logInfo("water kernels: " << kernels->name);
+		return kernels;
+	}
+
+	/**
+	 * @brief Get the scalar kernels, reference for the vectorized ones
+	 *
+	 * @param boundary the border pipes handled by the kernels
+	 * @return Kernels const& scalar kernels
+	 */
+	Kernels const &	scalar(WaterBoundary::Enum boundary) {
+		return scalarKernels[boundary];
+	}
+
+	/**
+	 * @brief Get the fastest kernels supported by the cpu, chosen on first call
+	 *
+	 * @param boundary the border pipes handled by the kernels
+	 * @return Kernels const& kernels to use
+	 */
+	Kernels const &	best(WaterBoundary::Enum boundary) {
+		static Kernels const *	kernels = select();
+		return kernels[boundary];
+	}
+
+	/**
+	 * @brief Get the vectorized kernels supported by the cpu, whatever the
+	 * simd setting, to check them against the scalar ones
+	 *
+	 * @param boundary the border pipes handled by the kernels
+	 * @return std::vector<Kernels const *> the kernels sets, from the slowest
+	 */
+	std::vector<Kernels const *>	supported(WaterBoundary::Enum boundary) {
+		std::vector<Kernels const *>	sets;
+
+		#if WATER_KERNELS_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse2"))
+			sets.push_back(&sse2Kernels[boundary]);
+		if (__builtin_cpu_supports("avx2")
+			&& (WATER_STORAGE != WATER_STORAGE_FP16 || __builtin_cpu_supports("f16c")))
+			sets.push_back(&avx2Kernels[boundary]);
+		#endif
+		return sets;
+	}
+}  // namespace WaterKernels
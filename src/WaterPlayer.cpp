@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cstring>
+
+#include "WaterPlayer.hpp"
+#include "Logging.hpp"
+
+// longest map path accepted in a record header
+#define WATER_REPLAY_MAX_MAP_PATH 4096
+
+// -- Constructors -------------------------------------------------------------
+
+WaterPlayer::WaterPlayer(std::string const & path)
+: _path(path),
+  _time(0),
+  _speed(1),
+  _current(UINT32_MAX),
+  _failed(false),
+  _wanted(0),
+  _quit(false) {
+	std::memset(&_header, 0, sizeof(_header));
+}
+
+WaterPlayer::~WaterPlayer() {
+	{
+		std::lock_guard<std::mutex> lock(_chunksMutex);
+		_quit = true;
+	}
+	_chunksCond.notify_all();
+	if (_reader.joinable())
+		_reader.join();
+}
+
+WaterPlayer::WaterPlayer(WaterPlayer const &src) {
+	*this = src;
+}
+
+WaterPlayer &WaterPlayer::operator=(WaterPlayer const &rhs) {
+	if (this != &rhs) {
+		logWarn("operator= called");
+	}
+	return *this;
+}
+
+// -- Methods ------------------------------------------------------------------
+
+/**
+ * @brief Read a record header and its map path
+ *
+ * @param path the record file
+ * @param header filled with the header
+ * @param mapPath filled with the map path
+ * @return false if the file is not a valid record
+ */
+bool	WaterPlayer::readHeader(std::string const & path, WaterRecordHeader & header,
+	std::string & mapPath)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		logErr("unable to open the record " << path);
+		return false;
+	}
+	std::string error;
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))
+		|| std::memcmp(header.magic, WATER_RECORD_MAGIC, sizeof(header.magic)) != 0)
+		error = "not a record file";
+	else if (header.version != WATER_RECORD_VERSION)
+		error = "version " + std::to_string(header.version) + ", expected "
+			+ std::to_string(WATER_RECORD_VERSION);
+	else if (header.width == 0 || header.height == 0 || header.scale <= 0
+		|| header.mapPathSize > WATER_REPLAY_MAX_MAP_PATH)
+		error = "invalid header";
+	if (error.empty()) {
+		mapPath.resize(header.mapPathSize);
+		if (!file.read(&mapPath[0], header.mapPathSize))
+			error = "truncated file";
+	}
+	if (!error.empty()) {
+		logErr("invalid record " << path << ", " << error);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Read the record header and index, then start the read-ahead
+ *
+ * A record without index, from an interrupted run, is scanned to rebuild it.
+ *
+ * @return false if the file is not a valid record or has no frame
+ */
+bool	WaterPlayer::open() {
+	if (!readHeader(_path, _header, _mapPath))
+		return false;
+	_file.open(_path, std::ios::binary);
+	if (!_file.is_open()) {
+		logErr("unable to open the record " << _path);
+		return false;
+	}
+	if (!_readIndex()) {
+		logWarn("record " << _path << " has no index, scanning its frames");
+		if (!_scanIndex())
+			return false;
+	}
+	if (_index.empty()) {
+		logErr("the record " << _path << " has no frame");
+		return false;
+	}
+
+	size_t size = static_cast<size_t>(_header.width) * _header.height;
+	_frame.assign(size, 0);
+	_prev.assign(size, 0);
+	_zero.assign(size, 0);
+	_time = _index[0].simTime;
+
+	_chunks.resize(WATER_REPLAY_READ_AHEAD);
+	for (Chunk & chunk : _chunks)
+		chunk.id = UINT32_MAX;
+	_reader = std::thread(&WaterPlayer::_readAheadLoop, this);
+	return true;
+}
+
+/**
+ * @brief Read the index written at the end of the record
+ *
+ * @return false if the record has no valid index
+ */
+bool	WaterPlayer::_readIndex() {
+	WaterRecordFooter footer;
+	_file.seekg(0, std::ios::end);
+	uint64_t fileSize = _file.tellg();
+	if (fileSize < sizeof(footer))
+		return false;
+	_file.seekg(fileSize - sizeof(footer));
+	if (!_file.read(reinterpret_cast<char *>(&footer), sizeof(footer))
+		|| std::memcmp(footer.magic, WATER_RECORD_INDEX_MAGIC, sizeof(footer.magic)) != 0
+		|| footer.indexOffset + footer.nbFrames * sizeof(WaterRecordIndexEntry) + sizeof(footer)
+		!= fileSize)
+		return false;
+
+	_index.resize(footer.nbFrames);
+	_file.seekg(footer.indexOffset);
+	return static_cast<bool>(_file.read(reinterpret_cast<char *>(_index.data()),
+		_index.size() * sizeof(WaterRecordIndexEntry)));
+}
+
+/**
+ * @brief Rebuild the index from the frames chunks, a truncated last frame is
+ * ignored
+ *
+ * @return false on read error
+ */
+bool	WaterPlayer::_scanIndex() {
+	_file.clear();
+	_file.seekg(0, std::ios::end);
+	uint64_t fileSize = _file.tellg();
+	uint64_t offset = sizeof(WaterRecordHeader) + _header.mapPathSize;
+
+	_index.clear();
+	WaterRecordFrameHeader header;
+	while (offset + sizeof(header) <= fileSize) {
+		_file.seekg(offset);
+		if (!_file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+			return false;
+		if (offset + sizeof(header) + header.size > fileSize)
+			break;
+		WaterRecordIndexEntry entry;
+		entry.offset = offset;
+		entry.simTime = header.simTime;
+		entry.size = header.size;
+		entry.flags = header.flags;
+		_index.push_back(entry);
+		offset += sizeof(header) + header.size;
+	}
+	_file.clear();
+	return true;
+}
+
+/**
+ * @brief Advance the playback
+ *
+ * @param dtTime elapsed time, scaled by the playback speed
+ * @return true if the played frame changed, false if it didn't or on error,
+ * then hasFailed() is set and the playback stays stopped
+ */
+bool	WaterPlayer::update(double dtTime) {
+	if (_failed)
+		return false;
+	seek(_time + dtTime * _speed);
+	uint32_t target = _frameAt(_time);
+	if (target == _current)
+		return false;
+	_failed = !_decodeTo(target);
+	return !_failed;
+}
+
+/**
+ * @brief Set the record time played, clamped to the record, decoded by the
+ * next update()
+ */
+void	WaterPlayer::seek(double time) {
+	_time = std::clamp(time, _index.front().simTime, _index.back().simTime);
+}
+
+/**
+ * @brief Move the playback by a number of frames, decoded by the next update()
+ *
+ * @param nbFrames frames to move, negative to go back
+ */
+void	WaterPlayer::step(int32_t nbFrames) {
+	int64_t id = _current == UINT32_MAX ? 0 : _current;
+	id = std::clamp<int64_t>(id + nbFrames, 0, _index.size() - 1);
+	_time = _index[id].simTime;
+}
+
+void	WaterPlayer::setSpeed(float speed) {
+	_speed = std::clamp(speed, WATER_REPLAY_MIN_SPEED, WATER_REPLAY_MAX_SPEED);
+}
+
+/**
+ * @brief Get the last frame whose time is not after time
+ */
+uint32_t	WaterPlayer::_frameAt(double time) const {
+	std::vector<WaterRecordIndexEntry>::const_iterator it = std::upper_bound(_index.begin(),
+		_index.end(), time, [](double t, WaterRecordIndexEntry const & entry) {
+			return t < entry.simTime;
+		});
+	return it == _index.begin() ? 0 : it - _index.begin() - 1;
+}
+
+/**
+ * @brief Decode up to a frame, from the current one if it is on the way,
+ * else from the last keyframe before it
+ *
+ * @param target the frame to decode
+ * @return false if a frame can't be read or decoded
+ */
+bool	WaterPlayer::_decodeTo(uint32_t target) {
+	uint32_t key = target;
+	while (key > 0 && !(_index[key].flags & WaterRecordFlag::KEYFRAME))
+		--key;
+	uint32_t id = key;
+	if (_current != UINT32_MAX && _current < target && _current >= key)
+		id = _current + 1;
+
+	for (; id <= target; ++id) {
+		bool found = false;
+		{
+			std::lock_guard<std::mutex> lock(_chunksMutex);
+			Chunk & chunk = _chunks[id % WATER_REPLAY_READ_AHEAD];
+			if (chunk.id == id) {
+				_encoded.swap(chunk.data);
+				chunk.id = UINT32_MAX;
+				found = true;
+			}
+			_wanted = id + 1;
+		}
+		_chunksCond.notify_one();
+		if (!found && !_readChunk(_file, id, _encoded)) {
+			logErr("unable to read the frame " << id << " of " << _path);
+			return false;
+		}
+
+		uint16_t const * ref = _index[id].flags & WaterRecordFlag::KEYFRAME
+			? _zero.data() : _frame.data();
+		if (!WaterRecorder::decode(_encoded.data(), _encoded.size(), ref, _prev.data(), _prev.size())) {
+			logErr("corrupted frame " << id << " in " << _path);
+			_current = UINT32_MAX;
+			return false;
+		}
+		_frame.swap(_prev);
+		_current = id;
+	}
+	return true;
+}
+
+bool	WaterPlayer::_readChunk(std::ifstream & file, uint32_t id, std::vector<uint8_t> & data) const {
+	WaterRecordIndexEntry const & entry = _index[id];
+	WaterRecordFrameHeader header;
+	file.clear();
+	file.seekg(entry.offset);
+	if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || header.size != entry.size)
+		return false;
+	data.resize(header.size);
+	return static_cast<bool>(file.read(reinterpret_cast<char *>(data.data()), header.size));
+}
+
+/**
+ * @brief Read-ahead thread, keep the WATER_REPLAY_READ_AHEAD frames after the
+ * played one in memory
+ */
+void	WaterPlayer::_readAheadLoop() {
+	std::ifstream file(_path, std::ios::binary);
+	std::vector<uint8_t> data;
+
+	std::unique_lock<std::mutex> lock(_chunksMutex);
+	while (!_quit) {
+		// first missing frame of the window
+		uint32_t end = std::min<uint64_t>(static_cast<uint64_t>(_wanted) + WATER_REPLAY_READ_AHEAD,
+			_index.size());
+		uint32_t id = _wanted;
+		while (id < end && _chunks[id % WATER_REPLAY_READ_AHEAD].id == id)
+			++id;
+		if (id >= end) {
+			_chunksCond.wait(lock);
+			continue;
+		}
+
+		lock.unlock();
+		bool read = _readChunk(file, id, data);
+		lock.lock();
+		if (!read) {
+			// the player reports the error when it reaches the frame
+			_chunksCond.wait(lock);
+			continue;
+		}
+		// the window may have moved during the read
+		if (id >= _wanted && id < static_cast<uint64_t>(_wanted) + WATER_REPLAY_READ_AHEAD) {
+			Chunk & chunk = _chunks[id % WATER_REPLAY_READ_AHEAD];
+			chunk.id = id;
+			chunk.data.swap(data);
+		}
+	}
+}
+
+// -- getters ------------------------------------------------------------------
+WaterRecordHeader const &	WaterPlayer::getHeader() const { return _header; }
+std::string const &	WaterPlayer::getMapPath() const { return _mapPath; }
+uint16_t const *	WaterPlayer::getFrame() const { return _frame.data(); }
+uint32_t	WaterPlayer::getFrameId() const { return _current; }
+uint32_t	WaterPlayer::getNbFrames() const { return _index.size(); }
+double	WaterPlayer::getTime() const { return _time; }
+float	WaterPlayer::getSpeed() const { return _speed; }
+bool	WaterPlayer::hasFailed() const { return _failed; }
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "WaterRecorder.hpp"
+#include "Logging.hpp"
+
+static_assert(sizeof(WaterRecordHeader) == 64, "WaterRecordHeader must be 64 bytes");
+
+// -- Constructors -------------------------------------------------------------
+
+/**
+ * @brief Create a recorder, start() opens the file
+ *
+ * @param path the record file
+ * @param mapPath the map simulated, to replay the record over its terrain
+ * @param width water columns per row
+ * @param height water columns rows
+ */
+WaterRecorder::WaterRecorder(std::string const & path, std::string const & mapPath,
+	uint32_t width, uint32_t height)
+: _path(path),
+  _mapPath(mapPath),
+  _width(width),
+  _height(height),
+  _quit(false),
+  _offset(0),
+  _encodeTime(0),
+  _nbDropped(0) {
+	size_t size = static_cast<size_t>(width) * height;
+	_frames.resize(WATER_RECORD_QUEUE_SIZE);
+	for (Frame & frame : _frames) {
+		frame.depth.resize(size);
+		_free.push(&frame);
+	}
+	_prev.assign(size, 0);
+	_zero.assign(size, 0);
+}
+
+/**
+ * @brief Write the queued frames and the index, then print the report
+ */
+WaterRecorder::~WaterRecorder() {
+	_quit = true;
+	if (_writer.joinable()) {
+		_writer.join();
+		_writeIndex();
+		_report();
+	}
+}
+
+WaterRecorder::WaterRecorder(WaterRecorder const &src) {
+	*this = src;
+}
+
+WaterRecorder &WaterRecorder::operator=(WaterRecorder const &rhs) {
+	if (this != &rhs) {
+		logWarn("operator= called");
+	}
+	return *this;
+}
+
+// -- Methods ------------------------------------------------------------------
+
+/**
+ * @brief Open the file, write its header and start the writer thread
+ *
+ * @return false if the file can't be created
+ */
+bool	WaterRecorder::start() {
+	_file.open(_path, std::ios::binary | std::ios::trunc);
+	if (!_file.is_open()) {
+		logErr("unable to create the record " << _path);
+		return false;
+	}
+
+	WaterRecordHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, WATER_RECORD_MAGIC, sizeof(header.magic));
+	header.version = WATER_RECORD_VERSION;
+	header.width = _width;
+	header.height = _height;
+	header.scale = WATER_RECORD_SCALE;
+	header.keyframeInterval = WATER_RECORD_KEYFRAME;
+	header.mapPathSize = _mapPath.size();
+	_file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+	_file.write(_mapPath.data(), _mapPath.size());
+	if (!_file) {
+		logErr("unable to write the record " << _path);
+		return false;
+	}
+	_offset = sizeof(header) + _mapPath.size();
+
+	_writer = std::thread(&WaterRecorder::_writerLoop, this);
+	return true;
+}
+
+/**
+ * @brief Queue the current depth, simulation thread only
+ *
+ * @param grid the water columns
+ * @param simTime the simulated time
+ */
+void	WaterRecorder::record(WaterGrid const & grid, double simTime) {
+	Frame * frame;
+	if (!_free.pop(frame)) {
+		++_nbDropped;
+		return;
+	}
+
+	uint16_t * dst = frame->depth.data();
+	for (uint32_t v = 0; v < _height; ++v) {
+		for (uint32_t u = 0; u < _width; u = grid.getRunEnd(u)) {
+			WaterValue const * depth = grid.cells(WaterPlane::DEPTH, u, v);
+			for (uint32_t i = 0; i < grid.getRunEnd(u) - u; ++i) {
+				float q = std::min(depth[i] * WATER_RECORD_SCALE + 0.5f, 65535.0f);
+				*dst++ = q > 0 ? static_cast<uint16_t>(q) : 0;
+			}
+		}
+	}
+	frame->simTime = simTime;
+	_pending.push(frame);
+}
+
+void	WaterRecorder::_writerLoop() {
+	Frame * frame;
+	while (true) {
+		if (_pending.pop(frame)) {
+			_writeFrame(*frame);
+			_free.push(frame);
+		}
+		else if (_quit) {
+			break;
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(WATER_RECORD_IDLE_SLEEP_MS));
+		}
+	}
+}
+
+void	WaterRecorder::_writeFrame(Frame const & frame) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool keyframe = _index.size() % WATER_RECORD_KEYFRAME == 0;
+	encode(frame.depth.data(), keyframe ? _zero.data() : _prev.data(), frame.depth.size(), _encoded);
+	_prev = frame.depth;
+	_encodeTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	WaterRecordFrameHeader header;
+	header.size = _encoded.size();
+	header.flags = keyframe ? WaterRecordFlag::KEYFRAME : 0;
+	header.simTime = frame.simTime;
+	_file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+	_file.write(reinterpret_cast<char const *>(_encoded.data()), _encoded.size());
+
+	WaterRecordIndexEntry entry;
+	entry.offset = _offset;
+	entry.simTime = header.simTime;
+	entry.size = header.size;
+	entry.flags = header.flags;
+	_index.push_back(entry);
+	_offset += sizeof(header) + _encoded.size();
+}
+
+void	WaterRecorder::_writeIndex() {
+	WaterRecordFooter footer;
+	std::memset(&footer, 0, sizeof(footer));
+	footer.indexOffset = _offset;
+	footer.nbFrames = _index.size();
+	std::memcpy(footer.magic, WATER_RECORD_INDEX_MAGIC, sizeof(footer.magic));
+
+	_file.write(reinterpret_cast<char const *>(_index.data()),
+		_index.size() * sizeof(WaterRecordIndexEntry));
+	_file.write(reinterpret_cast<char const *>(&footer), sizeof(footer));
+	_offset += _index.size() * sizeof(WaterRecordIndexEntry) + sizeof(footer);
+	_file.close();
+	if (!_file)
+		logErr("unable to write the record " << _path);
+}
+
+/**
+ * @brief Print the compression ratio against raw float frames and the
+ * encoding throughput
+ */
+void	WaterRecorder::_report() const {
+	double rawSize = static_cast<double>(_index.size()) * _width * _height * sizeof(float);
+	double mb = 1024.0 * 1024.0;
+	logInfo("water record " << _path << ": " << _index.size() << " frames, "
+		<< _nbDropped << " dropped");
+	logInfo("  raw " << rawSize / mb << " MB, written " << _offset / mb << " MB, ratio "
+		<< (_offset > 0 ? rawSize / _offset : 0) << ":1");
+	logInfo("  encode " << _encodeTime << "s, "
+		<< (_encodeTime > 0 ? rawSize / mb / _encodeTime : 0) << " MB/s");
+}
+
+// -- codec --------------------------------------------------------------------
+
+static inline void	putVarint(std::vector<uint8_t> & out, uint32_t value) {
+	while (value >= 0x80) {
+		out.push_back(static_cast<uint8_t>(value) | 0x80);
+		value >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(value));
+}
+
+static inline bool	getVarint(uint8_t const * & data, uint8_t const * end, uint32_t & value) {
+	value = 0;
+	for (uint8_t shift = 0; shift < 35; shift += 7) {
+		if (data == end)
+			return false;
+		uint8_t byte = *data++;
+		value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Encode a frame as runs of unchanged values and literals
+ *
+ * The frame is a sequence of (unchanged count, literal count, literals)
+ * varints, each literal being the zigzag encoded delta against prev. Settled
+ * water gives long unchanged runs and moving water small deltas, most of
+ * them stored in a single byte.
+ *
+ * @param frame the frame to encode
+ * @param prev the reference frame
+ * @param size number of values in the frames
+ * @param out filled with the encoded frame
+ */
+void	WaterRecorder::encode(uint16_t const * frame, uint16_t const * prev, size_t size,
+	std::vector<uint8_t> & out)
+{
+	out.clear();
+	size_t i = 0;
+	while (i < size) {
+		size_t runStart = i;
+		while (i < size && frame[i] == prev[i])
+			++i;
+		size_t litStart = i;
+		while (i < size) {
+			if (frame[i] != prev[i]) {
+				++i;
+				continue;
+			}
+			// a short unchanged run is cheaper as literals than as a new pair
+			size_t j = i;
+			while (j < size && j - i < 4 && frame[j] == prev[j])
+				++j;
+			if (j == size || j - i == 4)
+				break;
+			i = j;
+		}
+		putVarint(out, litStart - runStart);
+		putVarint(out, i - litStart);
+		for (size_t k = litStart; k < i; ++k) {
+			int16_t delta = static_cast<int16_t>(frame[k] - prev[k]);
+			putVarint(out, static_cast<uint16_t>((delta << 1) ^ (delta >> 15)));
+		}
+	}
+}
+
+/**
+ * @brief Decode a frame encoded by encode()
+ *
+ * @param data the encoded frame
+ * @param dataSize the encoded frame size
+ * @param prev the reference frame
+ * @param frame filled with the decoded frame
+ * @param size number of values in the frames
+ * @return false if the data is corrupted
+ */
+bool	WaterRecorder::decode(uint8_t const * data, size_t dataSize, uint16_t const * prev,
+	uint16_t * frame, size_t size)
+{
+	uint8_t const * end = data + dataSize;
+	size_t i = 0;
+	while (i < size) {
+		uint32_t runSize, litSize;
+		if (!getVarint(data, end, runSize) || !getVarint(data, end, litSize)
+			|| static_cast<size_t>(runSize) + litSize > size - i || runSize + litSize == 0)
+			return false;
+		std::copy(prev + i, prev + i + runSize, frame + i);
+		i += runSize;
+		for (uint32_t k = 0; k < litSize; ++k, ++i) {
+			uint32_t zigzag;
+			if (!getVarint(data, end, zigzag))
+				return false;
+			int16_t delta = static_cast<int16_t>((zigzag >> 1) ^ -(zigzag & 1));
+			frame[i] = static_cast<uint16_t>(prev[i] + delta);
+		}
+	}
+	return data == end;
+}
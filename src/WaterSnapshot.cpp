@@ -0,0 +1,250 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+	#include <iterator>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include "WaterSnapshot.hpp"
+#include "Water.hpp"
+#include "Logging.hpp"
+
+static_assert(sizeof(WaterSnapshotHeader) == 64, "WaterSnapshotHeader must be 64 bytes");
+
+const WaterPlane::Enum	WaterSnapshot::snapshotPlanes[] = {
+	WaterPlane::DEPTH,
+	WaterPlane::L_FLOW,
+	WaterPlane::T_FLOW,
+	WaterPlane::TERRAIN_H,
+	WaterPlane::OUT_SCALE  // scale the next step flows with the limiter
+};
+
+// -- Constructors -------------------------------------------------------------
+
+WaterSnapshot::WaterSnapshot()
+: _mapped(nullptr),
+  _mappedSize(0),
+  _data(nullptr),
+  _size(0) {}
+
+WaterSnapshot::~WaterSnapshot() {
+	_unmap();
+}
+
+WaterSnapshot::WaterSnapshot(WaterSnapshot const &src) {
+	*this = src;
+}
+
+WaterSnapshot &WaterSnapshot::operator=(WaterSnapshot const &rhs) {
+	if (this != &rhs) {
+		logWarn("operator= called");
+	}
+	return *this;
+}
+
+// -- Methods ------------------------------------------------------------------
+
+/**
+ * @brief Copy the water state in the snapshot
+ *
+ * @param grid the water columns
+ * @param tileAwake the tiles awake flags, WATER_TILE_SIZE wide tiles
+ * @param tileFlow the tiles flow flags
+ * @param scenario the FlowScenario simulated
+ * @param currentRiseH the even rise scenario water height
+ * @param simTime the simulated time since the scenario start
+ */
+void	WaterSnapshot::capture(WaterGrid const & grid, std::vector<uint8_t> const & tileAwake,
+	std::vector<uint8_t> const & tileFlow, uint32_t scenario, float currentRiseH, double simTime)
+{
+	_unmap();
+	size_t rowSize = grid.getWidth() * sizeof(float);
+	_buffer.resize(sizeof(WaterSnapshotHeader)
+		+ WATER_SNAPSHOT_NB_PLANES * rowSize * grid.getHeight() + tileAwake.size() * 2);
+
+	WaterSnapshotHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, WATER_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = WATER_SNAPSHOT_VERSION;
+	header.width = grid.getWidth();
+	header.height = grid.getHeight();
+	header.nbPlanes = WATER_SNAPSHOT_NB_PLANES;
+	header.scenario = scenario;
+	header.currentRiseH = currentRiseH;
+	header.simTime = simTime;
+	header.tileSize = WATER_TILE_SIZE;
+	header.nbTiles = tileAwake.size();
+	std::memcpy(&_buffer[0], &header, sizeof(header));
+
+	// rows without their padding, as floats whatever the storage format
+	uint8_t * dst = &_buffer[sizeof(header)];
+	for (WaterPlane::Enum plane : snapshotPlanes) {
+		for (uint32_t v = 0; v < grid.getHeight(); ++v) {
+			grid.readRow(plane, v, reinterpret_cast<float *>(dst));
+			dst += rowSize;
+		}
+	}
+	std::memcpy(dst, tileAwake.data(), tileAwake.size());
+	std::memcpy(dst + tileAwake.size(), tileFlow.data(), tileFlow.size());
+	_data = &_buffer[0];
+	_size = _buffer.size();
+}
+
+/**
+ * @brief Write the snapshot in a file, through a temporary file so an
+ * interrupted save never leaves a truncated snapshot
+ *
+ * @param path the snapshot file
+ * @return false on write error
+ */
+bool	WaterSnapshot::save(std::string const & path) const {
+	std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file.write(reinterpret_cast<char const *>(_data), _size)) {
+			logErr("unable to write the snapshot " << tmpPath);
+			return false;
+		}
+	}
+	if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+		logErr("unable to rename " << tmpPath << " to " << path);
+		std::remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Map a snapshot file and check its header
+ *
+ * @param path the snapshot file
+ * @return false if the file can't be read or is not a valid snapshot
+ */
+bool	WaterSnapshot::load(std::string const & path) {
+	_unmap();
+	_buffer.clear();
+
+	#ifdef _WIN32
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			logErr("unable to open the snapshot " << path);
+			return false;
+		}
+		_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		_data = _buffer.data();
+		_size = _buffer.size();
+	#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			logErr("unable to open the snapshot " << path);
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(WaterSnapshotHeader))) {
+			logErr("invalid snapshot " << path << ", file too small");
+			close(fd);
+			return false;
+		}
+		void * mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapped == MAP_FAILED) {
+			logErr("unable to map the snapshot " << path);
+			return false;
+		}
+		_mapped = mapped;
+		_mappedSize = st.st_size;
+		_data = static_cast<uint8_t const *>(mapped);
+		_size = _mappedSize;
+	#endif
+
+	std::string error;
+	if (_size < sizeof(WaterSnapshotHeader)
+		|| std::memcmp(getHeader().magic, WATER_SNAPSHOT_MAGIC, sizeof(getHeader().magic)) != 0)
+		error = "not a snapshot file";
+	else if (getHeader().version != WATER_SNAPSHOT_VERSION)
+		error = "version " + std::to_string(getHeader().version) + ", expected "
+			+ std::to_string(WATER_SNAPSHOT_VERSION);
+	else if (getHeader().nbPlanes != WATER_SNAPSHOT_NB_PLANES
+		|| _size != sizeof(WaterSnapshotHeader) + _planesSize()
+		+ static_cast<size_t>(getHeader().nbTiles) * 2)
+		error = "truncated file";
+	if (!error.empty()) {
+		logErr("invalid snapshot " << path << ", " << error);
+		_unmap();
+		_buffer.clear();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Copy the snapshot planes in the grid, rounded to its storage format
+ *
+ * @param grid the water columns, same size as the snapshot
+ */
+void	WaterSnapshot::restore(WaterGrid & grid) const {
+	for (WaterPlane::Enum plane : snapshotPlanes) {
+		float const * src = getPlane(plane);
+		for (uint32_t v = 0; v < grid.getHeight(); ++v)
+			grid.writeRow(plane, v, src + static_cast<size_t>(v) * grid.getWidth());
+	}
+}
+
+void	WaterSnapshot::_unmap() {
+	#ifndef _WIN32
+		if (_mapped)
+			munmap(_mapped, _mappedSize);
+	#endif
+	_mapped = nullptr;
+	_mappedSize = 0;
+	_data = nullptr;
+	_size = 0;
+}
+
+size_t	WaterSnapshot::_planesSize() const {
+	return static_cast<size_t>(WATER_SNAPSHOT_NB_PLANES) * getHeader().width * getHeader().height
+		* sizeof(float);
+}
+
+// -- getters ------------------------------------------------------------------
+WaterSnapshotHeader const &	WaterSnapshot::getHeader() const {
+	return *reinterpret_cast<WaterSnapshotHeader const *>(_data);
+}
+
+/**
+ * @brief Get a saved plane, width * height floats
+ *
+ * @param plane one of the snapshotPlanes
+ * @return float const* the plane, nullptr if it is not saved
+ */
+float const *	WaterSnapshot::getPlane(WaterPlane::Enum plane) const {
+	WaterSnapshotHeader const & header = getHeader();
+	size_t planeSize = static_cast<size_t>(header.width) * header.height;
+	for (uint32_t i = 0; i < WATER_SNAPSHOT_NB_PLANES; ++i) {
+		if (snapshotPlanes[i] == plane) {
+			return reinterpret_cast<float const *>(_data + sizeof(WaterSnapshotHeader))
+				+ i * planeSize;
+		}
+	}
+	return nullptr;
+}
+
+/**
+ * @brief Get the tiles awake flags, nbTiles bytes
+ */
+uint8_t const *	WaterSnapshot::getTileAwake() const {
+	return _data + sizeof(WaterSnapshotHeader) + _planesSize();
+}
+
+/**
+ * @brief Get the tiles flow flags, nbTiles bytes
+ */
+uint8_t const *	WaterSnapshot::getTileFlow() const {
+	return getTileAwake() + getHeader().nbTiles;
+}
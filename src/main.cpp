@@ -1,59 +1,214 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
 #include <vector>
 #include "mod1.hpp"
 #include "Terrain.hpp"
 #include "Gui.hpp"
 #include "Scene.hpp"
+#include "WaterPlayer.hpp"
+#include "Rng.hpp"
 
-bool	init(int ac, char const **av, Scene & scene, std::vector<Terrain *> & terrains) {
-	std::vector<std::string>	mapsPath;
-
+bool	init(int ac, char const **av, Scene & scene, std::vector<Terrain *> & terrains,
+	CmdOptions & options)
+{
 	initLogs();  // init logs functions
-	srand(time(NULL));  // init random
 
 	file::mkdir(CONFIG_DIR);  // create config folder
 	initSettings(SETTINGS_FILE);  // create settings object
 
-	if (!scene.init()) {
+	if (!argParse(ac - 1, av + 1, options))  // parse arguments
 		return false;
+
+	// init random, print the seed to reproduce the run
+	if (!options.hasSeed)
+		options.seed = std::chrono::system_clock::now().time_since_epoch().count();
+	Rng::setSeed(options.seed);
+	logInfo("random seed: " << options.seed);
+
+	// a replay needs the resolution of its record, on its map by default
+	if (!options.replayPath.empty()) {
+		WaterRecordHeader header;
+		std::string mapPath;
+		if (!WaterPlayer::readHeader(options.replayPath, header, mapPath))
+			return false;
+		if (header.width != header.height) {
+			logErr("unable to replay " << options.replayPath << ", the terrains are square");
+			return false;
+		}
+		if (options.mapsPath.empty())
+			options.mapsPath.push_back(mapPath);
+		if (options.resolution != 0 && options.resolution != header.width + 1)
+			logWarn("resolution " << options.resolution << " replaced by the record one");
+		options.resolution = header.width + 1;
 	}
 
-	if (!argParse(ac - 1, av + 1, mapsPath))  // parse arguments
+	// no window in headless mode
+	if (!options.headless && !scene.init()) {
 		return false;
+	}
+
 	// create Terrain object for each file argument
 	try {
-		for (std::string mapPath : mapsPath) {
-			terrains.push_back(new Terrain(mapPath, scene.getGui(), scene));
+		for (std::string mapPath : options.mapsPath) {
+			terrains.push_back(new Terrain(mapPath, scene.getGui(), scene, options.resolution,
+				options.headless));
 		}
 	} catch(Terrain::TerrainException const & e) {
 		logErr(e.what());
 		return false;
 	}
 
-	return checkPrgm();
+	return options.headless || checkPrgm();
 }
 
-bool	simulation(std::vector<Terrain *> & terrains, Scene &scene) {
+bool	simulation(std::vector<Terrain *> & terrains, Scene &scene, CmdOptions const & options) {
 	for (Terrain * & terrain : terrains) {
 		if (!terrain->init())
 			return false;
 	}
 
+	// resume a saved run on the first map
+	if (!options.restorePath.empty() && !scene.restoreSnapshot(options.restorePath))
+		return false;
+	if (!options.recordPath.empty() && !terrains[0]->getWater().startRecording(options.recordPath))
+		return false;
+	if (!options.replayPath.empty() && !scene.startReplay(options.replayPath))
+		return false;
+
 	return scene.run();
 }
 
+/**
+ * @brief Run the simulation of each terrain without window, print the timings
+ * and the final water state
+ *
+ * @param terrains the terrains
+ * @param options the command line options
+ * @return false on error
+ */
+bool	headless(std::vector<Terrain *> & terrains, CmdOptions const & options) {
+	typedef std::chrono::steady_clock	Clock;
+
+	// find the scenario, the '_' in the name stand for spaces
+	uint16_t scenarioId = FlowScenario::EVEN_RISE;
+	if (!options.scenario.empty()) {
+		std::string name = options.scenario;
+		std::replace(name.begin(), name.end(), '_', ' ');
+		for (scenarioId = 0; scenarioId < FlowScenario::COUNT; ++scenarioId) {
+			if (Water::flowScenarioName[scenarioId] == name)
+				break;
+		}
+		if (scenarioId == FlowScenario::COUNT) {
+			logErr("unknown scenario: " << options.scenario);
+			return false;
+		}
+	}
+
+	std::cout << std::fixed;
+	for (uint32_t i = 0; i < terrains.size(); ++i) {
+		Terrain * terrain = terrains[i];
+
+		Clock::time_point start = Clock::now();
+		if (!terrain->init())
+			return false;
+		// resume a saved run on the first map
+		if (i == 0 && !options.restorePath.empty()) {
+			if (!terrain->getWater().restoreSnapshot(options.restorePath))
+				return false;
+		}
+		else {
+			terrain->setScenario(scenarioId);
+		}
+		if (i == 0 && !options.recordPath.empty()) {
+			if (!terrain->getWater().startRecording(options.recordPath))
+				return false;
+		}
+		if (i == 0 && !options.replayPath.empty()) {
+			if (!terrain->getWater().startReplay(options.replayPath))
+				return false;
+		}
+		double initTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+		uint64_t nbSubsteps = 0;
+		start = Clock::now();
+		for (uint32_t step = 0; step < options.steps; ++step) {
+			if (!terrain->update(options.dt))
+				return false;
+			nbSubsteps += terrain->getWater().getNbSubsteps();
+		}
+		double stepsTime = std::chrono::duration<double>(Clock::now() - start).count();
+
+		Water const & water = terrain->getWater();
+		glm::uvec2 res = terrain->getResolution();
+		std::cout << "map: " << options.mapsPath[i] << std::endl;
+		std::cout << "  resolution: " << res.x << "x" << res.y << std::endl;
+		std::cout << "  scenario: " << Water::flowScenarioName[water.getScenario()] << std::endl;
+		std::cout << "  steps: " << options.steps << " x " << std::setprecision(4) << options.dt
+			<< "s, " << nbSubsteps << " substeps" << std::endl;
+		std::cout << "  init: " << std::setprecision(6) << initTime << "s" << std::endl;
+		for (uint16_t phase = 0; phase < TerrainPhase::COUNT; ++phase) {
+			if (phase != TerrainPhase::HEIGHTS)  // no shading and mesh without window
+				continue;
+			std::cout << "    terrain " << Terrain::phaseName[phase] << ": "
+				<< terrain->getPhaseTime(static_cast<TerrainPhase::Enum>(phase)) << "s" << std::endl;
+		}
+		std::cout << "  update: " << stepsTime << "s";
+		if (options.steps > 0)
+			std::cout << " (" << stepsTime * 1000 / options.steps << "ms/step)";
+		std::cout << std::endl;
+		for (uint16_t phase = 0; phase < WaterPhase::COUNT; ++phase) {
+			if (phase == WaterPhase::MESH || phase == WaterPhase::BORDER)  // no mesh without window
+				continue;
+			std::cout << "    " << Water::phaseName[phase] << ": "
+				<< water.getPhaseTime(static_cast<WaterPhase::Enum>(phase)) << "s" << std::endl;
+		}
+		std::cout << "  sim time: " << std::setprecision(4) << water.getSimTime() << "s" << std::endl;
+		std::cout << "  volume: " << water.getVolume() << std::endl;
+		std::cout << "  cell updates: " << water.getNbCellUpdates() << std::endl;
+		std::cout << "  memory: " << std::setprecision(1) << water.getResidentBytes() / (1024.0 * 1024.0)
+			<< "MB" << std::endl;
+		std::cout << "  storage: " << WATER_STORAGE_NAME << std::endl;
+		std::cout << "  checksum: " << std::hex << std::setfill('0') << std::setw(16)
+			<< water.getChecksum() << std::dec << std::setfill(' ') << std::endl;
+
+		// the first map water against a reference run
+		if (i == 0 && !options.savePath.empty() && !water.writeSnapshot(options.savePath))
+			return false;
+		if (i == 0 && !options.comparePath.empty()) {
+			WaterDiff diff;
+			if (!water.compareSnapshot(options.comparePath, diff))
+				return false;
+			std::cout << "  depth error: rms " << std::scientific << std::setprecision(3) << diff.depthRms
+				<< ", max " << diff.depthMax << std::endl;
+			std::cout << "  volume drift: " << diff.volumeDrift * 100 << "% of " << std::fixed
+				<< std::setprecision(4) << diff.volume << std::endl;
+		}
+	}
+	return true;
+}
+
 int main(int ac, char const **av) {
 	int	ret = EXIT_SUCCESS;
 	std::vector<Terrain *>	terrains;
 	Scene	scene(terrains);
+	CmdOptions	options;
 
 	// init program & load settings
-	if (!init(ac, av, scene, terrains))
+	if (!init(ac, av, scene, terrains, options))
 		ret = EXIT_FAILURE;
 
-	if (ret != EXIT_FAILURE) {
+	if (ret != EXIT_FAILURE && options.headless) {
+		// batch run, the settings are not modified
+		if (!headless(terrains, options))
+			ret = EXIT_FAILURE;
+	}
+	else if (ret != EXIT_FAILURE) {
 		// launch simulation
-		if (!simulation(terrains, scene))
+		if (!simulation(terrains, scene, options))
 			ret = EXIT_FAILURE;
+		Stats::printStats();
 
 		// save settings before exiting
 		if (ret != EXIT_FAILURE)
@@ -4,6 +4,10 @@
 #include "Logging.hpp"
 #include "FileUtils.hpp"
 #include "Inputs.hpp"
+#include "WaterSnapshot.hpp"
+#include "WaterRecorder.hpp"
+#include "TerrainCloud.hpp"
+#include "TerrainHeightmap.hpp"
 
 SettingsJson s;
 
@@ -159,6 +163,42 @@ bool	initSettings(std::string const & filename) {
 	s.j("graphics").add<int64_t>("width", 1200).setMin(800).setMax(2560).setDescription("The resolution's width.");
 	s.j("graphics").add<int64_t>("height", 800).setMin(600).setMax(1440).setDescription("The resolution's height.");
 
+	/* simulation */
+	s.add<SettingsJson>("simulation");
+	s.j("simulation").add<uint64_t>("threads", 0).setMin(0).setMax(256)
+		.setDescription("Number of threads used by the water simulation, 0 to use all the cores.");
+	s.j("simulation").add<bool>("simd", true)
+		.setDescription("Use the vectorized (SSE2/AVX2) water kernels if the cpu support them.");
+	s.j("simulation").add<uint64_t>("resolution", TERRAIN_DEF_RES).setMin(TERRAIN_MIN_RES).setMax(TERRAIN_MAX_RES)
+		.setDescription("Number of terrain points per side, the water grid has one less column per side. "
+			"Overridden by the map file and the command line.");
+	s.j("simulation").add<bool>("terrainCache", true)
+		.setDescription("Save the built terrains in the " CACHE_DIR " folder, an unchanged map is loaded "
+			"without its interpolation by the next launches.");
+	s.j("simulation").add<bool>("outflowLimiter", true)
+		.setDescription("Prevent negative water depth with the single pass outflow limiter, "
+			"false to use the iterative correction.");
+	s.j("simulation").add<double>("courant", 0.5).setMin(0.05).setMax(1.0)
+		.setDescription("Fraction of the stable time step used by each simulation substep.");
+	s.j("simulation").add<uint64_t>("maxSubsteps", 8).setMin(1).setMax(256)
+		.setDescription("Max simulation substeps per frame, a slower frame slows the simulation down.");
+	s.j("simulation").add<uint64_t>("blockSteps", 1).setMin(1).setMax(16)
+		.setDescription("Substeps advanced by a single sweep of the water grid rows while they stay in "
+			"cache, on the same active tiles, 1 to run each phase on the whole grid. Needs the outflow "
+			"limiter.");
+	s.j("simulation").add<std::string>("boundary", "wall")
+		.setDescription("Water grid borders: wall to keep the water in, open to let it flow out of the "
+			"map, periodic to connect the opposite borders. Open and periodic need the outflow limiter.");
+	s.j("simulation").add<double>("rainDensity", 0.3).setMin(0.0).setMax(1.0)
+		.setDescription("Fraction of the columns getting a drop at each rain shower of the raining scenario.");
+	s.j("simulation").add<bool>("thread", true)
+		.setDescription("Run the water simulation on its own thread, false to run it before each frame draw.");
+	s.j("simulation").add<bool>("allTerrains", false)
+		.setDescription("Simulate all the maps at the same time, not only the displayed one.");
+	s.j("simulation").add<bool>("sparse", false)
+		.setDescription("Only keep in memory the water grid parts close to the water, for the huge "
+			"mostly dry maps. Needs the outflow limiter.");
+
 	/* mouse sensitivity */
 	s.add<double>("mouse_sensitivity", 0.7).setMin(0.0).setMax(3.0) \
 		.setDescription("Camera mouse sensitivity.");
@@ -207,10 +247,61 @@ bool	saveSettings(std::string const & filename) {
  * @return false Return always false
  */
 bool	usage() {
-	std::cout << "usage: ./mod1 <map1.mod1> <map2.mod1> ..." << std::endl;
+	std::cout << "usage: ./mod1 [-r <resolution>] [--restore <file>] [--record <file>] "
+		"[--replay <file>] [--seed <n>] [--headless [--steps <n>] [--scenario <name>] [--dt <s>] "
+		"[--save <file>] [--compare <file>]] <map1.mod1> <map2.mod1> ..."
+		<< std::endl;
+	std::cout << "  maps: .mod1 maps, at most " << MAX_POINTS_NB << " points, or point clouds ("
+		<< TERRAIN_CLOUD_XYZ_EXT << " and " << TERRAIN_CLOUD_CSV_EXT << " text, " << TERRAIN_CLOUD_EXT
+		<< " binary), or heightmaps (" << TERRAIN_HEIGHTMAP_PNG_EXT << " gray levels, "
+		<< TERRAIN_HEIGHTMAP_EXT << " floats)" << std::endl;
+	std::cout << "  -r, --resolution <n>: number of terrain points per side ["
+		<< TERRAIN_MIN_RES << ", " << TERRAIN_MAX_RES << "]" << std::endl;
+	std::cout << "  --restore <file>: restore the first map water from a snapshot ("
+		<< SNAPSHOTS_DIR << "*" << WATER_SNAPSHOT_EXT << ")" << std::endl;
+	std::cout << "  --record <file>: record the first map water after each update ("
+		<< "*" << WATER_RECORD_EXT << ")" << std::endl;
+	std::cout << "  --replay <file>: replay a record on the first map, the record map and "
+		"resolution are used when no map is given" << std::endl;
+	std::cout << "  --seed <n>: random numbers seed, the same seed gives the same rain (default random)"
+		<< std::endl;
+	std::cout << "  --headless: run the simulation without window and print its timings" << std::endl;
+	std::cout << "  --steps <n>: headless number of updates (default " << HEADLESS_DEF_STEPS << ")" << std::endl;
+	std::cout << "  --scenario <name>: headless scenario, even_rise, wave, raining, drain or sandbox" << std::endl;
+	std::cout << "  --dt <s>: headless update delta time (default " << HEADLESS_DEF_DT << ")" << std::endl;
+	std::cout << "  --save <file>: headless snapshot of the first map water after the run" << std::endl;
+	std::cout << "  --compare <file>: headless depth error and volume drift of the first map water against "
+		"a snapshot saved by a fp32 build (this build stores " << WATER_STORAGE_NAME << ")" << std::endl;
 	return false;
 }
 
+/**
+ * @brief Parse the number following an option
+ *
+ * @param nbArgs number of arguments
+ * @param args arguments
+ * @param i the option id, incremented if the number is valid
+ * @param min the min value
+ * @param max the max value
+ * @param value filled with the number
+ * @param integer true to only accept whole numbers
+ * @return false if the number is missing or invalid
+ */
+bool	argNumber(int nbArgs, char const ** args, int & i, double min, double max, double & value,
+	bool integer)
+{
+	char * end = nullptr;
+	if (i + 1 < nbArgs)  // an integer only in decimal digits, no fraction nor exponent
+		value = integer ? std::strtoll(args[i + 1], &end, 10) : std::strtod(args[i + 1], &end);
+	if (end == nullptr || end == args[i + 1] || *end != '\0' || !(value >= min && value <= max)) {
+		std::cout << "invalid " << args[i] << " value, expected " << (integer ? "an integer" : "a number")
+			<< " in [" << min << ", " << max << "]" << std::endl;
+		return false;
+	}
+	++i;
+	return true;
+}
+
 bool	hasSuffix(std::string const & str, std::string const & suffix) {
 	return str.size() >= suffix.size() &&
 		str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
@@ -221,14 +312,66 @@ bool	hasSuffix(std::string const & str, std::string const & suffix) {
  *
  * @param nbArgs number of arguments (argc - 1)
  * @param args arguments (av + 1)
+ * @param options filled with the parsed options
  * @return false If need to quit
  */
-bool	argParse(int nbArgs, char const ** args, std::vector<std::string> & mapsPath) {
+bool	argParse(int nbArgs, char const ** args, CmdOptions & options) {
+	std::vector<std::string> & mapsPath = options.mapsPath;
+	double	value;
+
 	for (int i = 0; i < nbArgs; ++i) {
 		if (strcmp(args[i], "--usage") == 0 || strcmp(args[i], "-u") == 0) {
 			return usage();
 		}
-		else if (hasSuffix(std::string(args[i]), ".mod1")) {
+		else if (strcmp(args[i], "--resolution") == 0 || strcmp(args[i], "-r") == 0) {
+			if (!argNumber(nbArgs, args, i, TERRAIN_MIN_RES, TERRAIN_MAX_RES, value, true))
+				return usage();
+			options.resolution = value;
+		}
+		else if (strcmp(args[i], "--headless") == 0) {
+			options.headless = true;
+		}
+		else if (strcmp(args[i], "--steps") == 0) {
+			if (!argNumber(nbArgs, args, i, 0, UINT32_MAX, value, true))
+				return usage();
+			options.steps = value;
+		}
+		else if (strcmp(args[i], "--scenario") == 0 && i + 1 < nbArgs) {
+			options.scenario = args[++i];
+		}
+		else if (strcmp(args[i], "--restore") == 0 && i + 1 < nbArgs) {
+			options.restorePath = args[++i];
+		}
+		else if (strcmp(args[i], "--record") == 0 && i + 1 < nbArgs) {
+			options.recordPath = args[++i];
+		}
+		else if (strcmp(args[i], "--replay") == 0 && i + 1 < nbArgs) {
+			options.replayPath = args[++i];
+		}
+		else if (strcmp(args[i], "--save") == 0 && i + 1 < nbArgs) {
+			options.savePath = args[++i];
+		}
+		else if (strcmp(args[i], "--compare") == 0 && i + 1 < nbArgs) {
+			options.comparePath = args[++i];
+		}
+		else if (strcmp(args[i], "--seed") == 0) {
+			// parsed as an integer, a double would lose the high bits
+			char * end = nullptr;
+			options.seed = i + 1 < nbArgs ? std::strtoull(args[i + 1], &end, 10) : 0;
+			if (end == nullptr || end == args[i + 1] || *end != '\0' || args[i + 1][0] == '-') {
+				std::cout << "invalid " << args[i] << " value, expected an unsigned integer" << std::endl;
+				return usage();
+			}
+			options.hasSeed = true;
+			++i;
+		}
+		else if (strcmp(args[i], "--dt") == 0) {
+			if (!argNumber(nbArgs, args, i, 0, HEADLESS_MAX_DT, value, false))
+				return usage();
+			options.dt = value;
+		}
+		else if (hasSuffix(std::string(args[i]), ".mod1") || TerrainCloud::isCloud(args[i])
+		|| TerrainHeightmap::isHeightmap(args[i])) {
 			mapsPath.push_back(std::string(args[i]));
 		}
 		else {
@@ -237,13 +380,23 @@ bool	argParse(int nbArgs, char const ** args, std::vector<std::string> & mapsPat
 		}
 	}
 
-	// we need at least one map
-	if (mapsPath.size() == 0)
+	// we need at least one map, a replay brings its own
+	if (mapsPath.size() == 0 && options.replayPath.empty())
 		return usage();
 
 	return true;
 }
 
+// -- CmdOptions ---------------------------------------------------------------
+CmdOptions::CmdOptions()
+: resolution(0),
+  headless(false),
+  steps(HEADLESS_DEF_STEPS),
+  scenario(""),
+  dt(HEADLESS_DEF_DT),
+  seed(0),
+  hasSeed(false) {}
+
 /**
  * @brief Get the current time in ms
  *
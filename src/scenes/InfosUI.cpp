@@ -78,6 +78,20 @@ bool InfosUI::init() {
 			.setTextAlign(TextAlign::RIGHT)
 			.setZ(1);
 
+		// active tiles text
+		str = std::to_string(_scene.getNbTiles()) + "/" + std::to_string(_scene.getNbTiles())
+			+ " active tiles";
+		ui.x = ABaseUI::strWidth(UI_FONT, str, UI_FONT_SCALE) + marg.x;
+		size = {ui.x, ui.y};
+		pos = {winSz.x - marg.x - size.x, winSz.y - marg.y - ui.y * 2};
+		_tilesText = &addText(pos, size, str);
+		_tilesText->setTextFont(UI_FONT)
+			.setTextOutline(.17)
+			.setTextScale(UI_FONT_SCALE)
+			.setTextColor(UI_TEXT_COLOR)
+			.setTextAlign(TextAlign::RIGHT)
+			.setZ(1);
+
 		// map text
 		str = "map " + std::to_string(_scene.getTerrainId() + 1);
 		ui.x = ABaseUI::strWidth(UI_FONT, str, UI_FONT_SCALE) + marg.x;
@@ -227,6 +241,11 @@ bool InfosUI::update(float dtTime) {
 		_fps = _scene.getFps();
 		str = std::to_string(_fps) + "fps";
 		_fpsText->setText(str);
+
+		// update active tiles
+		str = std::to_string(_scene.getNbActiveTiles()) + "/" + std::to_string(_scene.getNbTiles())
+			+ " active tiles";
+		_tilesText->setText(str);
 	}
 
 	// update map
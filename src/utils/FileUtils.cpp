@@ -30,6 +30,19 @@ namespace file {
 		return ghc::filesystem::is_directory(p1);
 	}
 
+	/**
+	 * @brief Get the absolute path of a file, without links nor dots
+	 *
+	 * @param path The file path
+	 * @return the canonical path, or path itself if it doesn't exist
+	 */
+	std::string	canonical(std::string const & path) {
+		std::error_code	error;
+		ghc::filesystem::path	p1 = ghc::filesystem::canonical(path, error);
+
+		return error ? path : p1.string();
+	}
+
 	/**
 	 * @brief Create a directory
 	 *
@@ -10,6 +10,8 @@ const std::string	Inputs::input_type_name[] = {
 	"decrement_1",
 	"modifier_1",
 	"modifier_2",
+	"snapshot",
+	"restore",
 };
 const SDL_Scancode	Inputs::default_keys[] = {
 	DEFAULT_ACTION,
@@ -20,6 +22,8 @@ const SDL_Scancode	Inputs::default_keys[] = {
 	DEFAULT_DECREMENT_1,
 	DEFAULT_MODIFIER_1,
 	DEFAULT_MODIFIER_2,
+	DEFAULT_SNAPSHOT,
+	DEFAULT_RESTORE,
 };
 const std::string	Inputs::configFile = CONTROLS_FILE;
 
@@ -57,6 +61,10 @@ Inputs::Inputs()
 		.setMin(4).setMax(286).setDescription("modifier key 1");
 	_controls.j("keys").add<int64_t>("modifier_2", DEFAULT_MODIFIER_2) \
 		.setMin(4).setMax(286).setDescription("modifier key 2");
+	_controls.j("keys").add<int64_t>("snapshot", DEFAULT_SNAPSHOT) \
+		.setMin(4).setMax(286).setDescription("save the water state");
+	_controls.j("keys").add<int64_t>("restore", DEFAULT_RESTORE) \
+		.setMin(4).setMax(286).setDescription("restore the saved water state");
 	try {
 		if (!_controls.loadFile(Inputs::configFile)) {
 			logWarn("Invalid value in " << Inputs::configFile << ".");
@@ -74,6 +82,8 @@ Inputs::Inputs()
 		{ static_cast<SDL_Scancode>(_controls.j("keys").i("decrement_1")), InputType::DECREMENT_1 },
 		{ static_cast<SDL_Scancode>(_controls.j("keys").i("modifier_1")), InputType::MODIFIER_1 },
 		{ static_cast<SDL_Scancode>(_controls.j("keys").i("modifier_2")), InputType::MODIFIER_2 },
+		{ static_cast<SDL_Scancode>(_controls.j("keys").i("snapshot")), InputType::SNAPSHOT },
+		{ static_cast<SDL_Scancode>(_controls.j("keys").i("restore")), InputType::RESTORE },
 	};
 	_used_scan = {
 		_controls.j("keys").i("action"),
@@ -84,6 +94,8 @@ Inputs::Inputs()
 		_controls.j("keys").i("decrement_1"),
 		_controls.j("keys").i("modifier_1"),
 		_controls.j("keys").i("modifier_2"),
+		_controls.j("keys").i("snapshot"),
+		_controls.j("keys").i("restore"),
 	};
 	_controls.saveToFile(Inputs::configFile);
 
@@ -549,6 +561,8 @@ void				Inputs::_resetKeys() {
 		{ static_cast<SDL_Scancode>(_controls.j("keys").i("decrement_1")), InputType::Enum::DECREMENT_1 },
 		{ static_cast<SDL_Scancode>(_controls.j("keys").i("modifier_1")), InputType::Enum::MODIFIER_1 },
 		{ static_cast<SDL_Scancode>(_controls.j("keys").i("modifier_2")), InputType::Enum::MODIFIER_2 },
+		{ static_cast<SDL_Scancode>(_controls.j("keys").i("snapshot")), InputType::Enum::SNAPSHOT },
+		{ static_cast<SDL_Scancode>(_controls.j("keys").i("restore")), InputType::Enum::RESTORE },
 	};
 	_used_scan = {
 		_controls.j("keys").i("action"),
@@ -559,6 +573,8 @@ void				Inputs::_resetKeys() {
 		_controls.j("keys").i("decrement_1"),
 		_controls.j("keys").i("modifier_1"),
 		_controls.j("keys").i("modifier_2"),
+		_controls.j("keys").i("snapshot"),
+		_controls.j("keys").i("restore"),
 	};
 	_controls.saveToFile(Inputs::configFile);
 }
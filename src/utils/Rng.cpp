@@ -0,0 +1,18 @@
+#include "Rng.hpp"
+
+namespace Rng {
+	static uint64_t	_seed = 0;
+
+	/**
+	 * @brief Set the program seed, before any random number is drawn
+	 *
+	 * @param seed the seed
+	 */
+	void	setSeed(uint64_t seed) {
+		_seed = seed;
+	}
+
+	uint64_t	getSeed() {
+		return _seed;
+	}
+}  // namespace Rng
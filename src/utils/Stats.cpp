@@ -5,6 +5,8 @@
 #include "Logging.hpp"
 
 std::unordered_map<std::string, struct sStat> Stats::stats = {};
+std::unordered_map<std::string, struct sValueStat> Stats::values = {};
+std::mutex Stats::valuesMutex;
 
 /**
  * @brief Construct a new Stats object
@@ -20,7 +22,7 @@ Stats::~Stats() {
 
 /**
  * @brief Print functions stats, print only the one that has been called
- * with getStats
+ * with getStats, then the values stats
  */
 void    Stats::printStats() {
     if (stats.size() > 0) {
@@ -44,6 +46,46 @@ void    Stats::printStats() {
         }
         logDebug("}");
     }
+
+    std::lock_guard<std::mutex> lock(valuesMutex);
+    if (values.size() > 0) {
+        logDebug("values stats:");
+    }
+
+    for (auto const &value : values) {
+        logDebug(value.first << "{");
+        logDebug("  samples: " << value.second.nbValues);
+        logDebug("  average: " << std::fixed << std::setprecision(4) <<
+            value.second.total / value.second.nbValues);
+        logDebug("  min: " << value.second.min);
+        logDebug("  max: " << value.second.max);
+        logDebug("}");
+    }
+}
+
+/**
+ * @brief Add a sample to a value stats (per frame counters for example),
+ * can be called from any thread
+ *
+ * @param name the value name
+ * @param value the sample
+ */
+void    Stats::addValue(std::string name, double value) {
+    std::lock_guard<std::mutex> lock(valuesMutex);
+    auto it = Stats::values.find(name);
+    if (it == Stats::values.end()) {
+        struct sValueStat stats;
+        stats.nbValues = 0;
+        stats.total = 0;
+        stats.min = value;
+        stats.max = value;
+        it = Stats::values.emplace(name, stats).first;
+    }
+    ++(it->second.nbValues);
+    it->second.total += value;
+    it->second.min = std::min(it->second.min, value);
+    it->second.max = std::max(it->second.max, value);
+    it->second.last = value;
 }
 
 /**
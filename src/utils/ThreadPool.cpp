@@ -0,0 +1,143 @@
+#include "ThreadPool.hpp"
+#include "mod1.hpp"
+#include "Logging.hpp"
+
+thread_local bool	ThreadPool::_inJob = false;
+
+// -- Constructors -------------------------------------------------------------
+
+/**
+ * @brief Construct a new Thread Pool object
+ *
+ * @param nbThreads total number of threads running the jobs (calling thread
+ * included), 0 to use all the cores
+ */
+ThreadPool::ThreadPool(uint32_t nbThreads)
+: _nbWaiting(0),
+  _job(nullptr),
+  _nbJobs(0),
+  _nextJob(0),
+  _nbBusy(0),
+  _generation(0),
+  _quit(false) {
+	if (nbThreads == 0)
+		nbThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (uint32_t i = 1; i < nbThreads; ++i) {
+		_workers.push_back(std::thread(&ThreadPool::_workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_quit = true;
+	}
+	_startCond.notify_all();
+	for (std::thread & worker : _workers)
+		worker.join();
+}
+
+ThreadPool::ThreadPool(ThreadPool const &src) {
+	*this = src;
+}
+
+ThreadPool &ThreadPool::operator=(ThreadPool const &rhs) {
+	if (this != &rhs) {
+		logWarn("ThreadPool operator= called");
+	}
+	return *this;
+}
+
+// -- Methods ------------------------------------------------------------------
+
+/**
+ * @brief Get the shared pool, sized by the "simulation.threads" setting
+ *
+ * @return ThreadPool& the shared pool
+ */
+ThreadPool &	ThreadPool::get() {
+	static ThreadPool	instance(s.j("simulation").u("threads"));
+	return instance;
+}
+
+/**
+ * @brief Run job(jobId) for each jobId in [0, nbJobs[ and wait for all of them
+ *
+ * The job id to thread mapping is not fixed, the jobs must only depend on
+ * their id. Called from inside a job, the jobs are run on the calling thread.
+ *
+ * @param nbJobs the number of jobs
+ * @param job the function to call for each job
+ * @param background true to run the jobs on the calling thread instead of
+ * waiting for the pool
+ */
+void	ThreadPool::run(uint32_t nbJobs, std::function<void(uint32_t jobId)> const & job,
+	bool background)
+{
+	std::unique_lock<std::mutex> runLock(_runMutex, std::defer_lock);
+	bool onCaller = _workers.empty() || nbJobs <= 1 || _inJob;
+	if (!onCaller && background) {
+		onCaller = _nbWaiting > 0 || !runLock.try_lock();
+	}
+	else if (!onCaller) {
+		++_nbWaiting;
+		runLock.lock();
+		--_nbWaiting;
+	}
+	if (onCaller) {
+		for (uint32_t i = 0; i < nbJobs; ++i)
+			job(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_job = &job;
+		_nbJobs = nbJobs;
+		_nextJob = 0;
+		_nbBusy = _workers.size();
+		++_generation;
+	}
+	_startCond.notify_all();
+
+	// the calling thread work too
+	_runJobs();
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_doneCond.wait(lock, [this]() { return _nbBusy == 0; });
+	_job = nullptr;
+}
+
+void	ThreadPool::_runJobs() {
+	_inJob = true;
+	for (uint32_t jobId = _nextJob++; jobId < _nbJobs; jobId = _nextJob++) {
+		(*_job)(jobId);
+	}
+	_inJob = false;
+}
+
+void	ThreadPool::_workerLoop() {
+	uint64_t	generation = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_startCond.wait(lock, [&]() { return _quit || _generation != generation; });
+			if (_quit)
+				return;
+			generation = _generation;
+		}
+
+		_runJobs();
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (--_nbBusy == 0)
+				_doneCond.notify_one();
+		}
+	}
+}
+
+// -- getters ------------------------------------------------------------------
+uint32_t	ThreadPool::getNbThreads() const { return _workers.size() + 1; }
@@ -59,9 +59,11 @@ namespace MouseRaycast {
 		float len, glm::vec3 & intersection)
 	{
 		intersection = binarySearch(terrain, camPos, 0, 0, len, ray);
-		intersection.x = std::round(intersection.x);
-		intersection.z = std::round(intersection.z);
-		return (intersection.x >= 0 && intersection.x < BOX_MAX_SIZE.x &&
-			intersection.z >= 0 && intersection.z < BOX_MAX_SIZE.z);
+		// snap on the closest terrain point
+		glm::vec2 vertSpace = terrain.getVertSpace();
+		intersection.x = std::round(intersection.x / vertSpace.x) * vertSpace.x;
+		intersection.z = std::round(intersection.z / vertSpace.y) * vertSpace.y;
+		return (intersection.x >= 0 && intersection.x <= BOX_MAX_SIZE.x &&
+			intersection.z >= 0 && intersection.z <= BOX_MAX_SIZE.z);
 	}
 }
@@ -0,0 +1,103 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "WaterGrid.hpp"
+
+// sparse grid size, in columns, not a multiple of the tiles size
+#define GRID_WIDTH 1000
+#define GRID_HEIGHT 1010
+// memory pages of the process (4096 bytes) that can stay resident after all
+// the tiles dried: the pages shared by the freed blocks and the allocator
+#define GRID_MAX_KEPT_PAGES 256
+
+/**
+ * @brief Get the resident memory of the process, from /proc
+ *
+ * @return uint64_t the bytes, 0 if unknown
+ */
+static uint64_t	processResidentBytes() {
+	std::ifstream statm("/proc/self/statm");
+	uint64_t size = 0;
+	uint64_t resident = 0;
+	if (!(statm >> size >> resident))
+		return 0;
+	return resident * 4096;
+}
+
+/**
+ * @brief Check a counter against its expected value, print the failures
+ *
+ * @return false if they differ
+ */
+static bool	check(char const * name, uint64_t value, uint64_t expected) {
+	if (value == expected)
+		return true;
+	std::cout << name << ": " << value << ", expected " << expected << ", FAILED" << std::endl;
+	return false;
+}
+
+/**
+ * @brief Fill all the tiles of a sparse grid with water, dry them in two
+ * halves, then wet them again. The resident tiles and bytes counters must
+ * follow the wet tiles, not the highest number of them, the dried tiles must
+ * read 0 and give their memory back.
+ *
+ * @return EXIT_FAILURE if a counter, a cell or the process memory is wrong
+ */
+int main() {
+	WaterGrid grid;
+	grid.resize(GRID_WIDTH, GRID_HEIGHT, true);
+	if (!grid.isSparse()) {
+		std::cout << "no sparse water grid on this system" << std::endl;
+		return EXIT_SUCCESS;
+	}
+	uint32_t tilesW = (GRID_WIDTH + WATER_GRID_TILE_SIZE - 1) / WATER_GRID_TILE_SIZE;
+	uint32_t tilesH = (GRID_HEIGHT + WATER_GRID_TILE_SIZE - 1) / WATER_GRID_TILE_SIZE;
+	uint64_t indexBytes = static_cast<uint64_t>(tilesW) * tilesH * sizeof(uint8_t *);
+	uint64_t tileBytes = WATER_GRID_TILE_SIZE * WATER_GRID_TILE_SIZE * grid.getCellBytes();
+	bool ok = check("dry grid bytes", grid.getResidentBytes(), indexBytes);
+	uint64_t processStart = processResidentBytes();
+
+	// the written water allocates all the tiles
+	std::vector<float> depth(GRID_WIDTH, 1.0f);
+	for (uint32_t v = 0; v < GRID_HEIGHT; ++v)
+		grid.writeRow(WaterPlane::DEPTH, v, depth.data());
+	ok &= check("wet tiles", grid.getNbResidentTiles(), tilesW * tilesH);
+	ok &= check("wet grid bytes", grid.getResidentBytes(), indexBytes + tilesW * tilesH * tileBytes);
+
+	// the left half dries
+	uint32_t halfW = tilesW / 2;
+	for (uint32_t tv = 0; tv < tilesH; ++tv) {
+		for (uint32_t tu = 0; tu < halfW; ++tu)
+			grid.freeTile(tu, tv);
+	}
+	ok &= check("half dry tiles", grid.getNbResidentTiles(), (tilesW - halfW) * tilesH);
+	ok &= check("half dry grid bytes", grid.getResidentBytes(),
+		indexBytes + (tilesW - halfW) * tilesH * tileBytes);
+	ok &= check("dried cell", grid.depth(0, 0), 0);
+	ok &= check("wet cell", grid.depth(GRID_WIDTH - 1, GRID_HEIGHT - 1), 1);
+
+	// then the right half
+	for (uint32_t tv = 0; tv < tilesH; ++tv) {
+		for (uint32_t tu = halfW; tu < tilesW; ++tu)
+			grid.freeTile(tu, tv);
+	}
+	ok &= check("dry tiles", grid.getNbResidentTiles(), 0);
+	ok &= check("dried grid bytes", grid.getResidentBytes(), indexBytes);
+	uint64_t processDry = processResidentBytes();
+	if (processStart != 0 && processDry > processStart + GRID_MAX_KEPT_PAGES * 4096) {
+		std::cout << "dried process memory: " << processDry - processStart << " bytes kept, FAILED" << std::endl;
+		ok = false;
+	}
+
+	// the wet tiles take the freed blocks back, they start at 0
+	grid.allocTile(1, 2);
+	ok &= check("wet again tiles", grid.getNbResidentTiles(), 1);
+	ok &= check("wet again grid bytes", grid.getResidentBytes(), indexBytes + tileBytes);
+	ok &= check("wet again cell", grid.depth(WATER_GRID_TILE_SIZE, 2 * WATER_GRID_TILE_SIZE), 0);
+
+	std::cout << "sparse grid " << GRID_WIDTH << "x" << GRID_HEIGHT << ": resident memory "
+		<< (ok ? "ok" : "FAILED") << std::endl;
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "mod1.hpp"
+#include "Water.hpp"
+#include "WaterKernels.hpp"
+
+// max relative error allowed between a vectorized kernel and the scalar one,
+// relative to max(1, |scalar value|)
+#define KERNELS_TOLERANCE 1e-5f
+// random grids per kernels set
+#define KERNELS_NB_GRIDS 32
+// random grids sizes, in columns
+#define KERNELS_MAX_WIDTH 131
+#define KERNELS_MAX_HEIGHT 23
+// updates of each grid
+#define KERNELS_NB_STEPS 4
+
+/**
+ * @brief Compare a kernels set with the scalar one on a random grid
+ *
+ * The grid mix dry and wet columns and terrain walls, the tested kernels
+ * update the rows in three random unaligned spans. It is run without then
+ * with the outflow limiter. The rain drops only add an amount, the depth
+ * must be exactly the same. A sparse tested grid has all its tiles resident,
+ * its rows are split in tile runs.
+ *
+ * @param kernels the kernels to check
+ * @param gen the random generator of the grid
+ * @param sparse update a sparse copy of the grid
+ * @return the max relative error of the depth and flows, INFINITY if the
+ * rain differs or a value is not a number
+ */
+static float	checkGrid(WaterKernels::Kernels const & kernels, std::mt19937 & gen, bool sparse) {
+	uint32_t const	width = 2 + gen() % (KERNELS_MAX_WIDTH - 1);
+	uint32_t const	height = 2 + gen() % (KERNELS_MAX_HEIGHT - 1);
+	float const	dtTime = 0.016f;
+	float const	gridArea = 1.0f;
+	WaterKernels::Kernels const &	scalarRef = WaterKernels::scalar(kernels.boundary);
+
+	uint32_t spans[4] = {0, static_cast<uint32_t>(gen() % (width + 1)),
+		static_cast<uint32_t>(gen() % (width + 1)), width};
+	std::sort(spans + 1, spans + 3);
+
+	float maxError = 0;
+	for (bool limited : {false, true}) {
+		WaterKernels::FlowParams const	params = {1.0f, 1.0f, 9.81f / (1 / 1.5f), 9.81f / (1 / 1.5f),
+			std::sqrt(9.81f), std::sqrt(9.81f), limited};
+		std::uniform_real_distribution<float>	terrainDist(-5.0f, 10.0f);
+		std::uniform_real_distribution<float>	depthDist(0.0f, 4.0f);
+		WaterGrid	ref(width, height);
+		ref.fillPlane(WaterPlane::OUT_SCALE, 1.0f);
+		for (uint32_t v = 0; v < height; ++v) {
+			for (uint32_t u = 0; u < width; ++u) {
+				ref.terrainH(u, v) = terrainDist(gen);
+				// a third of dry columns to get walls
+				ref.depth(u, v) = gen() % 3 == 0 ? 0.0f : depthDist(gen);
+			}
+		}
+		WaterGrid	res(ref);
+		if (sparse) {
+			res.resize(width, height, true);
+			for (uint32_t tv = 0; tv * WATER_GRID_TILE_SIZE < height; ++tv) {
+				for (uint32_t tu = 0; tu * WATER_GRID_TILE_SIZE < width; ++tu)
+					res.allocTile(tu, tv);
+			}
+			std::vector<float> values(width);
+			for (uint8_t plane = 0; plane < WaterPlane::COUNT; ++plane) {
+				for (uint32_t v = 0; v < height; ++v) {
+					ref.readRow(static_cast<WaterPlane::Enum>(plane), v, values.data());
+					res.writeRow(static_cast<WaterPlane::Enum>(plane), v, values.data());
+				}
+			}
+		}
+
+		for (uint8_t step = 0; step < KERNELS_NB_STEPS; ++step) {
+			for (uint32_t v = 0; v < height; ++v) {
+				scalarRef.flowRow(ref, v, 0, width, dtTime, params);
+				for (uint8_t i = 0; i < 3; ++i)
+					kernels.flowRow(res, v, spans[i], spans[i + 1], dtTime, params);
+			}
+			if (limited) {
+				for (uint32_t v = 0; v < height; ++v) {
+					scalarRef.limitRow(ref, v, 0, width, dtTime, gridArea, params);
+					for (uint8_t i = 0; i < 3; ++i)
+						kernels.limitRow(res, v, spans[i], spans[i + 1], dtTime, gridArea, params);
+				}
+			}
+			for (uint32_t v = 0; v < height; ++v) {
+				scalarRef.depthRow(ref, v, 0, width, dtTime, gridArea, params);
+				for (uint8_t i = 0; i < 3; ++i)
+					kernels.depthRow(res, v, spans[i], spans[i + 1], dtTime, gridArea, params);
+			}
+
+			for (WaterPlane::Enum plane : {WaterPlane::DEPTH, WaterPlane::L_FLOW, WaterPlane::T_FLOW}) {
+				for (uint32_t v = 0; v < height; ++v) {
+					for (uint32_t u = 0; u < width; ++u) {
+						float expected = ref.cell(plane, u, v);
+						float error = std::fabs(res.cell(plane, u, v) - expected)
+							/ std::max(1.0f, std::fabs(expected));
+						if (!(error <= maxError))  // also catch NaN
+							maxError = std::isnan(error) ? INFINITY : error;
+					}
+				}
+			}
+		}
+	}
+
+	std::vector<WaterValue> rainRef(width, 1.0f);
+	std::vector<WaterValue> rainRes(rainRef);
+	for (uint32_t threshold : {0u, 1u << 22, static_cast<uint32_t>(gen() % (1u << 24)), 1u << 24}) {
+		uint32_t key = gen();
+		uint32_t nbRef = scalarRef.rainRow(rainRef.data(), 0, width, key, threshold, 0.25f);
+		uint32_t nbRes = 0;
+		for (uint8_t i = 0; i < 3; ++i)
+			nbRes += kernels.rainRow(rainRes.data() + spans[i], spans[i], spans[i + 1], key, threshold, 0.25f);
+		if (nbRes != nbRef || rainRes != rainRef)
+			maxError = INFINITY;
+	}
+	return maxError;
+}
+
+/**
+ * @brief Check every vectorized kernels set supported by the cpu against the
+ * scalar kernels, on each border policy, then every set on a sparse grid
+ *
+ * @return EXIT_FAILURE if a set is above the tolerance
+ */
+int main() {
+	initLogs();
+
+	int ret = EXIT_SUCCESS;
+	uint32_t nbSets = 0;
+	for (bool sparse : {false, true}) {
+		for (uint8_t b = 0; b < WaterBoundary::COUNT; ++b) {
+			WaterBoundary::Enum boundary = static_cast<WaterBoundary::Enum>(b);
+			std::vector<WaterKernels::Kernels const *> sets = WaterKernels::supported(boundary);
+			// the scalar kernels split the rows in runs too
+			if (sparse)
+				sets.insert(sets.begin(), &WaterKernels::scalar(boundary));
+			for (WaterKernels::Kernels const * kernels : sets) {
+				std::mt19937 gen(42 + b);
+				float maxError = 0;
+				for (uint32_t i = 0; i < KERNELS_NB_GRIDS; ++i)
+					maxError = std::max(maxError, checkGrid(*kernels, gen, sparse));
+
+				bool ok = maxError <= KERNELS_TOLERANCE;
+				std::cout << kernels->name << " " << Water::boundaryName[b] << (sparse ? " sparse" : "")
+					<< ": max relative error " << maxError << (ok ? ", ok" : ", FAILED") << std::endl;
+				if (!ok)
+					ret = EXIT_FAILURE;
+				if (!sparse)
+					++nbSets;
+			}
+		}
+	}
+	if (nbSets == 0)
+		std::cout << "no vectorized water kernels on this cpu" << std::endl;
+	return ret;
+}